@@ -0,0 +1,221 @@
+//
+//  Allocator.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <cstdint>
+
+#include "Allocator.h"
+
+#pragma mark - Allocator
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+Allocator::Allocator(size_t capacity)
+		  :_used(0)
+		  ,_peak(0)
+		  ,_capacity(capacity)
+		  ,_failures(0)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+Allocator::~Allocator()
+	{}
+
+/*****************************************************************************\
+|* Hand out some memory, if it's within the cap
+\*****************************************************************************/
+void * Allocator::allocate(size_t bytes)
+	{
+	bytes = round(bytes);
+
+	void *ptr = nullptr;
+	if ((_capacity == 0) || (bytes <= _capacity - _used))
+		ptr = _allocate(bytes);
+
+	if (ptr == nullptr)
+		{
+		_failures ++;
+		return nullptr;
+		}
+
+	_used += bytes;
+	_peak  = MAX(_peak, _used);
+	return ptr;
+	}
+
+/*****************************************************************************\
+|* Give some back
+\*****************************************************************************/
+void Allocator::release(void *ptr, size_t bytes)
+	{
+	if (ptr == nullptr)
+		return;
+
+	bytes  = round(bytes);
+	_used -= bytes;
+	_release(ptr, bytes);
+	}
+
+/*****************************************************************************\
+|* How much more we could hand out
+\*****************************************************************************/
+size_t Allocator::available(void)
+	{
+	return (_capacity == 0) ? SIZE_MAX : _capacity - _used;
+	}
+
+/*****************************************************************************\
+|* The default
+\*****************************************************************************/
+Allocator * Allocator::heap(void)
+	{
+	static HeapAllocator heap;
+	return &heap;
+	}
+
+#pragma mark - HeapAllocator
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+HeapAllocator::HeapAllocator(size_t capacity)
+			  :Allocator(capacity)
+	{}
+
+/*****************************************************************************\
+|* Allocate from the heap
+\*****************************************************************************/
+void * HeapAllocator::_allocate(size_t bytes)
+	{
+	return malloc(bytes);
+	}
+
+/*****************************************************************************\
+|* Give back to the heap
+\*****************************************************************************/
+void HeapAllocator::_release(void *ptr, size_t)
+	{
+	free(ptr);
+	}
+
+#pragma mark - StaticPool
+
+/*****************************************************************************\
+|* Constructor: manage someone else's memory
+\*****************************************************************************/
+StaticPool::StaticPool(void *memory, size_t bytes)
+		   :Allocator(0)
+		   ,_base(nullptr)
+		   ,_owned(false)
+		   ,_free(nullptr)
+	{
+	_init(memory, bytes);
+	}
+
+/*****************************************************************************\
+|* Constructor: allocate the pool now, and never again
+\*****************************************************************************/
+StaticPool::StaticPool(size_t bytes)
+		   :Allocator(0)
+		   ,_base(nullptr)
+		   ,_owned(true)
+		   ,_free(nullptr)
+	{
+	bytes = round(bytes);
+	_init(malloc(bytes + ALIGN), bytes + ALIGN);
+	}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+StaticPool::~StaticPool()
+	{
+	if (_owned)
+		FREE(_base);
+	}
+
+/*****************************************************************************\
+|* Make the (aligned part of the) memory one big free block
+\*****************************************************************************/
+void StaticPool::_init(void *memory, size_t bytes)
+	{
+	_base = (char *) memory;
+	if (_base == nullptr)
+		return;
+
+	uintptr_t at	= (uintptr_t) _base;
+	uintptr_t start = (at + ALIGN - 1) & ~((uintptr_t)ALIGN - 1);
+	size_t usable	= (bytes - (start - at)) & ~((size_t)ALIGN - 1);
+
+	_free		= (Block *) start;
+	_free->size	= usable;
+	_free->next	= nullptr;
+	_capacity	= usable;
+	}
+
+/*****************************************************************************\
+|* First fit. Everything's a multiple of ALIGN, which is bigger than a Block,
+|* so whatever's left over is always big enough to stay on the free list
+\*****************************************************************************/
+void * StaticPool::_allocate(size_t bytes)
+	{
+	Block **link = &_free;
+	for (Block *block = _free; block != nullptr; block = block->next)
+		{
+		if (block->size >= bytes)
+			{
+			if (block->size == bytes)
+				*link = block->next;
+			else
+				{
+				Block *rest = (Block *)((char *) block + bytes);
+				rest->size	= block->size - bytes;
+				rest->next	= block->next;
+				*link		= rest;
+				}
+			return block;
+			}
+		link = &block->next;
+		}
+	return nullptr;
+	}
+
+/*****************************************************************************\
+|* Put a block back in address order, merging it with the free blocks either
+|* side of it
+\*****************************************************************************/
+void StaticPool::_release(void *ptr, size_t bytes)
+	{
+	Block *block = (Block *) ptr;
+	Block *prev	 = nullptr;
+	Block *next	 = _free;
+	while ((next != nullptr) && (next < block))
+		{
+		prev = next;
+		next = next->next;
+		}
+
+	block->size = bytes;
+	block->next = next;
+	if ((next != nullptr) && ((char *) block + block->size == (char *) next))
+		{
+		block->size += next->size;
+		block->next	 = next->next;
+		}
+
+	if (prev == nullptr)
+		_free = block;
+	else if ((char *) prev + prev->size == (char *) block)
+		{
+		prev->size += block->size;
+		prev->next	= block->next;
+		}
+	else
+		prev->next = block;
+	}
@@ -0,0 +1,204 @@
+//
+//  Allocator.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Allocator_h
+#define Allocator_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <type_traits>
+
+#include "properties.h"
+#include "macros.h"
+
+/*****************************************************************************\
+|* Where the editor's buffer storage comes from. Everything handed out is
+|* counted against an optional capacity, so the editor can be held to a
+|* memory budget and say how much of it it's using.
+|*
+|* Requests are rounded up to ALIGN bytes, and the size has to be given back
+|* on release, which saves the pools from keeping a header per block. A
+|* request that can't be met (over capacity, or out of memory) returns
+|* nullptr rather than throwing.
+|*
+|* There are two kinds:
+|*
+|*  - HeapAllocator: malloc() and free(), with an optional cap
+|*  - StaticPool:    first-fit within one block of memory that's either
+|*                   handed in (say a static array on a target without a
+|*                   heap) or allocated once up front. Freed blocks are
+|*                   merged with their neighbours so long sessions don't
+|*                   fragment the pool
+\*****************************************************************************/
+class Allocator
+	{
+    NON_COPYABLE_NOR_MOVEABLE(Allocator)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			ALIGN			= 16			// Granularity of allocations
+			};
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(size_t, used);					// Bytes handed out
+    GET(size_t, peak);					// ... at most, so far
+    GET(size_t, capacity);				// Most we'll hand out, 0 for any
+    GET(size_t, failures);				// Requests we couldn't meet
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit Allocator(size_t capacity = 0);
+        virtual ~Allocator();
+
+        /*********************************************************************\
+        |* Get and give back memory
+        \*********************************************************************/
+		void * allocate(size_t bytes);
+		void release(void *ptr, size_t bytes);
+
+        /*********************************************************************\
+        |* How much more we could hand out
+        \*********************************************************************/
+		size_t available(void);
+
+        /*********************************************************************\
+        |* The default: the heap, uncapped
+        \*********************************************************************/
+		static Allocator * heap(void);
+
+        /*********************************************************************\
+        |* Round a request up to the allocation granularity
+        \*********************************************************************/
+		static inline size_t round(size_t bytes)
+			{ return (MAX(bytes, (size_t)1) + ALIGN - 1) & ~((size_t)ALIGN - 1); }
+
+    protected:
+        /*********************************************************************\
+        |* What the subclasses provide. Sizes are already rounded
+        \*********************************************************************/
+		virtual void * _allocate(size_t bytes) = 0;
+		virtual void _release(void *ptr, size_t bytes) = 0;
+	};
+
+/*****************************************************************************\
+|* The heap, with an optional cap
+\*****************************************************************************/
+class HeapAllocator : public Allocator
+	{
+    NON_COPYABLE_NOR_MOVEABLE(HeapAllocator)
+
+    public:
+        explicit HeapAllocator(size_t capacity = 0);
+
+    protected:
+		virtual void * _allocate(size_t bytes) override;
+		virtual void _release(void *ptr, size_t bytes) override;
+	};
+
+/*****************************************************************************\
+|* A fixed pool of memory
+\*****************************************************************************/
+class StaticPool : public Allocator
+	{
+    NON_COPYABLE_NOR_MOVEABLE(StaticPool)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    protected:
+		typedef struct Block
+			{
+			size_t					size;	// Bytes free here
+			struct Block *			next;	// Next free block up
+			} Block;
+
+    protected:
+		char *				_base;			// The pool
+		bool				_owned;			// ... which we allocated
+		Block *				_free;			// Free blocks, in address order
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor: manage the given memory, or allocate
+        |* 'bytes' of our own up front
+        \*********************************************************************/
+        explicit StaticPool(void *memory, size_t bytes);
+        explicit StaticPool(size_t bytes);
+        virtual ~StaticPool();
+
+    protected:
+		virtual void * _allocate(size_t bytes) override;
+		virtual void _release(void *ptr, size_t bytes) override;
+
+    private:
+		void _init(void *memory, size_t bytes);
+	};
+
+/*****************************************************************************\
+|* Lets standard containers draw on an Allocator. There's no way to report
+|* failure through a container, so running out here aborts; callers with a
+|* budget check for room before they grow anything
+\*****************************************************************************/
+template <typename T>
+class StlAllocator
+	{
+    public:
+		typedef T				value_type;
+		typedef std::true_type	propagate_on_container_copy_assignment;
+		typedef std::true_type	propagate_on_container_move_assignment;
+		typedef std::true_type	propagate_on_container_swap;
+
+		Allocator *				allocator;
+
+		StlAllocator(Allocator *allocator = Allocator::heap())
+			:allocator(allocator)
+			{}
+
+		template <typename U>
+		StlAllocator(const StlAllocator<U>& other)
+			:allocator(other.allocator)
+			{}
+
+		T * allocate(size_t n)
+			{
+			void *ptr = allocator->allocate(n * sizeof(T));
+			if (ptr == nullptr)
+				abort();
+			return (T *) ptr;
+			}
+
+		void deallocate(T *ptr, size_t n)
+			{
+			allocator->release(ptr, n * sizeof(T));
+			}
+
+		template <typename U>
+		bool operator == (const StlAllocator<U>& other) const
+			{ return allocator == other.allocator; }
+
+		template <typename U>
+		bool operator != (const StlAllocator<U>& other) const
+			{ return allocator != other.allocator; }
+	};
+
+/*****************************************************************************\
+|* A string drawing on an Allocator
+\*****************************************************************************/
+typedef std::basic_string<char, std::char_traits<char>, StlAllocator<char>>
+		PooledString;
+
+#endif /* Allocator_h */
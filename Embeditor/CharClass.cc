@@ -0,0 +1,143 @@
+//
+//  CharClass.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include "CharClass.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
+
+/*****************************************************************************\
+|* Fold ASCII upper case to lower case. The vector paths add 0x20 to every
+|* byte in 'A'..'Z', which is the same as the table for ASCII and leaves
+|* anything with the top bit set alone
+\*****************************************************************************/
+void CharClass::fold(const char *src, char *dst, size_t len)
+	{
+	size_t i = 0;
+
+	#if defined(__SSE2__)
+		const __m128i a1	= _mm_set1_epi8('A' - 1);
+		const __m128i z1	= _mm_set1_epi8('Z' + 1);
+		const __m128i bit	= _mm_set1_epi8(0x20);
+
+		for (; i + 16 <= len; i += 16)
+			{
+			__m128i v	 = _mm_loadu_si128((const __m128i *)(src + i));
+			__m128i isUC = _mm_and_si128(_mm_cmpgt_epi8(v, a1),
+										 _mm_cmplt_epi8(v, z1));
+			v = _mm_or_si128(v, _mm_and_si128(isUC, bit));
+			_mm_storeu_si128((__m128i *)(dst + i), v);
+			}
+	#elif defined(__ARM_NEON)
+		const uint8x16_t a	= vdupq_n_u8('A');
+		const uint8x16_t n	= vdupq_n_u8('Z' - 'A');
+		const uint8x16_t bit = vdupq_n_u8(0x20);
+
+		for (; i + 16 <= len; i += 16)
+			{
+			uint8x16_t v	= vld1q_u8((const uint8_t *)(src + i));
+			uint8x16_t isUC	= vcleq_u8(vsubq_u8(v, a), n);
+			v = vorrq_u8(v, vandq_u8(isUC, bit));
+			vst1q_u8((uint8_t *)(dst + i), v);
+			}
+	#endif
+
+	for (; i < len; i++)
+		dst[i] = (char) folded[(uint8_t)src[i]];
+	}
+
+#if defined(__ARM_NEON)
+/*****************************************************************************\
+|* NEON has no movemask, but narrowing each 16-bit lane by 4 leaves a nybble
+|* per byte, so the first set byte is the lowest set bit over 4
+\*****************************************************************************/
+static inline uint64_t nybbles(uint8x16_t eq)
+	{
+	uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+	}
+#endif
+
+/*****************************************************************************\
+|* The first byte that's 'a' or 'b'
+\*****************************************************************************/
+size_t CharClass::find(const char *src, size_t len, char a, char b)
+	{
+	size_t i = 0;
+
+	#if defined(__SSE2__)
+		const __m128i va	= _mm_set1_epi8(a);
+		const __m128i vb	= _mm_set1_epi8(b);
+
+		for (; i + 16 <= len; i += 16)
+			{
+			__m128i v	= _mm_loadu_si128((const __m128i *)(src + i));
+			int hits	= _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+														 _mm_cmpeq_epi8(v, vb)));
+			if (hits != 0)
+				return i + __builtin_ctz(hits);
+			}
+	#elif defined(__ARM_NEON)
+		const uint8x16_t va	= vdupq_n_u8((uint8_t) a);
+		const uint8x16_t vb	= vdupq_n_u8((uint8_t) b);
+
+		for (; i + 16 <= len; i += 16)
+			{
+			uint8x16_t v	= vld1q_u8((const uint8_t *)(src + i));
+			uint64_t hits	= nybbles(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)));
+			if (hits != 0)
+				return i + (__builtin_ctzll(hits) >> 2);
+			}
+	#endif
+
+	for (; i < len; i++)
+		if ((src[i] == a) || (src[i] == b))
+			break;
+	return i;
+	}
+
+/*****************************************************************************\
+|* The first byte that's neither 'a' nor 'b'
+\*****************************************************************************/
+size_t CharClass::skip(const char *src, size_t len, char a, char b)
+	{
+	size_t i = 0;
+
+	#if defined(__SSE2__)
+		const __m128i va	= _mm_set1_epi8(a);
+		const __m128i vb	= _mm_set1_epi8(b);
+
+		for (; i + 16 <= len; i += 16)
+			{
+			__m128i v	= _mm_loadu_si128((const __m128i *)(src + i));
+			int same	= _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+														 _mm_cmpeq_epi8(v, vb)));
+			if (same != 0xFFFF)
+				return i + __builtin_ctz(~same);
+			}
+	#elif defined(__ARM_NEON)
+		const uint8x16_t va	= vdupq_n_u8((uint8_t) a);
+		const uint8x16_t vb	= vdupq_n_u8((uint8_t) b);
+
+		for (; i + 16 <= len; i += 16)
+			{
+			uint8x16_t v	= vld1q_u8((const uint8_t *)(src + i));
+			uint8x16_t same	= vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb));
+			uint64_t other	= nybbles(vmvnq_u8(same));
+			if (other != 0)
+				return i + (__builtin_ctzll(other) >> 2);
+			}
+	#endif
+
+	for (; i < len; i++)
+		if ((src[i] != a) && (src[i] != b))
+			break;
+	return i;
+	}
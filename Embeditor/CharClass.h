@@ -0,0 +1,132 @@
+//
+//  CharClass.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef CharClass_h
+#define CharClass_h
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*****************************************************************************\
+|* Character classification by table lookup. This is shared between the
+|* syntax highlighter and the search code so both agree on what a separator
+|* or a word character is, and neither has to call strchr() or the locale-
+|* dependent ctype functions per character
+\*****************************************************************************/
+class CharClass
+	{
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			CC_SPACE		= (1<<0),		// isspace()
+			CC_SEPARATOR	= (1<<1),		// Ends a keyword or number
+			CC_DIGIT		= (1<<2),		// 0-9
+			CC_UPPER		= (1<<3),		// A-Z
+			CC_LOWER		= (1<<4),		// a-z
+			CC_WORD			= (1<<5)		// Part of an identifier
+			};
+
+		typedef std::array<uint8_t, 256> Table;
+
+    private:
+        /*********************************************************************\
+        |* Build the tables at compile time
+        \*********************************************************************/
+		static constexpr Table _classes(void)
+			{
+			Table t = {};
+			const char *seps = ",.()+-/*=~%<>[];";
+
+			for (int c = 0; c < 256; c++)
+				{
+				bool space = (c == ' ') || ((c >= '\t') && (c <= '\r'));
+				bool upper = (c >= 'A') && (c <= 'Z');
+				bool lower = (c >= 'a') && (c <= 'z');
+				bool digit = (c >= '0') && (c <= '9');
+
+				uint8_t cls = 0;
+				if (space)
+					cls |= CC_SPACE | CC_SEPARATOR;
+				if (upper)
+					cls |= CC_UPPER | CC_WORD;
+				if (lower)
+					cls |= CC_LOWER | CC_WORD;
+				if (digit)
+					cls |= CC_DIGIT | CC_WORD;
+				if ((c == '_') || (c >= 0x80))
+					cls |= CC_WORD;
+				if (c == '\0')
+					cls |= CC_SEPARATOR;
+				for (const char *s = seps; *s; s++)
+					if (*s == c)
+						cls |= CC_SEPARATOR;
+				t[c] = cls;
+				}
+			return t;
+			}
+
+		static constexpr Table _folded(void)
+			{
+			Table t = {};
+			for (int c = 0; c < 256; c++)
+				t[c] = ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+			return t;
+			}
+
+    public:
+		static const Table classes;
+		static const Table folded;
+
+        /*********************************************************************\
+        |* Lookups
+        \*********************************************************************/
+		static constexpr bool isSpace(int c)
+			{
+			return (classes[(uint8_t)c] & CC_SPACE) != 0;
+			}
+
+		static constexpr bool isSeparator(int c)
+			{
+			return (classes[(uint8_t)c] & CC_SEPARATOR) != 0;
+			}
+
+		static constexpr bool isWord(int c)
+			{
+			return (classes[(uint8_t)c] & CC_WORD) != 0;
+			}
+
+		static constexpr bool isDigit(int c)
+			{
+			return (classes[(uint8_t)c] & CC_DIGIT) != 0;
+			}
+
+		static constexpr uint8_t fold(int c)
+			{
+			return folded[(uint8_t)c];
+			}
+
+        /*********************************************************************\
+        |* Fold ASCII case over a buffer, a vector at a time where we can
+        \*********************************************************************/
+		static void fold(const char *src, char *dst, size_t len);
+
+        /*********************************************************************\
+        |* Where the first byte that is (find) or isn't (skip) 'a' or 'b' is,
+        |* or 'len' if there isn't one, a vector at a time where we can
+        \*********************************************************************/
+		static size_t find(const char *src, size_t len, char a, char b);
+		static size_t skip(const char *src, size_t len, char a, char b);
+	};
+
+inline constexpr CharClass::Table CharClass::classes = CharClass::_classes();
+inline constexpr CharClass::Table CharClass::folded	= CharClass::_folded();
+
+#endif /* CharClass_h */
@@ -0,0 +1,127 @@
+//
+//  Diff.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include "Diff.h"
+#include "macros.h"
+
+/*****************************************************************************\
+|* FNV-1a
+\*****************************************************************************/
+uint64_t Diff::hash(const char *text, int len)
+	{
+	uint64_t h = 14695981039346656037ull;
+	for (int i=0; i<len; i++)
+		{
+		h ^= (uint8_t) text[i];
+		h *= 1099511628211ull;
+		}
+	return h;
+	}
+
+/*****************************************************************************\
+|* Myers' greedy diff. trace[d] holds the furthest x reached on each diagonal
+|* k (-d..d) after d edits, which is all we need to walk back from the end
+|* and find the snakes (runs of matching lines). The hunks are the gaps
+|* between them
+\*****************************************************************************/
+bool Diff::lines(const HashList& a, const HashList& b, int base, HunkList& hunks)
+	{
+	int n = (int) a.size();
+	int m = (int) b.size();
+	
+	if ((n == 0) || (m == 0))
+		{
+		if (n + m > 0)
+			hunks.push_back({base, n, base, m});
+		return true;
+		}
+	
+	int max		= MIN(n + m, (int) MAX_COST);
+	int offset	= max + 1;
+	std::vector<int> v(2 * max + 3, 0);
+	std::vector<std::vector<int>> trace;
+	
+	bool done = false;
+	for (int d = 0; (d <= max) && !done; d++)
+		{
+		std::vector<int> furthest(2 * d + 1);
+		for (int k = -d; k <= d; k += 2)
+			{
+			int x;
+			if ((k == -d) || ((k != d) && (v[offset+k-1] < v[offset+k+1])))
+				x = v[offset + k + 1];
+			else
+				x = v[offset + k - 1] + 1;
+			
+			int y = x - k;
+			while ((x < n) && (y < m) && (a[x] == b[y]))
+				{
+				x ++;
+				y ++;
+				}
+			
+			v[offset + k]	= x;
+			furthest[k + d]	= x;
+			if ((x >= n) && (y >= m))
+				{
+				done = true;
+				break;
+				}
+			}
+		trace.push_back(std::move(furthest));
+		}
+	
+	if (!done)
+		{
+		hunks.push_back({base, n, base, m});
+		return false;
+		}
+	
+	// Walk back collecting the snakes, as (start x, start y, end x)
+	std::vector<int> snakes;
+	int x = n;
+	int y = m;
+	for (int d = (int) trace.size() - 1; d > 0; d--)
+		{
+		const std::vector<int>& prev = trace[d - 1];
+		int k = x - y;
+		int prevK;
+		if ((k == -d) || ((k != d) && (prev[k-1 + d-1] < prev[k+1 + d-1])))
+			prevK = k + 1;
+		else
+			prevK = k - 1;
+		
+		int prevX	= prev[prevK + d - 1];
+		int prevY	= prevX - prevK;
+		int midX	= (prevK == k + 1) ? prevX : prevX + 1;
+		int midY	= midX - k;
+		
+		if (x > midX)
+			snakes.insert(snakes.end(), {midX, midY, x});
+		x = prevX;
+		y = prevY;
+		}
+	if (x > 0)
+		snakes.insert(snakes.end(), {0, 0, x});
+	
+	// The snakes came out backwards. Anything between them is a hunk
+	int px = 0;
+	int py = 0;
+	for (int i = (int) snakes.size() - 3; i >= -3; i -= 3)
+		{
+		int sx = (i >= 0) ? snakes[i]	  : n;
+		int sy = (i >= 0) ? snakes[i + 1] : m;
+		if ((sx > px) || (sy > py))
+			hunks.push_back({base + px, sx - px, base + py, sy - py});
+		if (i >= 0)
+			{
+			px = snakes[i + 2];
+			py = px - (sx - sy);
+			}
+		}
+	return true;
+	}
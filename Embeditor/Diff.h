@@ -0,0 +1,60 @@
+//
+//  Diff.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Diff_h
+#define Diff_h
+
+#include <cstdint>
+#include <vector>
+
+/*****************************************************************************\
+|* Line diffs, for bringing the rows in memory up to date with a file that's
+|* been changed on disk without reloading all of it. Lines are compared by
+|* hash, and the diff itself is Myers' O((N+M)D) algorithm, which is quick
+|* when the two versions are close. If they're not (more than MAX_COST lines
+|* inserted or deleted) we give up and report one hunk covering everything.
+\*****************************************************************************/
+class Diff
+	{
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			MAX_COST		= 1024			// Edits before we stop looking
+			};
+
+		typedef struct Hunk
+			{
+			int						oldStart;	// First line replaced
+			int						oldCount;	// ... and how many
+			int						newStart;	// First line replacing them
+			int						newCount;	// ... and how many
+			} Hunk;
+
+		typedef std::vector<Hunk> HunkList;
+		typedef std::vector<uint64_t> HashList;
+
+    public:
+        /*********************************************************************\
+        |* Hash a line
+        \*********************************************************************/
+		static uint64_t hash(const char *text, int len);
+
+        /*********************************************************************\
+        |* Diff two runs of line hashes, appending the hunks (in order) to
+        |* 'hunks'. Line numbers are offset by 'base'. Returns false if the
+        |* diff was too costly and we fell back to replacing everything
+        \*********************************************************************/
+		static bool lines(const HashList& a,
+						  const HashList& b,
+						  int base,
+						  HunkList& hunks);
+	};
+
+#endif /* Diff_h */
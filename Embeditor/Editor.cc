@@ -6,14 +6,22 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstring>
 
 #include <ctype.h>
 #include <cstdio>
 #include <stdarg.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
+#include "CharClass.h"
+#include "Diff.h"
 #include "Editor.h"
+#include "Languages.h"
+#include "Search.h"
+#include "Utf8.h"
 
 #ifdef TERMIOS
 static struct termios orig_termios;
@@ -35,39 +43,59 @@ static void disableRawMode(void)
 	
 #endif
 
+
+
+#define WELCOME_FMT 		"Editor -- version %s"
+#define EDIT_VERSION		"0.0.1"
+#define EDIT_QUIT_TIMES		3
+#define EDIT_UNDO_LEVELS	1000
+#define RENDER_CACHE_ROWS	256
+#define MEMORY_LOW			8		// Shed caches with 1/8 of the budget left
+#define MEMORY_FLOOR		32		// Refuse edits with 1/32 of it left
+#define EDIT_OVERHEAD		256		// Bytes to log an edit, give or take
+#define SYNC_HIGHLIGHT_ROWS	2000	// Most rows an edit highlights itself
+#define HIGHLIGHT_CACHE_ROWS 1024	// Rows' highlighting remembered
+#define MAX_PENDING_HEREDOCS 4		// Heredocs one row can start
+#define MAX_RAW_DELIMITER	16		// As in C++
+#define BENCHMARK_SECONDS	0.5		// Per language and pass
+#define DETECT_BYTES		65536	// Looked at to see what a big file is
+#define HEX_ROW_BYTES		16		// Bytes to a row in hex mode
+#define CTRL_KEY(k) 		((k) & 0x1f)
+
 /*****************************************************************************\
-|* Highlighting patterns. Should probably put these into a set of files
-|* in /usr/share at some point
+|* Colour map for different types of highlight
 \*****************************************************************************/
-std::vector<std::string> C_HL_extensions =
+const Editor::Theme Editor::defaultTheme =
 	{
-	".c", ".h", ".cpp", ".cc"
-	};
-	
-std::vector<std::string> C_HL_keywords =
-	{
-	"switch", "if", "while", "for", "break", "continue", "return", "else",
-	"struct", "union", "typedef", "static", "enum", "class", "case",
-	"int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
-	"void|"
+	0,			// HL_NORMAL
+	36,			// HL_COMMENT
+	36,			// HL_MLCOMMENT
+	33,			// HL_KEYWORD1
+	32,			// HL_KEYWORD2
+	35,			// HL_STRING
+	31,			// HL_NUMBER
+	95,			// HL_CONSTANT
+	96,			// HL_VARIABLE
+	91,			// HL_ERROR
+	93,			// HL_WARNING
+	34			// HL_MATCH
 	};
 
-struct Editor::Syntax HLDB[] =
+/*****************************************************************************\
+|* The built-in languages, in the order they're tried, each with a
+|* highlighter of its own
+\*****************************************************************************/
+const Editor::Language Editor::_languages[] =
 	{
-		{
-		"c", C_HL_extensions, C_HL_keywords, "//", "/*", "*/",
-		Editor::HIGHLIGHT_NUMBERS | Editor::HIGHLIGHT_STRINGS
-		},
+		{&Languages::C,			&Editor::_highlight<&Languages::C>},
+		{&Languages::CPP,		&Editor::_highlight<&Languages::CPP>},
+		{&Languages::PYTHON,	&Editor::_highlight<&Languages::PYTHON>},
+		{&Languages::SHELL,		&Editor::_highlight<&Languages::SHELL>},
+		{&Languages::JSON,		&Editor::_highlight<&Languages::JSON>},
+		{&Languages::YAML,		&Editor::_highlight<&Languages::YAML>},
+		{&Languages::LOG,		&Editor::_highlight<&Languages::LOG>}
 	};
 
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
-
-
-#define WELCOME_FMT 		"Editor -- version %s"
-#define EDIT_VERSION		"0.0.1"
-#define EDIT_QUIT_TIMES		3
-#define CTRL_KEY(k) 		((k) & 0x1f)
-
 /*****************************************************************************\
 |* Constructor
 \*****************************************************************************/
@@ -84,9 +112,96 @@ Editor::Editor()
 	   ,_status("")
 	   ,_statusTime(0)
 	   ,_syntax(nullptr)
+	   ,_highlightCache(HIGHLIGHT_CACHE_ROWS)
+	   ,_allocator(Allocator::heap())
 	   ,_tabStop(4)
+	   ,_theme(&defaultTheme)
+	   ,_useIndex(false)
+	   ,_searchFlags(0)
+	   ,_paging(false)
+	   ,_windowStart(0)
+	   ,_following(false)
+	   ,_tailOffset(0)
+	   ,_tailPartial(false)
+	   ,_encoding(Utf8::ENC_UTF8)
+	   ,_bom(false)
+	   ,_hexMode(false)
+	   ,_wrapping(false)
+	   ,_foldedRow(-1)
+	   ,_pagerRows(0)
+	   ,_tailPending(false)
+	   ,_diskChanged(false)
+	   ,_waitingForKey(false)
+	   ,_rendered(RENDER_CACHE_ROWS, {.row		= -1,
+									  .stops	= StopList(),
+									  .spans	= SpanList()})
+	   ,_renderedAny(false)
+	   ,_matchRow(-1)
+	   ,_matchCx(0)
+	   ,_matchLen(0)
+	   ,_highlighter(nullptr)
+	   ,_highlighted(0)
+	   ,_highlightSeen(0)
+	   ,_highlightCancel(false)
+	   ,_backgroundCache(HIGHLIGHT_CACHE_ROWS)
+	   ,_previewTop(0)
+	   ,_previewDone(0)
+	   ,_previewSeen(0)
+	   ,_hexOnly(false)
+	   ,_hexCursor(0)
+	   ,_hexTop(0)
+	   ,_hexLow(false)
+	   ,_hexAscii(false)
+	   ,_wrapOffset(0)
+	   ,_wrapY(0)
 	{}
 
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+Editor::~Editor()
+	{
+	_stopHighlighting();
+	}
+
+/*****************************************************************************\
+|* Use a different allocator for the document
+\*****************************************************************************/
+void Editor::setAllocator(Allocator *allocator)
+	{
+	_stopHighlighting();
+	_allocator	 = allocator;
+	_highlighted = 0;
+	_rows.setAllocator(allocator);
+	_hex.setAllocator(allocator);
+	_wraps.setAllocator(allocator);
+	_lexerStates.setAllocator(allocator);
+	_highlightCache.setAllocator(allocator);
+	_backgroundCache.setAllocator(allocator);
+	
+	// Containers keep the allocator they're made with, so make new ones
+	_undo	= EditBatchList(StlAllocator<EditBatch>(allocator));
+	_redo	= EditBatchList(StlAllocator<EditBatch>(allocator));
+	_batch.edits = EditList(StlAllocator<Edit>(allocator));
+	for (Rendered& entry : _rendered)
+		{
+		entry.stops	= StopList(StlAllocator<Stop>(allocator));
+		entry.spans	= SpanList(StlAllocator<Span>(allocator));
+		}
+	_folded			= PooledString(StlAllocator<char>(allocator));
+	_frame			= PooledString(StlAllocator<char>(allocator));
+	}
+
+/*****************************************************************************\
+|* Load syntax definitions, and pick again for whatever's open
+\*****************************************************************************/
+int Editor::loadSyntax(std::string directory)
+	{
+	int loaded = _syntaxFiles.load(directory);
+	_selectSyntaxHighlight();
+	return loaded;
+	}
+
 /*****************************************************************************\
 |* Open a file to edit
 \*****************************************************************************/
@@ -97,28 +212,272 @@ void Editor::open(std::string filename)
 
 	#ifdef TERMIOS
 		FILE *fp = fopen(filename.c_str(), "r");
-		if (fp == nullptr)
+		struct stat sb;
+		if ((fp == nullptr) || (fstat(fileno(fp), &sb) != 0))
 			die("fopen()");
 		
-		char *line 		= nullptr;
-		size_t lineCap	= 0;
-		ssize_t lineLen;
-		while ((lineLen = getline(&line, &lineCap, fp)) != -1)
+		// Loading isn't an edit, so rather than going through _insertRow()
+		// and the undo log, the file is read into the line store in one go
+		// and the rows just point into it
+		_stopHighlighting();
+		char *data	= _rows.buffer(sb.st_size);
+		size_t size	= (data == nullptr) ? 0 : fread(data, 1, sb.st_size, fp);
+		fclose(fp);
+		
+		// Binary isn't edited, and Latin-1 is held as UTF-8 (and turned
+		// back when it's saved), so find out which before anything else
+		size_t bom		= 0;
+		size_t onDisk	= size;
+		_encoding		= Utf8::detect(data, size, &bom);
+		_bom			= (bom > 0);
+		if (_encoding == Utf8::ENC_BINARY)
 			{
-			while ((lineLen >0) &&
-				   ((line[lineLen-1] == '\n') || (line[lineLen-1] == '\r')))
-				{
-				lineLen --;
-				}
-			_insertRow(std::string(line, lineLen), (int)_rows.size());
+			_rows.clear();
+			hex(filename);
+			setStatus("'%s' looks binary: editing it in hex", filename.c_str());
+			return;
 			}
-		FREE(line);
-		fclose(fp);
-		_dirty = 0;
+		if (_encoding == Utf8::ENC_LATIN1)
+			{
+			std::string raw(data, size);
+			_rows.clear();
+			data = _rows.buffer(size + Utf8::latin1Growth(raw.data(), size));
+			size = (data == nullptr) ? 0
+									 : Utf8::fromLatin1(raw.data(), size, data);
+			}
+		
+		const char *end	= data + size;
+		int lines		= 0;
+		for (const char *p = data; p < end; p++)
+			{
+			p = (const char *) memchr(p, '\n', end - p);
+			if (p == nullptr)
+				break;
+			lines ++;
+			}
+		
+		// If it won't fit in the memory budget, it can still be viewed
+		if ((data == nullptr)
+		 || (_rows.growth(lines + 1) + _allocator->capacity() / MEMORY_LOW
+				> _allocator->available()))
+			{
+			_rows.clear();
+			view(filename);
+			setStatus("'%s' is too big for the memory budget: viewing it "
+					  "read-only", filename.c_str());
+			return;
+			}
+		_rows.reserve(lines + 1);
+		
+		for (const char *p = data + bom; p < end; )
+			{
+			const char *nl	= (const char *) memchr(p, '\n', end - p);
+			const char *eol	= (nl == nullptr) ? end : nl;
+			size_t len		= eol - p;
+			while ((len > 0) && (p[len - 1] == '\r'))
+				len --;
+			
+			_rows.push(p, len);
+			p = eol + 1;
+			}
+		
+		_tailOffset	 = onDisk;
+		_tailPartial = (size > 0) && (data[size - 1] != '\n');
+		_wraps.forget();
+		_rehighlight();
+		_dirty 			= 0;
+		_diskChanged	= false;
+		_watcher.watch(filename);
+		
+		// The index is built from the bytes on disk, so it only matches the
+		// rows if they're the same bytes
+		if (_useIndex && (_encoding == Utf8::ENC_UTF8) && !_bom)
+			_index.build(filename, (int)_rows.size());
+		
+		_journal.begin(filename);
+		if (_journal.exists())
+			_recover();
+		if (_encoding == Utf8::ENC_LATIN1)
+			setStatus("'%s' isn't UTF-8: reading it as Latin-1",
+					  filename.c_str());
 	#else
 	#endif
 	}
+
+/*****************************************************************************\
+|* View a file read-only. Only a window of rows around the cursor is ever
+|* loaded into _rows, and the pager fetches them from disk on demand
+\*****************************************************************************/
+void Editor::view(std::string filename)
+	{
+	_filename = filename;
+	_selectSyntaxHighlight();
+	
+	if (!_pager.open(filename))
+		die("open()");
+	
+	// Only the start of a file this big is looked at, up to the last
+	// whole line so nothing's cut in half
+	std::string head(DETECT_BYTES, '\0');
+	ssize_t got = pread(_pager.fd(), head.data(), head.length(), 0);
+	head.resize(MAX(got, (ssize_t) 0));
+	size_t nl = head.rfind('\n');
+	if ((nl != std::string::npos) && (head.length() == (size_t) DETECT_BYTES))
+		head.resize(nl + 1);
+	
+	size_t bom	= 0;
+	_encoding	= Utf8::detect(head.data(), head.length(), &bom);
+	_bom		= (bom > 0);
+	if (_encoding == Utf8::ENC_BINARY)
+		{
+		_pager.close();
+		hex(filename, true);
+		setStatus("'%s' looks binary: viewing it in hex", filename.c_str());
+		return;
+		}
+	
+	_stopHighlighting();
+	_paging 	 = true;
+	_windowStart = 0;
+	_rows.clear();
+	_wraps.forget();
+	_dirty		 = 0;
+	}
+
+/*****************************************************************************\
+|* Edit a file in hex. Nothing is read until it's drawn
+\*****************************************************************************/
+void Editor::hex(std::string filename, bool readOnly)
+	{
+	if (!_hex.open(filename, readOnly))
+		die("open()");
+	
+	_filename	= filename;
+	_hexMode	= true;
+	_hexOnly	= true;
+	_hexCursor	= 0;
+	_hexTop		= 0;
+	_hexLow		= false;
+	_hexAscii	= false;
+	_dirty		= 0;
+	}
+
+/*****************************************************************************\
+|* Start or stop wrapping long rows. The rows are drawn a line at a time
+|* rather than sideways, so what was rendered for one way won't do
+\*****************************************************************************/
+void Editor::wrap(bool on)
+	{
+	_wrapping	= on;
+	_wrapOffset	= 0;
+	_colOffset	= 0;
+	_forgetRendered();
+	}
+
+/*****************************************************************************\
+|* Start or stop following the end of the file
+\*****************************************************************************/
+void Editor::follow(bool on)
+	{
+	if (on && (_filename.length() > 0))
+		{
+		_following 	 = _watcher.watching() || _watcher.watch(_filename);
+		_tailPending = _following;
+		}
+	else
+		{
+		// An edited file is always watched for changes, a viewed one
+		// only while it's followed
+		_following = false;
+		if (_paging)
+			_watcher.stop();
+		}
+	}
 		
+/*****************************************************************************\
+|* Time the highlighters over a file, in each built-in language and each
+|* that's been loaded. Each goes over the rows as the background worker
+|* does (just the state) and as drawing does (with spans), without the
+|* cache, over and over until there's a steady figure
+\*****************************************************************************/
+void Editor::benchmark(std::string filename)
+	{
+	FILE *fp = fopen(filename.c_str(), "r");
+	if (fp == nullptr)
+		{
+		perror(filename.c_str());
+		return;
+		}
+	
+	std::string data;
+	char buf[64 * 1024];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.append(buf, got);
+	fclose(fp);
+	
+	std::vector<std::string_view> rows;
+	size_t bytes = 0;
+	for (size_t from = 0; from < data.length(); )
+		{
+		size_t nl = data.find('\n', from);
+		if (nl == std::string::npos)
+			nl = data.length();
+		rows.push_back(std::string_view(data).substr(from, nl - from));
+		bytes += nl - from;
+		from   = nl + 1;
+		}
+	
+	const Syntax *syntax	= _syntax;
+	Highlighter highlighter	= _highlighter;
+	SpanList spans	= SpanList(StlAllocator<Span>(_allocator));
+	
+	auto time = [&](const Syntax *language, Highlighter fn)
+		{
+		_syntax		 = language;
+		_highlighter = fn;
+		
+		double rate[2];
+		for (int pass = 0; pass < 2; pass++)
+			{
+			SpanList *into = (pass == 0) ? nullptr : &spans;
+			size_t done	   = 0;
+			auto start	   = std::chrono::steady_clock::now();
+			std::chrono::duration<double> took;
+			do
+				{
+				int state = 0;
+				for (std::string_view row : rows)
+					{
+					_lexerStates.reserve();
+					spans.clear();
+					state = (this->*fn)(row, into, state);
+					}
+				done += bytes;
+				took  = std::chrono::steady_clock::now() - start;
+				}
+			while (took.count() < BENCHMARK_SECONDS);
+			rate[pass] = done / took.count() / (1 << 20);
+			}
+		
+		printf("%-12.*s %12.1f %12.1f\n",
+			   (int) language->filetype.length(),
+			   language->filetype.data(),
+			   rate[0],
+			   rate[1]);
+		};
+	
+	printf("%s: %zu rows, %zu bytes\n", filename.c_str(), rows.size(), bytes);
+	printf("%-12s %12s %12s\n", "language", "state MB/s", "spans MB/s");
+	for (const Language& language : _languages)
+		time(language.syntax, language.highlighter);
+	for (int i = 0; i < _syntaxFiles.size(); i++)
+		time(&_syntaxFiles.at(i), &Editor::_highlight<nullptr>);
+	
+	_syntax		 = syntax;
+	_highlighter = highlighter;
+	}
+
 /*****************************************************************************\
 |* Set the status message
 \*****************************************************************************/
@@ -143,7 +502,9 @@ void Editor::edit(void)
 	_enableRawMode();
 	_windowSize(&_screenRows, &_screenCols);
 	
-	setStatus("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+	setStatus("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | "
+			  "Ctrl-R = replace | Ctrl-Z = undo | Ctrl-W = wrap | "
+			  "Ctrl-X = hex");
 	
 	for(;;)
 		{
@@ -171,26 +532,76 @@ void Editor::_save(void)
 				}
 			_selectSyntaxHighlight();
 			}
+		
+		// Don't silently overwrite someone else's changes
+		if (_watcher.poll() != 0)
+			_diskChanged = true;
+		if (_diskChanged)
+			{
+			setStatus("'%s' has changed on disk. Overwrite it? (y/n)",
+					  _filename.c_str());
+			_refreshScreen();
+			
+			int key;
+			do
+				key = _readKey();
+			while (key == REFRESH_KEY);
+			
+			if ((key != 'y') && (key != 'Y'))
+				{
+				setStatus("Save aborted");
+				return;
+				}
+			}
 
 		FILE *fp = fopen(_filename.c_str(), "w");
 		if (fp != nullptr)
 			{
-			int totalBytes = 0;
-			for (Row& row : _rows)
+			off_t totalBytes	= 0;
+			int numRows			= _rows.size();
+			bool exact			= true;
+			std::string latin1;
+			if (_bom)
+				totalBytes += fwrite("\xEF\xBB\xBF", 1, Utf8::BOM_BYTES, fp);
+			for (int i = 0; i < numRows; i++)
 				{
-				int len = (int) row.chars.length();
-				totalBytes += len;
-				if (fwrite(row.chars.c_str(), 1, len, fp) != len)
+				std::string_view text = _rows.text(i);
+				if (_encoding == Utf8::ENC_LATIN1)
+					{
+					exact &= Utf8::toLatin1(text, latin1);
+					text   = latin1;
+					}
+				int len = (int) text.length();
+				totalBytes += len + 1;
+				if ((fwrite(text.data(), 1, len, fp) != (size_t) len)
+				 || (fputc('\n', fp) == EOF))
 					{
-					setStatus("Can't save! I/O error: %s [%d bytes saved]",
-							  strerror(errno), totalBytes);
+					setStatus("Can't save! I/O error: %s [%lld bytes saved]",
+							  strerror(errno), (long long) totalBytes);
 					fclose(fp);
 					return;
 					}
 				}
-			_dirty = 0;
+			_dirty 			= 0;
+			_diskChanged	= false;
+			_tailOffset		= totalBytes;
+			_tailPartial	= false;
 			fclose(fp);
-			setStatus("%d bytes written to disk", totalBytes);
+			
+			// The changes we just made aren't news
+			if (_watcher.watching())
+				_watcher.sync();
+			else
+				_watcher.watch(_filename);
+			
+			_journal.remove();
+			_journal.begin(_filename);
+			if (exact)
+				setStatus("%lld bytes written to disk", (long long) totalBytes);
+			else
+				setStatus("%lld bytes written to disk, as Latin-1: what it "
+						  "doesn't have was saved as '?'",
+						  (long long) totalBytes);
 			}
 		else
 			{
@@ -203,9 +614,13 @@ void Editor::_save(void)
 /*****************************************************************************\
 |* Prompt the user
 \*****************************************************************************/
-std::string Editor::_prompt(std::string prompt, Editor::promptCallback cb)
+std::string Editor::_prompt(std::string prompt,
+							Editor::promptCallback cb,
+							bool *cancelled)
 	{
 	std::string buf = "";
+	if (cancelled != nullptr)
+		*cancelled = false;
 	
 	while (true)
 		{
@@ -220,12 +635,16 @@ std::string Editor::_prompt(std::string prompt, Editor::promptCallback cb)
 			}
 		else if (c == '\x1b')
 			{
+			if (cancelled != nullptr)
+				*cancelled = true;
 			setStatus("");
 			return "";
 			}
 		else if (c == '\r')
 			{
-			if (buf.length() != 0)
+			// An empty answer is only valid if the caller can tell it apart
+			// from ESC
+			if ((buf.length() != 0) || (cancelled != nullptr))
 				{
 				setStatus("");
 				return buf;
@@ -237,7 +656,7 @@ std::string Editor::_prompt(std::string prompt, Editor::promptCallback cb)
 			buf.append(&ch, 1);
 			}
 		
-		if (cb != nullptr)
+		if (cb)
 			cb(buf, c);
 		}
 	}
@@ -247,21 +666,36 @@ std::string Editor::_prompt(std::string prompt, Editor::promptCallback cb)
 \*****************************************************************************/
 void Editor::_refreshScreen(void)
 	{
-	_scroll();
+	if (_hexMode)
+		_hexScroll();
+	else
+		_scroll();
 
-	std::string abuf = "";
+	// The buffer is kept from frame to frame, so it's only allocated once
+	PooledString& abuf = _frame;
+	abuf.clear();
 
 	// Hide the cursor and home
 	abuf.append("\x1b[?25l");
 	abuf.append("\x1b[H");
 
-	_drawRows(abuf);
+	if (_hexMode)
+		_hexDrawRows(abuf);
+	else
+		_drawRows(abuf);
 	_drawStatusBar(abuf);
 	_drawMessageBar(abuf);
 
 	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (_cy - _rowOffset) + 1,
-											  (_rx - _colOffset) + 1);
+	if (_hexMode)
+		snprintf(buf, sizeof(buf), "\x1b[%d;%dH",
+				 (int)(_hexCursor / HEX_ROW_BYTES - _hexTop) + 1,
+				 _hexColumn() + 1);
+	else if (_wrapping)
+		snprintf(buf, sizeof(buf), "\x1b[%d;%dH", _wrapY + 1, _rx + 1);
+	else
+		snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (_cy - _rowOffset) + 1,
+												  (_rx - _colOffset) + 1);
 	abuf.append(buf);
 	
 	// Show the cursor again
@@ -271,15 +705,17 @@ void Editor::_refreshScreen(void)
 	}
 
 /*****************************************************************************\
-|* Draw rows
+|* Draw rows. When wrapping, a screen line is a line of a row, and a row
+|* goes on down the screen until it runs out of lines
 \*****************************************************************************/
-void Editor::_drawRows(std::string& buf)
+void Editor::_drawRows(PooledString& buf)
 	{
-	int numRows = (int) _rows.size();
+	int numRows = _numRows();
+	int filerow = _rowOffset;
+	int line	= _wrapping ? _wrapOffset : 0;
 	
 	for (int y = 0; y < _screenRows; y++)
 		{
-		int filerow = y + _rowOffset;
 		if (filerow >= numRows)
 			{
 			if ((numRows == 0) && (y == _screenRows / 3))
@@ -304,64 +740,30 @@ void Editor::_drawRows(std::string& buf)
 			else
 				buf.append("~");
 			}
-		else
+		else if (_wrapping)
 			{
-			Row& row = _rows.at(filerow);
-			int len = row.rsize - _colOffset;
-			if (len < 0)
-				len = 0;
-			if (len > _screenCols)
-				len = _screenCols;
-      
-			const char *c 		= row.render.c_str() + _colOffset;
-			uint8_t *hl 		= row.hl.data() + _colOffset;
-			int current_color	= -1;
-      
-			for (int j = 0; j < len; j++)
+			// Only as much of the row as is on screen is laid out
+			std::string_view text = _text(filerow);
+			int from	= _wraps.start(filerow, text, line);
+			int to		= _wraps.start(filerow, text, line + 1);
+			_drawRow(buf,
+					 filerow,
+					 from,
+					 (to < 0) ? (int) text.length() : to,
+					 0);
+			
+			line ++;
+			if (to < 0)
 				{
-				if (iscntrl(c[j]))
-					{
-					char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-					buf.append("\x1b[7m");
-					buf.append(&sym, 1);
-					buf.append("\x1b[m");
-					
-					if (current_color != -1)
-						{
-						char cbuf[16];
-						int clen = snprintf(cbuf,
-											sizeof(cbuf),
-											"\x1b[%dm",
-											current_color);
-						buf.append(cbuf, clen);
-						}
-					}
-				else if (hl[j] == HL_NORMAL)
-					{
-					if (current_color != -1)
-						{
-						buf.append("\x1b[39m");
-						current_color = -1;
-						}
-					buf.append(&c[j], 1);
-					}
-				else
-					{
-					int color = _syntaxToColor(hl[j]);
-					if (color != current_color)
-						{
-						current_color = color;
-						char cbuf[16];
-						int clen = snprintf(cbuf,
-											sizeof(cbuf),
-											"\x1b[%dm",
-											color);
-						buf.append(cbuf, clen);
-						}
-					buf.append(&c[j], 1);
-					}
+				filerow ++;
+				line = 0;
 				}
-			buf.append("\x1b[39m");
+			}
+		else
+			{
+			int x = _rowRxToCx(filerow, _colOffset);
+			_drawRow(buf, filerow, x, _rowSize(filerow), _rowCxToRx(filerow, x));
+			filerow ++;
 			}
 
     	buf.append("\x1b[K");
@@ -369,24 +771,174 @@ void Editor::_drawRows(std::string& buf)
 		}
 	}
 
+/*****************************************************************************\
+|* Draw a row from column 'x', which is at render column 'rx', up to column
+|* 'end' or until it runs off the screen
+\*****************************************************************************/
+void Editor::_drawRow(PooledString& buf, int rowId, int x, int end, int rx)
+	{
+	const SpanList& spans = _render(rowId).spans;
+	std::string_view text = _text(rowId);
+	int current_color	  = -1;
+	
+	// The search match is shown over the syntax highlighting
+	int matchFrom 		= INT_MAX;
+	int matchTo			= INT_MAX;
+	if (rowId == _matchRow)
+		{
+		matchFrom	= _matchCx;
+		matchTo		= _matchCx + _matchLen;
+		}
+	
+	// Draw a run at a time, up to wherever a span or the match starts or
+	// stops, or until we run off the screen
+	auto span = std::partition_point(spans.begin(), spans.end(),
+		[&](const Span& s) { return s.start + s.length <= x; });
+	
+	while ((x < end) && (rx < _colOffset + _screenCols))
+		{
+		int hl	= HL_NORMAL;
+		int to	= end;
+		if (span != spans.end())
+			{
+			if (span->start <= x)
+				{
+				hl = span->hl;
+				to = MIN(to, span->start + span->length);
+				}
+			else
+				to = MIN(to, span->start);
+			}
+		
+		if ((x >= matchFrom) && (x < matchTo))
+			{
+			hl = HL_MATCH;
+			to = MIN(to, matchTo);
+			}
+		else if (x < matchFrom)
+			to = MIN(to, matchFrom);
+		
+		rx = _drawRun(buf, text.data() + x, to - x, rx, hl, current_color);
+		x = to;
+		if ((span != spans.end()) && (x >= span->start + span->length))
+			span ++;
+		}
+	buf.append("\x1b[39m");
+	}
+
+/*****************************************************************************\
+|* Draw a run of text in one highlight, starting at render column 'rx',
+|* changing colour only if it's different from the last run. Tabs are
+|* expanded and control characters and bad UTF-8 shown inverted on the way.
+|* Anything right of the screen is left off, and a tab or wide character
+|* that's only partly on screen is drawn as spaces. Returns the render
+|* column after the run
+\*****************************************************************************/
+int Editor::_drawRun(PooledString& buf,
+					 const char *text,
+					 int len,
+					 int rx,
+					 int hl,
+					 int& color)
+	{
+	char cbuf[16];
+	int want = ((*_theme)[hl] == 0) ? -1 : (*_theme)[hl];
+	if (want != color)
+		{
+		if (want == -1)
+			buf.append("\x1b[39m");
+		else
+			buf.append(cbuf, snprintf(cbuf, sizeof(cbuf), "\x1b[%dm", want));
+		color = want;
+		}
+	
+	int right = _colOffset + _screenCols;
+	int j	  = 0;
+	while ((j < len) && (rx < right))
+		{
+		// Plain text goes out in one go
+		int k = j;
+		while ((k < len) && (k - j < right - rx) && ((uint8_t)(text[k] - ' ') < 0x5F))
+			k++;
+		if (k > j)
+			{
+			buf.append(text + j, k - j);
+			rx += k - j;
+			j	= k;
+			continue;
+			}
+		
+		if (text[j] == '\t')
+			{
+			int next = rx + _tabStop - (rx % _tabStop);
+			buf.append(MIN(next, right) - MAX(rx, _colOffset), ' ');
+			rx = next;
+			j++;
+			continue;
+			}
+		
+		uint32_t cp;
+		int width;
+		int bytes = Utf8::grapheme(text + j, len - j, &width);
+		Utf8::decode(text + j, len - j, &cp);
+		if (Utf8::isControl(cp))
+			{
+			char sym = ((uint8_t) text[j] <= 26) ? '@' + text[j] : '?';
+			buf.append("\x1b[7m");
+			buf.append(&sym, 1);
+			buf.append("\x1b[m");
+			if (color != -1)
+				buf.append(cbuf, snprintf(cbuf, sizeof(cbuf), "\x1b[%dm", color));
+			}
+		else if ((rx < _colOffset) || (rx + width > right))
+			buf.append(MIN(rx + width, right) - MAX(rx, _colOffset), ' ');
+		else
+			buf.append(text + j, bytes);
+		rx += width;
+		j  += bytes;
+		}
+	return rx;
+	}
+
 /*****************************************************************************\
 |* Draw the status bar
 \*****************************************************************************/
-void Editor::_drawStatusBar(std::string& buf)
+void Editor::_drawStatusBar(PooledString& buf)
 	{
   	buf.append("\x1b[7m");
-	int numrows = (int) _rows.size();
+	int numrows = _numRows();
 	
 	char status[80], rstatus[80];
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-		(_filename.length() > 0) ? _filename.c_str()
-								 : "[No Name]",
-		numrows,
-		_dirty ? "(modified)" : "");
-  
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-		(_syntax != nullptr) ? _syntax->filetype.c_str() : "no ft",
-		_cy + 1, numrows);
+	int len, rlen;
+	if (_hexMode)
+		{
+		len = snprintf(status, sizeof(status), "%.20s - %lld bytes %s",
+			_filename.c_str(),
+			(long long) _hex.size(),
+			_hex.readOnly() ? "(read-only)" : _dirty ? "(modified)" : "");
+		rlen = snprintf(rstatus, sizeof(rstatus), "[hex] | 0x%llx/0x%llx",
+			(long long) _hexCursor,
+			(long long) _hex.size());
+		}
+	else
+		{
+		len = snprintf(status, sizeof(status), "%.20s - %d%s lines %s",
+			(_filename.length() > 0) ? _filename.c_str()
+									 : "[No Name]",
+			numrows,
+			(_paging && !_pager.complete()) ? "+" : "",
+			_paging ? "(read-only)" : _dirty ? "(modified)" : "");
+	  
+		rlen = snprintf(rstatus, sizeof(rstatus), "%s%s%s%s%s%s | %d/%d",
+			_following ? "[follow] " : "",
+			_wrapping ? "[wrap] " : "",
+			(_encoding == Utf8::ENC_LATIN1) ? "[latin1] " :
+			(_encoding == Utf8::ENC_BINARY) ? "[binary] " : "",
+			(_searchFlags & Search::SEARCH_CASELESS) ? "[icase] " : "",
+			(_searchFlags & Search::SEARCH_WORD) ? "[word] " : "",
+			(_syntax != nullptr) ? std::string(_syntax->filetype).c_str() : "no ft",
+			_cy + 1, numrows);
+		}
 		
 	if (len > _screenCols)
 		len = _screenCols;
@@ -413,7 +965,7 @@ void Editor::_drawStatusBar(std::string& buf)
 /*****************************************************************************\
 |* Draw the message bar
 \*****************************************************************************/
-void Editor::_drawMessageBar(std::string& buf)
+void Editor::_drawMessageBar(PooledString& buf)
 	{
   	buf.append("\x1b[K");
   
@@ -425,66 +977,31 @@ void Editor::_drawMessageBar(std::string& buf)
     buf.append(_status);
 	}
 
-/*****************************************************************************\
-|* Colour map for different types of highlight
-\*****************************************************************************/
-int Editor::_syntaxToColor(int hl)
-	{
-	switch (hl)
-		{
-		case HL_COMMENT:
-		case HL_MLCOMMENT:
-			return 36;
-		case HL_KEYWORD1:
-			return 33;
-		case HL_KEYWORD2:
-			return 32;
-		case HL_STRING:
-			return 35;
-		case HL_NUMBER:
-			return 31;
-		case HL_MATCH:
-			return 34;
-		default:
-			return 37;
-		}
-	}
-
 /*****************************************************************************\
 |* Figure out which colour-syntax-highlighting to use
 \*****************************************************************************/
 void Editor::_selectSyntaxHighlight(void)
 	{
-	_syntax = nullptr;
+	_stopHighlighting();
+	_highlightCache.clear();
+	_backgroundCache.clear();
+	_lexerStates.clear();
+	_syntax		 = nullptr;
+	_highlighter = nullptr;
 	if (_filename.length() == 0)
 		return;
 
-	std::size_t pos = _filename.rfind(".");
-	if (pos != std::string::npos)
-		{
-		std::string ext = _filename.substr(pos);
-		
-		for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
+	// Loaded definitions first, with the generic highlighter
+	_syntax = _syntaxFiles.find(_filename);
+	for (const Language& language : _languages)
+		if ((_syntax == nullptr) && language.syntax->matches(_filename))
 			{
-			struct Editor::Syntax *s = &HLDB[j];
-			
-			for (std::string& match : s->filematch)
-				{
-				bool isExt 		= (match[0] == '.');
-				bool matchExt	= isExt && (ext.length() > 0) && (ext == match);
-				bool matchFile	= (!isExt) && (_filename == match);
-				if (matchExt || matchFile)
-					{
-					_syntax = s;
-					int numRows = (int) _rows.size();
-					
-					for (int i = 0; i < numRows; i++)
-						_updateSyntax(_rows.at(i));
-					return;
-					}
-				}
+			_syntax		 = language.syntax;
+			_highlighter = language.highlighter;
 			}
-		}
+
+	if (_syntax != nullptr)
+		_rehighlight();
 	}
 	
 /*****************************************************************************\
@@ -492,8 +1009,14 @@ void Editor::_selectSyntaxHighlight(void)
 \*****************************************************************************/
 void Editor::_scroll(void)
 	{
+	if (_wrapping)
+		{
+		_wrapScroll();
+		return;
+		}
+	
   	_rx = 0;
-	if (_cy < _rows.size())
+	if (_cy < _numRows())
 		_rx = _rowCxToRx(_cy, _cx);
   
 
@@ -509,174 +1032,853 @@ void Editor::_scroll(void)
 	if (_rx >= _colOffset + _screenCols)
 		_colOffset = _rx - _screenCols + 1;
 	}
-	
-	
 
 /*****************************************************************************\
-|* Which chars are separators
+|* Figure out the line at the top when wrapping. If the cursor's above it,
+|* its line goes at the top, and if it's more than a screen below, at the
+|* bottom. Either way only the lines between the two are counted, and no
+|* more than a screen of them, so a long row is never laid out further
+|* than the screen goes into it
 \*****************************************************************************/
-static int isSeparator(int c)
+void Editor::_wrapScroll(void)
 	{
-	return isspace(c)
-		|| (c == '\0')
-		|| (strchr(",.()+-/*=~%<>[];", c) != NULL);
+	int numRows = _numRows();
+	_wraps.setLayout(_screenCols, _tabStop);
+	_colOffset	= 0;
+	
+	int line	= 0;
+	_rx			= 0;
+	if (_cy < numRows)
+		{
+		std::string_view text = _text(_cy);
+		line = _wraps.line(_cy, text, _cx);
+		_rx	 = _wraps.column(_cy, text, _cx);
+		}
+	
+	// The row at the top may have lost lines since
+	if ((_rowOffset >= numRows)
+	 || (_wraps.start(_rowOffset, _text(_rowOffset), _wrapOffset) < 0))
+		_wrapOffset = 0;
+	
+	if ((_cy < _rowOffset) || ((_cy == _rowOffset) && (line < _wrapOffset)))
+		{
+		_rowOffset	= _cy;
+		_wrapOffset	= line;
+		_wrapY		= 0;
+		return;
+		}
+	
+	int y = -_wrapOffset;
+	for (int row = _rowOffset; (row < _cy) && (y < _screenRows); row++)
+		y += _wrapLines(row, _screenRows - y);
+	y += line;
+	if (y < _screenRows)
+		{
+		_wrapY = y;
+		return;
+		}
+	
+	_rowOffset	= _cy;
+	_wrapOffset	= line;
+	_wrapMove(_rowOffset, _wrapOffset, -(_screenRows - 1));
+	_wrapY		= _screenRows - 1;
 	}
 
 /*****************************************************************************\
-|* Update the syntax mappings within a row
+|* Move a row and line of it up (if 'by' is negative) or down by 'by' lines,
+|* stopping at the top, or the end of the file. Going down a row is only
+|* laid out as far as we go into it, but going up into one means finding
+|* its last line
 \*****************************************************************************/
-void Editor::_updateSyntax(Row& row)
+void Editor::_wrapMove(int& rowId, int& line, int by)
 	{
-	row.hl.resize(row.rsize);
-	memset(row.hl.data(), HL_NORMAL, row.rsize);
-
-	if (_syntax == nullptr)
-		return;
-
-	StringList keywords = _syntax->keywords;
-	std::string scs 	= _syntax->singleLineCommentStart;
-	std::string mcs 	= _syntax->multiLineCommentStart;
-  	std::string mce 	= _syntax->multilineCommentEnd;
-
-	int scsLen 			= (int) scs.length();
-	int mcsLen 			= (int) mcs.length();
-	int mceLen 			= (int) mce.length();
-
-	int prevSep 		= 1;
-	int inString 		= 0;
-	int inComment 		= (row.idx > 0 && _rows.at(row.idx-1).hl_open_comment);
-
-	int i = 0;
-	while (i < row.rsize)
+	int numRows = _numRows();
+	while ((by > 0) && (rowId < numRows))
 		{
-		char c 			= row.render.at(i);
-    	uint8_t prev_hl = (i > 0) ? row.hl[i - 1] : HL_NORMAL;
+		int lines = _wrapLines(rowId, line + by + 1);
+		if (line + by < lines)
+			{
+			line += by;
+			by	  = 0;
+			}
+		else
+			{
+			by	 -= lines - line;
+			rowId ++;
+			line  = 0;
+			}
+		}
+	
+	while (by < 0)
+		{
+		if ((line + by >= 0) || (rowId == 0))
+			{
+			line = MAX(line + by, 0);
+			by	 = 0;
+			}
+		else
+			{
+			by	 += line + 1;
+			rowId --;
+			line  = _wrapLines(rowId) - 1;
+			}
+		}
+	}
+
+/*****************************************************************************\
+|* The lines a row wraps onto, up to 'most'. Past the end of the file
+|* there's a line for the cursor to go on
+\*****************************************************************************/
+int Editor::_wrapLines(int rowId, int most)
+	{
+	if (rowId >= _numRows())
+		return MIN(1, most);
+	return _wraps.lines(rowId, _text(rowId), most);
+	}
+	
+	
 
-		if (scsLen && !inString && !inComment)
+/*****************************************************************************\
+|* Update the syntax mappings over a range of rows. Rows past 'to' are only
+|* revisited while the state they leave differs from before (a comment,
+|* string or heredoc opens or closes differently), so each row is
+|* highlighted once however large the range is. States are hash-consed, so
+|* that's one compare however deeply things are nested.
+|*
+|* That can still be the rest of the file, so once it's gone a screen past
+|* what's showing (or SYNC_HIGHLIGHT_ROWS, if that's sooner) the worker is
+|* left to carry on. Rows it hasn't reached yet are left to it too. When
+|* paging there's no worker, and the rows are only a window anyway
+\*****************************************************************************/
+void Editor::_updateSyntaxRange(int from, int to)
+	{
+	int numRows = (int) _rows.size();
+	
+	_forgetRendered();
+	if (_syntax == nullptr)
+		return;
+	
+	from = MAX(from, 0);
+	int highlighted = _highlighted;
+	if (from > highlighted)
+		return;
+	
+	int limit = _paging ? numRows
+						: MAX(to, MIN(_rowOffset + 2 * _screenRows,
+									  from + SYNC_HIGHLIGHT_ROWS));
+	int i;
+	for (i = from; i < numRows; i++)
+		{
+		int in		  = (i > 0) ? _rows.state(i - 1) : 0;
+		int state	  = _updateSyntax(_rows.text(i), nullptr, in);
+		bool changed  = (i >= highlighted) || (state != (int) _rows.state(i));
+		_rows.setState(i, state);
+		if ((i >= to) && !changed)
+			break;
+		if (i >= limit)
 			{
-			if (row.render.substr(i, scsLen) == scs)
-				{
-				memset(row.hl.data()+i, HL_COMMENT, row.rsize - i);
+			highlighted = i + 1;
+			break;
+			}
+		}
+	
+	if (i == numRows)
+		highlighted = numRows;
+	_highlighted = highlighted;
+	}
+
+/*****************************************************************************\
+|* Highlight everything again, as far as the screen now and the rest in the
+|* background
+\*****************************************************************************/
+void Editor::_rehighlight(void)
+	{
+	_stopHighlighting();
+	_highlighted = 0;
+	_updateSyntaxRange(0, 0);
+	_startHighlighting();
+	}
+
+/*****************************************************************************\
+|* Start the worker off on whatever rows are left. If the screen is further
+|* down than that, it has a guess at the screen first
+\*****************************************************************************/
+void Editor::_startHighlighting(void)
+	{
+	int numRows = (int) _rows.size();
+	int from	= _highlighted;
+	if (_paging || (_syntax == nullptr) || (from >= numRows)
+	 || _highlightWorker.joinable())
+		return;
+	
+	int previewRows = 0;
+	if (_rowOffset > from)
+		previewRows = MIN(_screenRows, numRows - _rowOffset);
+	_preview.resize(previewRows);
+	_previewTop		= _rowOffset;
+	_previewDone	= 0;
+	_previewSeen	= 0;
+	_highlightSeen	= from;
+	
+	// The worker mustn't allocate, so its cache and the states it'll need
+	// first have to be ready for it
+	if (_allocator->available() >= _allocator->capacity() / MEMORY_LOW)
+		_backgroundCache.reserve();
+	_lexerStates.reserve();
+	_highlightWorker = std::thread(&Editor::_highlightInBackground,
+								   this,
+								   from,
+								   (from > 0) ? (int) _rows.state(from - 1) : 0,
+								   _previewTop,
+								   previewRows);
+	}
+
+/*****************************************************************************\
+|* Stop the worker, before the rows change. What it's done so far stands
+\*****************************************************************************/
+void Editor::_stopHighlighting(void)
+	{
+	if (_highlightWorker.joinable())
+		{
+		_highlightCancel = true;
+		_highlightWorker.join();
+		_highlightCancel = false;
+		}
+	_preview.clear();
+	}
+
+/*****************************************************************************\
+|* The worker. It only reads the rows and sets their states, and each
+|* state is written before the row is published as done, so the draw path
+|* can read them without a lock. It's stopped before anything else changes
+|* the rows.
+|*
+|* The rows on screen depend on every row above them, so when those aren't
+|* done yet the screen is first highlighted as if nothing were open above
+|* it. That's usually right, and is replaced when the worker reaches it
+\*****************************************************************************/
+void Editor::_highlightInBackground(int from,
+									int in,
+									int previewTop,
+									int previewRows)
+	{
+	int state = 0;
+	for (int i = 0; i < previewRows; i++)
+		{
+		if (_highlightCancel)
+			return;
+		state		= _updateSyntax(_rows.text(previewTop + i),
+									nullptr,
+									state,
+									&_backgroundCache);
+		_preview[i] = state;
+		_previewDone.store(i + 1, std::memory_order_release);
+		}
+	
+	int numRows = (int) _rows.size();
+	state		= in;
+	for (int i = from; i < numRows; i++)
+		{
+		if (_highlightCancel)
+			return;
+		state = _updateSyntax(_rows.text(i), nullptr, state, &_backgroundCache);
+		_rows.setState(i, state);
+		_highlighted.store(i + 1, std::memory_order_release);
+		}
+	}
+
+/*****************************************************************************\
+|* Called when idle: pick up what the worker has done, and start it again
+|* if an edit stopped it. Returns true if there's more to draw
+\*****************************************************************************/
+bool Editor::_highlightProgress(void)
+	{
+	bool refresh = false;
+	
+	if (_highlightWorker.joinable())
+		{
+		// Keep it in states
+		_lexerStates.reserve();
+		
+		int highlighted = _highlighted.load(std::memory_order_acquire);
+		int previewed	= _previewDone.load(std::memory_order_acquire);
+		
+		// Anything drawn plain (or guessed at) may be done now, but it only
+		// needs drawing again if some of it was on screen
+		if ((highlighted != _highlightSeen) || (previewed != _previewSeen))
+			{
+			refresh = (_highlightSeen < _rowOffset + _screenRows)
+				   || (previewed != _previewSeen);
+			_highlightSeen	= highlighted;
+			_previewSeen	= previewed;
+			_forgetRendered();
+			}
+		
+		if (highlighted >= (int) _rows.size())
+			_stopHighlighting();
+		}
+	
+	_startHighlighting();
+	return refresh;
+	}
+
+/*****************************************************************************\
+|* Work out the highlighting of a row as a list of spans, given the state
+|* the previous row left (see LexerStates.h). Returns the state this one
+|* leaves. A row that's been highlighted from the same state before is
+|* taken from the cache
+\*****************************************************************************/
+int Editor::_updateSyntax(std::string_view chars,
+						  SpanList *spans,
+						  int in,
+						  SpanCache *cache)
+	{
+	if (spans != nullptr)
+		spans->clear();
+	if (_syntax == nullptr)
+		return 0;
+	
+	// Only the worker passes a cache, and it can't allocate
+	if (cache == nullptr)
+		_lexerStates.reserve();
+	
+	Highlighter highlighter = (_highlighter != nullptr)
+							? _highlighter
+							: &Editor::_highlight<nullptr>;
+	if (!SpanCache::worthCaching(chars))
+		return (this->*highlighter)(chars, spans, in);
+	
+	// Ours can grow again once it's been dropped, if there's room for it
+	if (cache == nullptr)
+		{
+		cache = &_highlightCache;
+		if (_allocator->available() >= _allocator->capacity() / MEMORY_LOW)
+			cache->reserve();
+		}
+	
+	uint64_t hash = SpanCache::hash(chars);
+	int state;
+	if (!cache->find(hash, chars.length(), in, spans, &state))
+		{
+		state = (this->*highlighter)(chars, spans, in);
+		cache->store(hash, chars.length(), in, spans, state);
+		}
+	return state;
+	}
+
+/*****************************************************************************\
+|* The highlighter proper, which runs the tokenizer's state machine over
+|* the row and turns its output into runs. For a built-in language 'Fixed'
+|* is its (constant) definition, so the delimiters are known here and the
+|* tests on them fold away.
+|*
+|* Most of a source file tends to be comments, strings and indentation, and
+|* in those only the odd byte can change anything, so runs of them are
+|* passed over a vector at a time rather than stepped through.
+|*
+|* What the row above left open is unpacked into a stack first. The top of
+|* it is the region we start in (a comment, a string, a raw string, or a
+|* heredoc, which takes the whole row), unless it's a substitution, which
+|* is code like any other. The rest only matters when something closes
+|* down to it. Whatever is open at the end goes back on, with any heredocs
+|* the row started (their text starts on the next row), and the stack is
+|* interned as the state this row leaves. A row with nothing open either
+|* side never touches the state table
+\*****************************************************************************/
+template <const Syntax *Fixed>
+int Editor::_highlight(std::string_view chars,
+					   SpanList *spans,
+					   int in)
+	{
+	const Syntax& syntax = (Fixed != nullptr) ? *Fixed : *_syntax;
+	
+	std::string_view scs = syntax.singleLineCommentStart;
+	std::string_view mcs = syntax.multiLineCommentStart;
+	std::string_view mce = syntax.multiLineCommentEnd;
+	std::string_view rss = syntax.rawStringStart;
+	std::string_view sbs = syntax.substitutionStart;
+	char sbe			 = syntax.substitutionEnd();
+	bool heredocs		 = (syntax.flags & Syntax::HIGHLIGHT_HEREDOCS) != 0;
+	bool longStrings	 = (syntax.flags & Syntax::HIGHLIGHT_LONG_STRINGS) != 0;
+
+	const uint8_t *text	= (const uint8_t *) chars.data();
+	int size			= (int) chars.length();
+	int state			= Tokenizer::S_SEPARATOR;
+	int i				= 0;
+	int runStart		= 0;
+	uint8_t runHl		= HL_NORMAL;
+	bool continued		= false;		// Row ends in an escaped newline
+
+	LexerStates::Stack stack;
+	LexerStates::Frame raw = {};		// The raw string we're in, if any
+	LexerStates::Frame pending[MAX_PENDING_HEREDOCS];
+	int numPending		= 0;
+
+	// Highlight from 'at' on as 'hl', ending the run before if it differs
+	auto mark = [&](int at, uint8_t hl)
+		{
+		if (hl == runHl)
+			return;
+		if ((runHl != HL_NORMAL) && (spans != nullptr))
+			spans->push_back({.start = runStart, .length = at - runStart, .hl = runHl});
+		runStart = at;
+		runHl	 = hl;
+		};
+
+	// Start in whatever the row above left open
+	_lexerStates.unpack(in, stack);
+	if (stack.size > 0)
+		{
+		LexerStates::Frame& top = stack.top();
+		switch (top.kind)
+			{
+			case LexerStates::F_COMMENT:
+				state = Tokenizer::S_COMMENT;
+				stack.pop();
+				break;
+
+			case LexerStates::F_STRING:
+				state = (top.arg == '"') ? Tokenizer::S_DQUOTE
+										 : Tokenizer::S_SQUOTE;
+				stack.pop();
+				break;
+
+			case LexerStates::F_RAW:
+				raw	  = top;
+				state = Tokenizer::S_RAW;
+				stack.pop();
 				break;
+
+			case LexerStates::F_HEREDOC:
+				{
+				// The whole row is in it, and ends it if it's the word
+				std::string_view word = chars;
+				while (top.arg && (word.length() > 0) && (word[0] == '\t'))
+					word.remove_prefix(1);
+				if (word == top.delimiter())
+					stack.pop();
+				if ((spans != nullptr) && (size > 0))
+					spans->push_back({.start = 0, .length = size, .hl = HL_STRING});
+				return (int) _lexerStates.intern(stack);
 				}
 			}
+		}
 
-		if (mcsLen && mceLen && !inString)
+	// A substitution opens code inside a string, or inside code. Either way
+	// it's closed by its bracket, so there has to be room to remember it
+	auto substitute = [&](void)
+		{
+		if (sbs.empty()
+		 || (chars.compare(i, sbs.length(), sbs) != 0)
+		 || (stack.size + 3 > LexerStates::MAX_DEPTH))
+			return false;
+		if (state == Tokenizer::S_DQUOTE)
+			stack.push(LexerStates::frame(LexerStates::F_STRING, '"'));
+		stack.push(LexerStates::frame(LexerStates::F_CODE, 0));
+		mark(i, HL_VARIABLE);
+		i	 += (int) sbs.length();
+		state = Tokenizer::S_SEPARATOR;
+		return true;
+		};
+
+	// Indentation is only ever text, as long as blanks are just separators
+	if ((state == Tokenizer::S_SEPARATOR)
+	 && (syntax.classes[' '] == Tokenizer::K_SEPARATOR)
+	 && (syntax.classes['\t'] == Tokenizer::K_SEPARATOR))
+		i = (int) CharClass::skip(chars.data(), size, ' ', '\t');
+
+	while (i < size)
+		{
+		// In a comment or string, go straight to what might end it
+		if (state >= Tokenizer::S_DQUOTE)
 			{
-			if (inComment)
+			// A raw string ends at its delimiter, and nothing else
+			if (state == Tokenizer::S_RAW)
 				{
-				*(row.hl.data() + i) = HL_MLCOMMENT;
-				if (row.render.substr(i, mceLen) == mce)
-					{
-					memset(row.hl.data()+i, HL_MLCOMMENT, mceLen);
-					i += mceLen;
-					inComment = 0;
-					prevSep = 1;
-					continue;
-					}
-				else
+				size_t end = chars.find(raw.delimiter(), i);
+				mark(i, HL_STRING);
+				if (end == std::string_view::npos)
 					{
-					i++;
-					continue;
+					i = size;
+					break;
 					}
+				i	  = (int)(end + raw.length);
+				state = Tokenizer::S_SEPARATOR;
+				continue;
+				}
+
+			bool comment = (state == Tokenizer::S_COMMENT);
+			char end	 = comment ? (mce.empty() ? '\0' : mce[0])
+								   : ((state == Tokenizer::S_DQUOTE) ? '"' : '\'');
+			char escape	 = comment ? end : '\\';
+			int run		 = (int) CharClass::find(chars.data() + i, size - i, end, escape);
+			if ((sbe != '\0') && !sbs.empty()
+			 && (state == Tokenizer::S_DQUOTE) && (run > 0))
+				{
+				const char *sub = (const char *) memchr(chars.data() + i, sbs[0], run);
+				if (sub != nullptr)
+					run = (int)(sub - (chars.data() + i));
 				}
-			else if (row.render.substr(i, mcsLen) == mcs)
+			if (run > 0)
 				{
-				memset(row.hl.data()+i, HL_MLCOMMENT, mcsLen);
-				i += mcsLen;
-				inComment = 1;
+				mark(i, comment ? HL_MLCOMMENT : HL_STRING);
+				i += run;
 				continue;
 				}
 			}
-		
-		if (_syntax->flags & HIGHLIGHT_STRINGS)
+
+		uint8_t cls			  = syntax.classes[text[i]];
+		Tokenizer::Step step  = Tokenizer::step(state, cls);
+
+		if (step.op == Tokenizer::OP_ONE)
 			{
-			if (inString)
+			mark(i, step.token);
+			state = step.next;
+			i++;
+			continue;
+			}
+
+		// An opener has to be compared, and if it isn't one the byte is
+		// whatever else it is
+		if (step.op == Tokenizer::OP_OPEN)
+			{
+			if ((scs.length() > 0) && (chars.compare(i, scs.length(), scs) == 0))
+				{
+				mark(i, HL_COMMENT);
+				i = size;
+				break;
+				}
+			if ((mcs.length() > 0) && (mce.length() > 0)
+			 && (chars.compare(i, mcs.length(), mcs) == 0))
+				{
+				mark(i, HL_MLCOMMENT);
+				i	 += (int) mcs.length();
+				state = Tokenizer::S_COMMENT;
+				continue;
+				}
+
+			// R"delim( is closed by )delim"
+			if ((rss.length() > 0) && (chars.compare(i, rss.length(), rss) == 0))
 				{
-				*(row.hl.data()+i) = HL_STRING;
-				if ((c == '\\') && (i + 1 < row.rsize))
+				int from = i + (int) rss.length();
+				int to	 = from;
+				while ((to < size) && (to - from <= MAX_RAW_DELIMITER)
+					&& (text[to] != '(') && (text[to] != ')')
+					&& (text[to] != '\\') && !CharClass::isSpace(text[to]))
+					to++;
+				if ((to < size) && (text[to] == '(') && (to - from <= MAX_RAW_DELIMITER))
 					{
-					*(row.hl.data() + i + 1) = HL_STRING;
-					i += 2;
+					char closer[LexerStates::MAX_DELIMITER];
+					int length		  = 0;
+					closer[length++]  = ')';
+					memcpy(closer + length, chars.data() + from, to - from);
+					length			 += to - from;
+					closer[length++]  = rss.back();
+					raw	  = LexerStates::frame(LexerStates::F_RAW,
+											   0,
+											   std::string_view(closer, length));
+					mark(i, HL_STRING);
+					i	  = to + 1;
+					state = Tokenizer::S_RAW;
 					continue;
 					}
-					
-				if (c == inString)
-					inString = 0;
-				
-				i++;
-				prevSep = 1;
-				continue;
 				}
-			else
+
+			// <<WORD, <<-WORD or <<'WORD' starts a heredoc on the next row.
+			// Not in $((arithmetic)), where << is a shift
+			bool arithmetic = (stack.size > 0)
+						   && (stack.top().kind == LexerStates::F_CODE)
+						   && (stack.top().arg > 0);
+			if (heredocs && !arithmetic && (numPending < MAX_PENDING_HEREDOCS)
+			 && (chars.compare(i, 2, "<<") == 0)
+			 && ((i + 2 >= size) || (text[i + 2] != '<')))
 				{
-				if (c == '"' || c == '\'')
+				int at	  = i + 2;
+				bool dash = (at < size) && (text[at] == '-');
+				if (dash)
+					at++;
+				while ((at < size) && ((text[at] == ' ') || (text[at] == '\t')))
+					at++;
+				char quote = ((at < size) && ((text[at] == '\'') || (text[at] == '"')))
+						   ? text[at]
+						   : '\0';
+				if (quote)
+					at++;
+				int word = at;
+				while ((at < size) && CharClass::isWord(text[at]))
+					at++;
+				bool closed = (quote == '\0') || ((at < size) && (text[at] == quote));
+				if ((at > word) && !CharClass::isDigit(text[word]) && closed)
 					{
-					inString = c;
-					row.hl[i] = HL_STRING;
-					i++;
-					continue;
+					LexerStates::Frame heredoc = LexerStates::frame(LexerStates::F_HEREDOC,
+																	dash,
+																	chars.substr(word, at - word));
+					if (heredoc.kind != 0)
+						{
+						pending[numPending++] = heredoc;
+						mark(i, HL_STRING);
+						i	  = at + (quote ? 1 : 0);
+						state = Tokenizer::S_SEPARATOR;
+						continue;
+						}
 					}
 				}
+
+			if ((sbe != '\0') && substitute())
+				continue;
+			step = Tokenizer::step(state, cls & ~(Tokenizer::OPENS | Tokenizer::NESTS));
 			}
 
-		if (_syntax->flags & HIGHLIGHT_NUMBERS)
+		// The start of a substitution in a string, or in one, a bracket:
+		// they nest, and the last one closes it
+		if (step.op == Tokenizer::OP_NEST)
 			{
-			bool prevNum = prevSep || (prev_hl == HL_NUMBER);
-			bool prevHl  = (c == '.') && (prev_hl == HL_NUMBER);
-			if ((isdigit(c) && prevNum) || prevHl)
+			if (state == Tokenizer::S_DQUOTE)
 				{
-				*(row.hl.data()+i) = HL_NUMBER;
-				i++;
-				prevSep = 0;
-				continue;
+				if (substitute())
+					continue;
+				}
+			else if ((stack.size > 0) && (stack.top().kind == LexerStates::F_CODE))
+				{
+				LexerStates::Frame& code = stack.top();
+				if ((text[i] == sbe) && (code.arg == 0))
+					{
+					stack.pop();
+					mark(i, HL_VARIABLE);
+					i++;
+					state = Tokenizer::S_SEPARATOR;
+					if ((stack.size > 0) && (stack.top().kind == LexerStates::F_STRING))
+						{
+						state = (stack.top().arg == '"') ? Tokenizer::S_DQUOTE
+														 : Tokenizer::S_SQUOTE;
+						stack.pop();
+						}
+					continue;
+					}
+				if (text[i] == sbe)
+					code.arg--;
+				else if (!sbs.empty()
+					  && (text[i] == (uint8_t) sbs.back())
+					  && (code.arg < UINT8_MAX))
+					code.arg++;
 				}
+			step = Tokenizer::step(state, cls & ~Tokenizer::NESTS);
 			}
 
-		if (prevSep)
+		switch (step.op)
 			{
-			int numKeywords = (int) keywords.size();
-			int j = 0;
-			for (j = 0; j<numKeywords; j++)
+			case Tokenizer::OP_KEYWORD:
 				{
-				int klen 	= (int) keywords[j].length();
-				bool kw2 	= keywords[j][klen - 1] == '|';
-				if (kw2)
-					klen--;
-				
-				std::string candidate = row.render.substr(i, klen);
-				std::string match     = keywords[j].substr(0, klen);
+				// Keywords are whole words, so find the end of this one and
+				// see if it's one of those starting with its first character
+				int end = i + 1;
+				while ((end < size) && !Tokenizer::endsWord(syntax.classes[text[end]]))
+					end++;
 				
-				bool foundKW = (candidate == match);
-				
-				if (foundKW && isSeparator(row.render[i + klen]))
+				const Syntax::Keyword *kw = syntax.keyword(chars.substr(i, end - i));
+				if (kw != nullptr)
 					{
-					memset(row.hl.data() + i,
-						   kw2 ? HL_KEYWORD2 : HL_KEYWORD1,
-						   klen);
-					i += klen;
-					break;
+					mark(i, kw->token);
+					i = end;
 					}
+				else
+					{
+					mark(i, step.token);
+					i++;
+					}
+				break;
 				}
-			
-			if (keywords[j] != "")
-				{
-				prevSep = 0;
-				continue;
-				}
+
+			case Tokenizer::OP_ESCAPE:
+				mark(i, step.token);
+				continued = (i + 1 >= size);
+				i		 += continued ? 1 : 2;
+				break;
+
+			case Tokenizer::OP_CLOSE:
+				mark(i, step.token);
+				if (chars.compare(i, mce.length(), mce) == 0)
+					{
+					i		 += (int) mce.length();
+					step.next = Tokenizer::S_SEPARATOR;
+					}
+				else
+					i++;
+				break;
+
+			default:
+				mark(i, step.token);
+				i++;
+				break;
 			}
+		state = step.next;
+		}
+	mark(size, HL_NORMAL);
 
-		prevSep = isSeparator(c);
-		i++;
+	// Leave open whatever's still open, with the heredocs on top in the
+	// order they come
+	switch (state)
+		{
+		case Tokenizer::S_COMMENT:
+			stack.push(LexerStates::frame(LexerStates::F_COMMENT, 0));
+			break;
+		case Tokenizer::S_DQUOTE:
+		case Tokenizer::S_SQUOTE:
+			if (longStrings || continued)
+				stack.push(LexerStates::frame(LexerStates::F_STRING,
+											  (state == Tokenizer::S_DQUOTE) ? '"' : '\''));
+			break;
+		case Tokenizer::S_RAW:
+			stack.push(raw);
+			break;
 		}
+	while (numPending > 0)
+		stack.push(pending[--numPending]);
 
-	int changed = (row.hl_open_comment != inComment);
-	row.hl_open_comment = inComment;
-  
-	if (changed && row.idx + 1 < _rows.size())
-		_updateSyntax(_rows.at(row.idx+1));
+	return (int) _lexerStates.intern(stack);
 	}
 		
+/*****************************************************************************\
+|* A size for people to read
+\*****************************************************************************/
+static std::string readable(size_t bytes)
+	{
+	char buf[32];
+	if (bytes < 10 * 1024)
+		snprintf(buf, sizeof(buf), "%zuB", bytes);
+	else if (bytes < 10 * 1024 * 1024)
+		snprintf(buf, sizeof(buf), "%zuKB", bytes >> 10);
+	else
+		snprintf(buf, sizeof(buf), "%zuMB", bytes >> 20);
+	return buf;
+	}
+
+/*****************************************************************************\
+|* Show how much memory the document has, and how it's being used
+\*****************************************************************************/
+void Editor::_memoryReport(void)
+	{
+	std::string budget = (_allocator->capacity() > 0)
+					   ? " of " + readable(_allocator->capacity())
+					   : "";
+	
+	if (_hexMode)
+		{
+		setStatus("Memory: %s%s used, %s peak | hex blocks %s, %d changed",
+				  readable(_allocator->used()).c_str(),
+				  budget.c_str(),
+				  readable(_allocator->peak()).c_str(),
+				  readable(_hex.footprint()).c_str(),
+				  _hex.dirtyBlocks());
+		return;
+		}
+	
+	unsigned long long hits	  = _highlightCache.hits() + _backgroundCache.hits();
+	unsigned long long misses = _highlightCache.misses() + _backgroundCache.misses();
+	
+	setStatus("Memory: %s%s used, %s peak | text %s, spare %s, garbage %s | "
+			  "highlight cache %llu hits, %llu misses | %u lexer states (%s)",
+			  readable(_allocator->used()).c_str(),
+			  budget.c_str(),
+			  readable(_allocator->peak()).c_str(),
+			  readable(_rows.liveBytes()).c_str(),
+			  readable(_rows.spareBytes()).c_str(),
+			  readable(_rows.deadBytes()).c_str(),
+			  hits,
+			  misses,
+			  (unsigned) _lexerStates.size() - 1,
+			  readable(_lexerStates.footprint()).c_str());
+	}
+
+/*****************************************************************************\
+|* Make sure there's room for an edit of about 'bytes'. Once the budget is
+|* getting low, the caches go first (they're only there for speed), then
+|* undo history, oldest first. If that still doesn't leave MEMORY_FLOOR
+|* spare, the edit is refused: the rest is kept for drawing the screen, and
+|* for saving
+\*****************************************************************************/
+bool Editor::_makeRoom(size_t bytes)
+	{
+	size_t capacity = _allocator->capacity();
+	if ((capacity == 0) || (_allocator->available() >= bytes + capacity / MEMORY_LOW))
+		return true;
+	
+	_dropCaches();
+	
+	int dropped = 0;
+	size_t need = bytes + capacity / MEMORY_LOW;
+	while ((_allocator->available() < need) && (_redo.size() > 0))
+		{
+		_redo.erase(_redo.begin());
+		dropped ++;
+		}
+	while ((_allocator->available() < need) && (_undo.size() > 0))
+		{
+		_undo.erase(_undo.begin());
+		dropped ++;
+		}
+	if (dropped > 0)
+		{
+		_stopHighlighting();
+		_rows.compact();
+		}
+	
+	if (_allocator->available() >= bytes + capacity / MEMORY_FLOOR)
+		{
+		if (dropped > 0)
+			setStatus("Memory is low: forgot the oldest %d undo step%s",
+					  dropped, (dropped == 1) ? "" : "s");
+		return true;
+		}
+	
+	setStatus("Out of memory (%s free of %s): edit refused. Save, or Ctrl-U "
+			  "for details", readable(_allocator->available()).c_str(),
+			  readable(capacity).c_str());
+	return false;
+	}
+
+/*****************************************************************************\
+|* Roughly what an edit costs: the text goes into the undo log and the row,
+|* which may have to move to a bigger block, and new rows may make the line
+|* list grow
+\*****************************************************************************/
+size_t Editor::_editBytes(int row, int rows, size_t text)
+	{
+	size_t bytes = EDIT_OVERHEAD + 2 * text + _rows.growth(rows);
+	if ((row >= 0) && (row < _rows.size()))
+		bytes += 2 * (size_t) _rows.length(row);
+	return bytes;
+	}
+
+/*****************************************************************************\
+|* Give back everything that's only kept to save time
+\*****************************************************************************/
+void Editor::_dropCaches(void)
+	{
+	for (Rendered& entry : _rendered)
+		{
+		entry.row = -1;
+		StopList(entry.stops.get_allocator()).swap(entry.stops);
+		SpanList(entry.spans.get_allocator()).swap(entry.spans);
+		}
+	_renderedAny = false;
+	_wraps.clear();
+	
+	PooledString(_folded.get_allocator()).swap(_folded);
+	PooledString(_frame.get_allocator()).swap(_frame);
+	_foldedRow = -1;
+	
+	// The worker's cache is its own while it runs
+	_stopHighlighting();
+	_highlightCache.clear();
+	_backgroundCache.clear();
+	
+	// Compacting copies the whole file, so only if it'd win back enough
+	size_t waste = _rows.deadBytes() + _rows.spareBytes();
+	if (waste >= _allocator->capacity() / MEMORY_FLOOR)
+		_rows.compact(true);
+	}
+
 /*****************************************************************************\
 |* Fetch the window size
 \*****************************************************************************/
@@ -752,24 +1954,66 @@ void Editor::_processKeypress(void)
 	{
 	static int quitTimes = EDIT_QUIT_TIMES;
 
+	_waitingForKey	= true;
 	int c 			= _readKey();
-	int numRows 	= (int) _rows.size();
+	_waitingForKey	= false;
+	int numRows 	= _numRows();
 	
-	switch (c)
+	if (c == REFRESH_KEY)
+		return;
+	
+	// Hex mode has keys of its own, but quits the same way
+	if (_hexMode && (c != CTRL_KEY('q')))
 		{
-		case '\r':
-			_insertNewLine();
-			break;
-
-		case CTRL_KEY('q'):
-			if (_dirty && quitTimes > 0)
-				{
-				setStatus("WARNING!!! File has unsaved changes. "
+		_hexKeypress(c);
+		quitTimes = EDIT_QUIT_TIMES;
+		return;
+		}
+	
+	// Only moving around and searching are allowed when paging
+	if (_paging)
+		switch (c)
+			{
+			case CTRL_KEY('q'):
+			case CTRL_KEY('f'):
+			case CTRL_KEY('t'):
+			case CTRL_KEY('u'):
+			case CTRL_KEY('w'):
+			case CTRL_KEY('x'):
+			case CTRL_KEY('l'):
+			case '\x1b':
+			case HOME_KEY:
+			case END_KEY:
+			case PAGE_UP:
+			case PAGE_DOWN:
+			case ARROW_UP:
+			case ARROW_DOWN:
+			case ARROW_LEFT:
+			case ARROW_RIGHT:
+				break;
+			default:
+				setStatus("Read-only: '%s' is being viewed, not edited",
+						  _filename.c_str());
+				return;
+			}
+	
+	switch (c)
+		{
+		case '\r':
+			_insertNewLine();
+			break;
+
+		case CTRL_KEY('q'):
+			if (_dirty && quitTimes > 0)
+				{
+				setStatus("WARNING!!! File has unsaved changes. "
 						  "Press Ctrl-Q %d more times to quit.",
 						  quitTimes);
 				quitTimes--;
 				return;
 				}
+			// Quitting means the unsaved changes aren't wanted
+			_journal.remove();
 			write(STDOUT_FILENO, "\x1b[2J", 4);
 			write(STDOUT_FILENO, "\x1b[H", 3);
 			exit(0);
@@ -785,13 +2029,44 @@ void Editor::_processKeypress(void)
 
 		case END_KEY:
 			if (_cy < numRows)
-				_cx = _rows[_cy].size;
+				_cx = _rowSize(_cy);
 			break;
 
 		case CTRL_KEY('f'):
 			_find();
 			break;
 
+		case CTRL_KEY('r'):
+			_replace();
+			break;
+
+		case CTRL_KEY('t'):
+			follow(!_following);
+			setStatus(_following ? "Following '%s'" : "Stopped following '%s'",
+					  _filename.c_str());
+			break;
+
+		case CTRL_KEY('u'):
+			_memoryReport();
+			break;
+
+		case CTRL_KEY('w'):
+			wrap(!_wrapping);
+			setStatus(_wrapping ? "Wrapping long lines" : "Not wrapping long lines");
+			break;
+
+		case CTRL_KEY('x'):
+			_toggleHex();
+			break;
+
+		case CTRL_KEY('z'):
+			_undoAction(false);
+			break;
+
+		case CTRL_KEY('y'):
+			_undoAction(true);
+			break;
+
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DEL_KEY:
@@ -803,6 +2078,19 @@ void Editor::_processKeypress(void)
 		case PAGE_UP:
 		case PAGE_DOWN:
 			{
+			// When wrapping it's a screen of lines rather than of rows, and
+			// the cursor keeps to its column on the screen
+			if (_wrapping)
+				{
+				int line = _wrapOffset;
+				_cy		 = _rowOffset;
+				_wrapMove(_cy, line, (c == PAGE_UP) ? -_screenRows
+													: 2 * _screenRows - 1);
+				_cx		 = (_cy < numRows) ? _wraps.cx(_cy, _text(_cy), line, _rx)
+										   : 0;
+				break;
+				}
+			
 			if (c == PAGE_UP)
 				{
 				_cy = _rowOffset;
@@ -836,6 +2124,8 @@ void Editor::_processKeypress(void)
 			break;
 		}
 
+	// Everything done in response to one key is undone as one batch
+	_closeBatch();
 	quitTimes = EDIT_QUIT_TIMES;
 	}
 
@@ -850,6 +2140,10 @@ int Editor::_readKey(void)
 		{
 		if (nread == -1 && errno != EAGAIN)
 			die("read");
+		
+		// Timed out: let anything running in the background get a redraw
+		if ((nread == 0) && _idle())
+			return REFRESH_KEY;
 		}
 
 	if (c == '\x1b')
@@ -916,25 +2210,35 @@ int Editor::_readKey(void)
 \*****************************************************************************/
 void Editor::_moveCursor(int key)
 	{
-	int numRows 	= (int) _rows.size();
+	int numRows 	= _numRows();
 	bool validRow	= (_cy < numRows);
 
+	// When wrapping, up and down are to the line above or below, which may
+	// be of the same row, keeping to the same column on the screen
+	if (_wrapping && ((key == ARROW_UP) || (key == ARROW_DOWN)))
+		{
+		int line = validRow ? _wraps.line(_cy, _text(_cy), _cx) : 0;
+		_wrapMove(_cy, line, (key == ARROW_UP) ? -1 : 1);
+		_cx		 = (_cy < numRows) ? _wraps.cx(_cy, _text(_cy), line, _rx) : 0;
+		return;
+		}
+
 	switch (key)
 		{
 		case ARROW_LEFT:
 			if (_cx != 0)
-				_cx--;
+				_cx = _rowPrevCx(_cy, _cx);
 			else if (_cy > 0)
 				{
 				_cy--;
-				_cx = _rows.at(_cy).size;
+				_cx = _rowSize(_cy);
 				}
 			break;
     
 		case ARROW_RIGHT:
-			if (validRow && (_cx < _rows.at(_cy).size))
-				_cx++;
-			else if (validRow && (_cx == _rows.at(_cy).size))
+			if (validRow && (_cx < _rowSize(_cy)))
+				_cx = _rowNextCx(_cy, _cx);
+			else if (validRow && (_cx == _rowSize(_cy)))
 				{
 				_cy++;
 				_cx = 0;
@@ -952,12 +2256,410 @@ void Editor::_moveCursor(int key)
 			break;
 		}
 
-	numRows 	= (int) _rows.size();
+	numRows 	= _numRows();
 	validRow	= (_cy < numRows);
 
-	int rowlen = validRow ? _rows.at(_cy).size : 0;
+	int rowlen = validRow ? _rowSize(_cy) : 0;
 	if (_cx > rowlen)
 		_cx = rowlen;
+	
+	// Going up or down can land part of the way through a grapheme
+	if (validRow)
+		_cx = _rowSnapCx(_cy, _cx);
+	}
+
+/*****************************************************************************\
+|* Called when no key has arrived for a while. Returns true if something in
+|* the background has changed what's on screen
+\*****************************************************************************/
+bool Editor::_idle(void)
+	{
+	bool refresh = false;
+	
+	// Hex mode works on the file as it is on disk, so any change to it is
+	// picked up when we're back to the text
+	if (_hexMode)
+		return false;
+	
+	if (_paging)
+		{
+		int rows = _pager.numRows();
+		if (rows != _pagerRows)
+			{
+			_pagerRows 	= rows;
+			refresh 	= true;
+			}
+		if (_pager.searchState() == Pager::SEARCH_DONE)
+			refresh = true;
+		}
+	
+	_journal.sync();
+	refresh = _highlightProgress() || refresh;
+	
+	// The rows can't change under a prompt or a search, so changes to the
+	// file wait until we're back to reading keys. However many writes there
+	// were, they're read (and drawn) in one go
+	if (!_waitingForKey)
+		return refresh;
+	
+	int changes = _watcher.poll();
+	if (!_paging && (changes & FileWatcher::WATCH_REPLACED))
+		refresh = _fileChanged() || refresh;
+	else if (_following && ((changes != 0) || _tailPending))
+		refresh = _tail() || refresh;
+	else if (!_paging && (changes != 0))
+		refresh = _fileChanged() || refresh;
+	
+	return refresh;
+	}
+
+/*****************************************************************************\
+|* Read whatever has been appended to the file since we last looked. Only
+|* the new rows (and a previously unfinished last row) are rendered and
+|* highlighted, and if the cursor was on the last row it stays there
+\*****************************************************************************/
+bool Editor::_tail(void)
+	{
+	int numRows = _numRows();
+	bool atEnd	= (_cy >= numRows - 1);
+	
+	_tailPending = false;
+	
+	if (_paging)
+		{
+		int grown = _pager.grow();
+		if (grown == 0)
+			{
+			// The pager may just be busy, so try again later
+			_tailPending = !_pager.complete()
+						|| (_pager.searchState() == Pager::SEARCH_RUNNING);
+			return false;
+			}
+		if (grown < 0)
+			{
+			setStatus("'%s' was truncated, rereading it", _filename.c_str());
+			_pager.open(_filename);
+			_wraps.forget();
+			}
+		_pagerRows = _pager.numRows();
+		_rows.clear();
+		}
+	else
+		{
+		struct stat sb;
+		if (stat(_filename.c_str(), &sb) != 0)
+			return false;
+		
+		if (sb.st_size < _tailOffset)
+			return _fileChanged();
+		if (sb.st_size == _tailOffset)
+			return false;
+		
+		FILE *fp = fopen(_filename.c_str(), "r");
+		if ((fp == nullptr) || (fseeko(fp, _tailOffset, SEEK_SET) != 0))
+			{
+			if (fp != nullptr)
+				fclose(fp);
+			return false;
+			}
+		
+		std::string data(sb.st_size - _tailOffset, '\0');
+		data.resize(fread(data.data(), 1, data.length(), fp));
+		fclose(fp);
+		
+		size_t read = data.length();
+		_decode(data, _tailOffset == 0);
+		
+		// Leave it unread if there's no room, we can't just take some
+		int lines	 = (int) std::count(data.begin(), data.end(), '\n') + 1;
+		if (!_makeRoom(2 * data.length() + _rows.growth(lines)))
+			{
+			follow(false);
+			setStatus("Out of memory: stopped following '%s'",
+					  _filename.c_str());
+			return true;
+			}
+		_tailOffset += read;
+		_stopHighlighting();
+		
+		int first	= (_tailPartial && (numRows > 0)) ? numRows - 1 : numRows;
+		size_t from	= 0;
+		while (from < data.length())
+			{
+			size_t nl	= data.find('\n', from);
+			size_t end	= (nl == std::string::npos) ? data.length() : nl;
+			std::string text = data.substr(from, end - from);
+			
+			if (_tailPartial && (_rows.size() > 0))
+				{
+				// Finish off the last row. The row text lost its '\r' when
+				// we read it, so a '\n' here just completes the row
+				int last = _rows.size() - 1;
+				text.insert(0, _rows.text(last));
+				while ((text.length() > 0) && (text.back() == '\r'))
+					text.pop_back();
+				_rows.set(last, text);
+				_index.rowChanged(last);
+				}
+			else
+				{
+				while ((text.length() > 0) && (text.back() == '\r'))
+					text.pop_back();
+				_rows.append(text);
+				}
+			
+			_tailPartial = (nl == std::string::npos);
+			from		 = end + 1;
+			}
+		
+		_updateSyntaxRange(first, (int) _rows.size() - 1);
+		}
+	
+	// The last row may have been finished off, so whatever was folded,
+	// rendered or laid out from it is out of date
+	_foldedRow = -1;
+	_forgetRendered();
+	_wraps.forget(MAX(numRows - 1, 0));
+	
+	if (atEnd)
+		{
+		_cy = MAX(_numRows() - 1, 0);
+		_cx = 0;
+		}
+	return true;
+	}
+
+/*****************************************************************************\
+|* The file has changed on disk. If there's nothing here to lose, pick up
+|* the changes, otherwise just warn (and ask before the next save)
+\*****************************************************************************/
+bool Editor::_fileChanged(void)
+	{
+	if (_dirty == 0)
+		return _reload();
+	
+	if (!_diskChanged)
+		{
+		_diskChanged = true;
+		setStatus("WARNING!!! '%s' has changed on disk, and there are "
+				  "unsaved changes here", _filename.c_str());
+		return true;
+		}
+	return false;
+	}
+
+/*****************************************************************************\
+|* Bring the rows up to date with the file on disk. Only the lines that
+|* differ are touched: unchanged rows keep their rendering and highlighting,
+|* and aren't even moved unless lines were added or removed. The changes
+|* are logged as one batch, so the cursor and undo history survive, and the
+|* reload can itself be undone.
+\*****************************************************************************/
+bool Editor::_reload(void)
+	{
+	struct stat sb;
+	if (stat(_filename.c_str(), &sb) != 0)
+		return false;
+	
+	FILE *fp = fopen(_filename.c_str(), "r");
+	if (fp == nullptr)
+		return false;
+	
+	std::string data(sb.st_size, '\0');
+	data.resize(fread(data.data(), 1, data.length(), fp));
+	fclose(fp);
+	
+	// It's taken to be what it was when it was opened
+	off_t read = (off_t) data.length();
+	_decode(data, true);
+	
+	// Split into lines the same way open() does
+	std::vector<std::pair<size_t, int>> lines;
+	size_t from = 0;
+	while (from < data.length())
+		{
+		const char *nl	= (const char *) memchr(data.data() + from,
+												'\n',
+												data.length() - from);
+		size_t end		= (nl == nullptr) ? data.length() : nl - data.data();
+		size_t len		= end - from;
+		while ((len > 0) && (data[from + len - 1] == '\r'))
+			len --;
+		lines.push_back({from, (int) len});
+		from = end + 1;
+		}
+	
+	_tailOffset	 = read;
+	_tailPartial = (data.length() > 0) && (data.back() != '\n');
+	
+	auto text = [&](int line)
+		{
+		return std::string(data, lines[line].first, lines[line].second);
+		};
+	auto same = [&](int row, int line)
+		{
+		std::string_view chars = _rows.text(row);
+		return (chars.length() == (size_t) lines[line].second)
+			&& (memcmp(chars.data(),
+					   data.data() + lines[line].first,
+					   chars.length()) == 0);
+		};
+	
+	// Usually only a little has changed, so trim the common head and tail
+	// before diffing what's left
+	int oldRows	= (int) _rows.size();
+	int newRows	= (int) lines.size();
+	int head	= 0;
+	while ((head < oldRows) && (head < newRows) && same(head, head))
+		head ++;
+	
+	int tail	= 0;
+	while ((tail < oldRows - head) && (tail < newRows - head)
+		&& same(oldRows - 1 - tail, newRows - 1 - tail))
+		tail ++;
+	
+	Diff::HashList a;
+	Diff::HashList b;
+	for (int i = head; i < oldRows - tail; i++)
+		a.push_back(Diff::hash(_rows.text(i).data(), _rows.length(i)));
+	for (int i = head; i < newRows - tail; i++)
+		b.push_back(Diff::hash(data.data() + lines[i].first,
+							   lines[i].second));
+	
+	Diff::HunkList hunks;
+	Diff::lines(a, b, head, hunks);
+	
+	// The old and new text of the changed lines go into the undo log, and
+	// the new text into the rows. If that won't fit, the file stays as it
+	// was here, and is treated as changed underneath us
+	size_t bytes = 0;
+	for (Diff::Hunk& h : hunks)
+		{
+		// Rows coming or going means a new list (see below)
+		if (h.oldCount != h.newCount)
+			bytes = MAX(bytes, (size_t) newRows * sizeof(LineStore::Line));
+		for (int i = h.oldStart; i < h.oldStart + h.oldCount; i++)
+			bytes += EDIT_OVERHEAD + _rows.length(i);
+		for (int i = h.newStart; i < h.newStart + h.newCount; i++)
+			bytes += EDIT_OVERHEAD + 2 * (size_t) lines[i].second;
+		}
+	if (!_makeRoom(bytes))
+		{
+		_diskChanged = true;
+		setStatus("'%s' changed on disk, but there isn't the memory to "
+				  "reload it", _filename.c_str());
+		return true;
+		}
+	
+	_dirty 		 = 0;
+	_diskChanged = false;
+	if (hunks.size() == 0)
+		return false;
+	
+	// Work out where the cursor, the screen and the highlighting end up
+	// before anything moves. Highlighting that's finished stays finished,
+	// and otherwise it carries on from the same row as before, so only the
+	// hunks themselves (and what they change the state of) are lexed again
+	_stopHighlighting();
+	int old			= _highlighted;
+	int highlighted	= (old >= oldRows) ? newRows : old;
+	int cy			= _cy;
+	int rowOffset	= _rowOffset;
+	for (Diff::Hunk& h : hunks)
+		{
+		int delta = h.newCount - h.oldCount;
+		if (_cy >= h.oldStart + h.oldCount)
+			cy += delta;
+		else if (_cy >= h.oldStart)
+			cy = h.newStart + MIN(_cy - h.oldStart, MAX(h.newCount - 1, 0));
+		if (_rowOffset >= h.oldStart + h.oldCount)
+			rowOffset += delta;
+		else if (_rowOffset >= h.oldStart)
+			rowOffset = h.newStart;
+		if (old >= oldRows)
+			continue;
+		if (old >= h.oldStart + h.oldCount)
+			highlighted += delta;
+		else if (old >= h.oldStart)
+			highlighted = h.newStart;
+		}
+	_highlighted = highlighted;
+	
+	// Changed lines are rewritten in place, and any left over in the hunk
+	// are deleted or inserted. The edits are logged in the order they'd be
+	// replayed in
+	bool shifted = false;
+	for (Diff::Hunk& h : hunks)
+		{
+		int paired = MIN(h.oldCount, h.newCount);
+		for (int i = 0; i < paired; i++)
+			{
+			std::string chars = text(h.newStart + i);
+			_logEdit(EDIT_DELETE_TEXT,
+					 h.newStart + i,
+					 0,
+					 _rows.string(h.oldStart + i));
+			_logEdit(EDIT_INSERT_TEXT, h.newStart + i, 0, chars);
+			_rows.set(h.oldStart + i, chars);
+			}
+		for (int i = paired; i < h.oldCount; i++)
+			_logEdit(EDIT_DELETE_ROW,
+					 h.newStart + paired,
+					 0,
+					 _rows.string(h.oldStart + i));
+		for (int i = paired; i < h.newCount; i++)
+			_logEdit(EDIT_INSERT_ROW, h.newStart + i, 0, text(h.newStart + i));
+		
+		shifted = shifted || (h.oldCount != h.newCount);
+		}
+	
+	// If rows came or went, rebuild the list in one pass rather than
+	// shuffling everything up or down once per row
+	if (shifted)
+		{
+		LineStore::LineList& lines = _rows.lines();
+		LineStore::LineList rows(lines.get_allocator());
+		rows.reserve(newRows);
+		
+		int old = 0;
+		for (Diff::Hunk& h : hunks)
+			{
+			int paired = MIN(h.oldCount, h.newCount);
+			while (old < h.oldStart + paired)
+				rows.push_back(lines[old++]);
+			while (old < h.oldStart + h.oldCount)
+				_rows.release(lines[old++]);
+			for (int i = paired; i < h.newCount; i++)
+				rows.push_back(_rows.make(text(h.newStart + i)));
+			}
+		while (old < oldRows)
+			rows.push_back(lines[old++]);
+		
+		lines.swap(rows);
+		_rows.compact();
+		}
+	
+	// Only the new rows need highlighting, and the rows after them until
+	// one comes out in the state it was in. Hunks past the highlighting are
+	// left to the worker
+	for (Diff::Hunk& h : hunks)
+		_updateSyntaxRange(h.newStart, h.newStart + h.newCount);
+	_closeBatch();
+	
+	// The rows match the file again
+	_journal.remove();
+	
+	_cy 		= MIN(MAX(cy, 0), newRows);
+	_rowOffset	= MIN(MAX(rowOffset, 0), newRows);
+	int rowLen	= (_cy < newRows) ? _rows.length(_cy) : 0;
+	_cx 		= MIN(_cx, rowLen);
+	
+	int changed = 0;
+	for (Diff::Hunk& h : hunks)
+		changed += MAX(h.oldCount, h.newCount);
+	setStatus("'%s' changed on disk: reloaded %d line%s",
+			  _filename.c_str(), changed, (changed == 1) ? "" : "s");
+	return true;
 	}
 
 #pragma mark - Editor Operations
@@ -967,11 +2669,14 @@ void Editor::_moveCursor(int key)
 \*****************************************************************************/
 void Editor::_insertChar(int c)
 	{
+	if (!_makeRoom(_editBytes(_cy, 1, 1)))
+		return;
+	
 	int numRows = (int) _rows.size();
 	if (_cy == numRows)
 		_insertRow("", numRows);
   
-  	_rowInsertChar(_rows.at(_cy), _cx, c);
+  	_rowInsertChar(_cy, _cx, c);
 	_cx++;
 	}
 
@@ -980,23 +2685,24 @@ void Editor::_insertChar(int c)
 \*****************************************************************************/
 void Editor::_insertNewLine(void)
 	{
+	if (!_makeRoom(_editBytes(_cy, 1, 0)))
+		return;
+	
 	if (_cx == 0)
 		_insertRow("", _cy);
 	else
 		{
-    	Row& row = _rows.at(_cy);
-    	_insertRow(row.chars.data()+ _cx, _cy + 1);
-		row = _rows.at(_cy);
-		row.size = _cx;
-		row.chars.resize(row.size);
-		_update(_cy);
+		// Take a copy: inserting the row can move the row we split
+		std::string tail(_rows.text(_cy).substr(_cx));
+    	_insertRow(tail, _cy + 1);
+		_rowDelString(_cy, _cx, (int) tail.length());
 		}
 	_cy++;
 	_cx = 0;
 	}
 
 /*****************************************************************************\
-|* Delete a character
+|* Delete the grapheme before the cursor
 \*****************************************************************************/
 void Editor::_delChar(void)
 	{
@@ -1005,17 +2711,23 @@ void Editor::_delChar(void)
 		return;
 	if ((_cx == 0) && (_cy == 0))
 		return;
+	
+	// Joining rows copies both into the log, and into a new block
+	int from	 = _rowPrevCx(_cy, _cx);
+	size_t bytes = (_cx > 0) ? _editBytes(_cy, 0, _cx - from)
+							 : _editBytes(_cy - 1, 0, 2 * _rows.length(_cy));
+	if (!_makeRoom(bytes))
+		return;
 
-	Row& row = _rows.at(_cy);
 	if (_cx > 0)
 		{
-		_rowDelChar(row, _cx - 1);
-		_cx--;
+		_rowDelString(_cy, from, _cx - from);
+		_cx = from;
 		}
 	else
 		{
-		_cx = _rows.at(_cy - 1).size;
-		_rowAppendString(_rows.at(_cy - 1), row.chars);
+		_cx = _rows.length(_cy - 1);
+		_rowAppendString(_cy - 1, _rows.string(_cy));
 		_delRow(_cy);
 		_cy--;
 		}
@@ -1030,12 +2742,14 @@ void Editor::_find(void)
 	int savedCy 		= _cy;
 	int savedColOffset 	= _colOffset;
 	int savedRowOffset 	= _rowOffset;
+	int savedWrapOffset	= _wrapOffset;
 
-	std::string query = _prompt("Search: %s (Use ESC/Arrows/Enter)",
-								std::bind(&Editor::_findAction,
-										  this,
-										  std::placeholders::_1,
-										  std::placeholders::_2));
+	std::string query = _prompt("Search: %s "
+								"(ESC/Arrows/Enter, ^C case, ^W word)",
+								[this](std::string query, int key)
+									{
+									_findAction(query, key);
+									});
 
 	if (query.length() == 0)
 		{
@@ -1043,6 +2757,7 @@ void Editor::_find(void)
 		_cy 		= savedCy;
 		_colOffset	= savedColOffset;
 		_rowOffset 	= savedRowOffset;
+		_wrapOffset	= savedWrapOffset;
 		}
 	}
 
@@ -1053,21 +2768,27 @@ void Editor::_findAction(std::string query, int key)
 	{
 	static int last_match 	= -1;
 	static int direction  	= 1;
-	static std::vector<uint8_t> savedHl;
-	static int savedHlLine;
 
-	if (savedHl.size() > 0)
-		{
-		_rows.at(savedHlLine).hl = savedHl;
-		savedHl.clear();
-		}
+	// Background work doesn't change the search, unless it's the pager
+	// telling us its search has finished
+	bool pagerDone = _paging && (_pager.searchState() == Pager::SEARCH_DONE);
+	if ((key == REFRESH_KEY) && !pagerDone)
+		return;
+
+	_matchRow = -1;
 
 	if (key == '\r' || key == '\x1b')
 		{
 		last_match = -1;
 		direction = 1;
+		if (_paging)
+			_pager.stopSearch();
 		return;
 		}
+	else if (key == REFRESH_KEY)
+		{
+		// Collect the pager's result below
+		}
 	else if (key == ARROW_RIGHT || key == ARROW_DOWN)
 		{
 		direction = 1;
@@ -1076,6 +2797,14 @@ void Editor::_findAction(std::string query, int key)
 		{
 		direction = -1;
 		}
+	else if (key == CTRL_KEY('c') || key == CTRL_KEY('w'))
+		{
+		// Change mode, and look again from the current match onwards
+		_searchFlags ^= (key == CTRL_KEY('c')) ? Search::SEARCH_CASELESS
+												  : Search::SEARCH_WORD;
+		if (last_match != -1)
+			last_match -= direction;
+		}
 	else
 		{
 		last_match = -1;
@@ -1084,125 +2813,1153 @@ void Editor::_findAction(std::string query, int key)
 
 	if (last_match == -1)
 		direction = 1;
-	int current = last_match;
-  
-	int numRows = (int)_rows.size();
-	for (int i = 0; i < numRows; i++)
-		{
-		current += direction;
-		if (current == -1)
-			current = numRows - 1;
-		else if (current == numRows)
-			current = 0;
-
-    	Row& row 	= _rows.at(current);
-		const char *match = strstr(row.render.c_str(), query.c_str());
-		if (match)
-			{
-			last_match = current;
-			_cy = current;
-			_cx = _rowRxToCx(row.idx, (int)(match - row.render.c_str()));
-			_rowOffset = numRows;
-
-			savedHlLine = current;
-			savedHl		= row.hl;
-			memset(&(row.hl[match - row.render.c_str()]),
-					HL_MATCH,
-					query.length());
-			break;
+	int current			= last_match;
+	int numRows			= _numRows();
+	int found			= -1;
+	std::string needle	= _needle(query);
+	
+	if (_paging)
+		{
+		// The pager streams through the file in the background, so start
+		// it off now and come back for the result when it's done
+		if (key != REFRESH_KEY)
+			{
+			int from = current + direction;
+			if (from < 0)
+				from = numRows - 1;
+			else if (from >= numRows)
+				from = 0;
+			_pager.search(query, _searchFlags, from, direction);
+			return;
 			}
+		found = _pager.searchResult();
 		}
-	}
-
-#pragma mark - Row operations
-/*****************************************************************************\
-|* Figure out the render x from the column x
-\*****************************************************************************/
-int Editor::_rowCxToRx(int rowId, int cx)
-	{
-	int rx = 0;
-	Row& row = _rows.at(rowId);
-	
-	for (int j=0; j < cx; j++)
+	else
 		{
-		if (row.chars.at(j) == '\t')
-			rx += (_tabStop - 1) - (rx % _tabStop);
-		rx++;
+		_index.setQuery(query);
+		for (int i = 0; i < numRows; i++)
+			{
+			current += direction;
+			if (current == -1)
+				current = numRows - 1;
+			else if (current == numRows)
+				current = 0;
+			
+			if (!_index.mayContain(current))
+				continue;
+			
+			if (_rowFind(current, needle, 0) >= 0)
+				{
+				found = current;
+				break;
+				}
+			}
 		}
-	return rx;
+	
+	if (found < 0)
+		return;
+
+	int match = _rowFind(found, needle, 0);
+	if (match < 0)
+		return;
+	
+	last_match = found;
+	_cy = found;
+	_cx = match;
+	_rowOffset = numRows;
+
+	_matchRow	= found;
+	_matchCx	= match;
+	_matchLen	= (int) query.length();
 	}
 
 /*****************************************************************************\
-|* Figure out the column x from the render x
+|* Search and replace. Each match from the cursor onwards is offered in turn,
+|* and 'a' replaces all the remaining ones in one go
 \*****************************************************************************/
-int Editor::_rowRxToCx(int rowId, int rx)
+void Editor::_replace(void)
 	{
-	int cur_rx = 0;
-	int cx;
- 	Row& row = _rows.at(rowId);
- 
-	for (cx = 0; cx < row.size; cx++)
+	bool cancelled;
+	
+	std::string query = _prompt("Replace: %s (ESC to cancel)", nullptr);
+	if (query.length() == 0)
+		return;
+	
+	std::string fmt  = "Replace '" + query + "' with: %s (ESC to cancel)";
+	std::string with = _prompt(fmt.c_str(), nullptr, &cancelled);
+	if (cancelled)
+		return;
+
+	int numRows			= (int) _rows.size();
+	int replaced		= 0;
+	int cy				= _cy;
+	int cx				= _cx;
+	bool stopped		= false;
+	std::string needle	= _needle(query);
+	
+	while (cy < numRows)
 		{
-		if (row.chars.at(cx) == '\t')
-			cur_rx += (_tabStop - 1) - (cur_rx % _tabStop);
-		cur_rx++;
+		int match = _rowFind(cy, needle, cx);
+		if (match < 0)
+			{
+			cy ++;
+			cx = 0;
+			continue;
+			}
+		
+		// Show the match, and ask what to do with it
+		_cy = cy;
+		_cx = match;
+		
+		_matchRow	= cy;
+		_matchCx	= match;
+		_matchLen	= (int) query.length();
+		setStatus("Replace this one? (y)es (n)o (a)ll (q)uit");
+		_refreshScreen();
+		
+		int key;
+		do
+			key = _readKey();
+		while (key == REFRESH_KEY);
+		_matchRow = -1;
 
-		if (cur_rx > rx)
-			return cx;
+		if (key == 'y' || key == 'Y')
+			{
+			stopped = !_makeRoom(_editBytes(cy,
+											0,
+											with.length() + query.length()));
+			if (stopped)
+				break;
+			_rowDelString(cy, match, (int) query.length());
+			_rowInsertString(cy, match, with);
+			cx = match + (int) with.length();
+			replaced ++;
+			}
+		else if (key == 'a' || key == 'A')
+			{
+			replaced += _replaceAll(query, with, cy, match, &stopped);
+			break;
+			}
+		else if (key == 'n' || key == 'N')
+			cx = match + (int) query.length();
+		else
+			break;
 		}
-	return cx;
+	
+	int rowLen = (_cy < numRows) ? _rows.length(_cy) : 0;
+	_cx = MIN(_cx, rowLen);
+	
+	// If we ran out of memory, that's already been said
+	if (!stopped)
+		setStatus("Replaced %d occurrence%s",
+				  replaced, (replaced == 1) ? "" : "s");
+	else if (replaced > 0)
+		setStatus("Out of memory: stopped after replacing %d occurrence%s",
+				  replaced, (replaced == 1) ? "" : "s");
 	}
+
 /*****************************************************************************\
-|* Update a row
+|* Replace every match from (row, col) to the end of the file. Each affected
+|* row is rebuilt once and logged as a single edit pair, and the syntax is
+|* re-highlighted once per run of adjacent changed rows, so the cost is one
+|* pass over the text however many matches there are. If memory runs out
+|* part way, it stops there and sets 'stopped'.
 \*****************************************************************************/
-void Editor::_update(int rowIndex)
+int Editor::_replaceAll(std::string query,
+						std::string with,
+						int row,
+						int col,
+						bool *stopped)
 	{
-	Row& row 	= _rows.at(rowIndex);
-	row.render	= "";
-
-	int idx 	= 0;
-	for (int j = 0; j < row.size; j++)
+	int numRows			= (int) _rows.size();
+	int qlen			= (int) query.length();
+	int replaced		= 0;
+	int first			= -1;
+	int last			= -1;
+	std::string needle	= _needle(query);
+	
+	_stopHighlighting();
+	_index.setQuery(query);
+	for (int i = MAX(row, 0); i < numRows; i++)
 		{
-		if (row.chars.at(j) == '\t')
+		if (!_index.mayContain(i))
+			continue;
+		
+		int match = _rowFind(i, needle, (i == row) ? col : 0);
+		if (match < 0)
+			continue;
+		
+		std::string chars = _rows.string(i);
+		std::string text;
+		text.reserve(chars.length());
+		
+		int from	= 0;
+		int count	= 0;
+		while (match >= 0)
 			{
-			row.render.append(" ");
-			idx ++;
-			while (idx % _tabStop != 0)
-				{
-				row.render.append(" ");
-				idx ++;
-				}
+			text.append(chars, from, match - from);
+			text.append(with);
+			from = match + qlen;
+			count ++;
+			match = _rowFind(i, needle, from);
 			}
-		else
+		text.append(chars, from, std::string::npos);
+		
+		// Stop here if we run out of memory, keeping what's been done
+		if (!_makeRoom(_editBytes(i, 0, chars.length() + text.length())))
 			{
-			row.render.append(row.chars, j, 1);
-			idx ++;
+			if (stopped != nullptr)
+				*stopped = true;
+			break;
 			}
-		}
-  
-	row.rsize = idx;
+		replaced += count;
+		
+		_logEdit(EDIT_DELETE_TEXT, i, 0, chars);
+		_logEdit(EDIT_INSERT_TEXT, i, 0, text);
+		_rows.set(i, text);
 
-	_updateSyntax(row);
+		// Highlight the previous run of changed rows when this one is
+		// not adjacent to it
+		if ((last >= 0) && (last != i - 1))
+			{
+			_updateSyntaxRange(first, last);
+			first = -1;
+			}
+		if (first < 0)
+			first = i;
+		last = i;
+		}
+	
+	if (first >= 0)
+		{
+		_updateSyntaxRange(first, last);
+		_dirty ++;
+		}
+	return replaced;
 	}
 
+#pragma mark - Hex mode
 
 /*****************************************************************************\
-|* Insert a row
+|* Switch between the text of the file and its hex. Hex works on the file
+|* as it is on disk, so the text has to be saved first, and the hex saved
+|* (or its changes thrown away by quitting) to go back
 \*****************************************************************************/
-void Editor::_insertRow(std::string s, int at)
+void Editor::_toggleHex(void)
 	{
-	if ((at >= 0) && (at <= _rows.size()))
+	if (!_hexMode)
 		{
-		Row row =
+		if (_filename.length() == 0)
 			{
-			.idx 				= at,
-			.size				= (int)s.length(),
-			.chars  			= s,
-			.rsize  			= 0,
-			.render 			= "",
-			.hl_open_comment	= 0
-			};
-		_rows.insert(_rows.begin()+at, row);
+			setStatus("There's no file to show in hex");
+			return;
+			}
+		if (_dirty)
+			{
+			setStatus("Save first: hex mode works on the file on disk");
+			return;
+			}
+		if (!_hex.open(_filename, _paging))
+			{
+			setStatus("Can't open '%s': %s", _filename.c_str(), strerror(errno));
+			return;
+			}
+		
+		_hexMode	= true;
+		_hexOnly	= false;
+		_hexCursor	= 0;
+		_hexTop		= 0;
+		_hexLow		= false;
+		_hexAscii	= false;
+		setStatus("HEX: Tab = hex/ASCII | Ctrl-G = go to | Ctrl-S = save | "
+				  "Ctrl-X = text");
+		return;
+		}
+	
+	if (_hexOnly)
+		{
+		setStatus("'%s' isn't text: it can only be shown in hex",
+				  _filename.c_str());
+		return;
+		}
+	if (_hex.dirtyBlocks() > 0)
+		{
+		setStatus("Save first (Ctrl-S), or quit to lose the changes");
+		return;
+		}
+	
+	_hex.close();
+	_hexMode = false;
+	_dirty	 = 0;
+	}
+
+/*****************************************************************************\
+|* Handle a key in hex mode. Bytes can be changed, but not inserted or
+|* deleted, so that every byte stays where it is in the file
+\*****************************************************************************/
+void Editor::_hexKeypress(int c)
+	{
+	off_t last	= MAX(_hex.size() - 1, (off_t) 0);
+	off_t page	= (off_t) _screenRows * HEX_ROW_BYTES;
+	off_t col	= _hexCursor % HEX_ROW_BYTES;
+	
+	switch (c)
+		{
+		case CTRL_KEY('s'):
+			_hexSave();
+			break;
+		
+		case CTRL_KEY('g'):
+			_hexGoto();
+			break;
+		
+		case CTRL_KEY('x'):
+			_toggleHex();
+			break;
+		
+		case CTRL_KEY('u'):
+			_memoryReport();
+			break;
+		
+		case '\t':
+			_hexAscii = !_hexAscii;
+			_hexLow	  = false;
+			break;
+		
+		case ARROW_LEFT:
+			if (!_hexAscii && _hexLow)
+				_hexLow = false;
+			else if (_hexCursor > 0)
+				{
+				_hexCursor --;
+				_hexLow = !_hexAscii;
+				}
+			break;
+		
+		case ARROW_RIGHT:
+			if (!_hexAscii && !_hexLow)
+				_hexLow = true;
+			else if (_hexCursor < last)
+				{
+				_hexCursor ++;
+				_hexLow = false;
+				}
+			break;
+		
+		case ARROW_UP:
+			if (_hexCursor >= HEX_ROW_BYTES)
+				_hexCursor -= HEX_ROW_BYTES;
+			break;
+		
+		case ARROW_DOWN:
+			if (_hexCursor + HEX_ROW_BYTES <= last)
+				_hexCursor += HEX_ROW_BYTES;
+			break;
+		
+		case PAGE_UP:
+			_hexCursor = (_hexCursor >= page) ? _hexCursor - page : col;
+			_hexTop	   = MAX(_hexTop - _screenRows, (off_t) 0);
+			break;
+		
+		case PAGE_DOWN:
+			_hexCursor = (_hexCursor + page <= last) ? _hexCursor + page : last;
+			_hexTop	  += _screenRows;
+			break;
+		
+		case HOME_KEY:
+			_hexCursor -= col;
+			_hexLow		= false;
+			break;
+		
+		case END_KEY:
+			_hexCursor = MIN(_hexCursor - col + HEX_ROW_BYTES - 1, last);
+			_hexLow	   = false;
+			break;
+		
+		case '\r':
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+		case DEL_KEY:
+			setStatus("Bytes can only be changed in hex, not inserted or deleted");
+			break;
+		
+		case CTRL_KEY('l'):
+		case '\x1b':
+			break;
+		
+		default:
+			{
+			int digit = -1;
+			if ((c >= '0') && (c <= '9'))
+				digit = c - '0';
+			else if ((c >= 'a') && (c <= 'f'))
+				digit = c - 'a' + 10;
+			else if ((c >= 'A') && (c <= 'F'))
+				digit = c - 'A' + 10;
+			
+			int byte = _hex.get(_hexCursor);
+			if (_hexAscii ? ((c < ' ') || (c >= 0x7F)) : (digit < 0))
+				setStatus(_hexAscii ? "Only printable ASCII can be typed here"
+									: "Type hex digits here, or Tab for ASCII");
+			else if (_hex.readOnly())
+				setStatus("Read-only: '%s' can't be changed", _filename.c_str());
+			else if (byte < 0)
+				setStatus("There's no byte there to change");
+			else
+				{
+				int value = _hexAscii ? c
+						  : _hexLow	  ? ((byte & 0xF0) | digit)
+									  : ((digit << 4) | (byte & 0x0F));
+				if (!_hex.set(_hexCursor, (uint8_t) value))
+					setStatus("Out of memory: can't change that byte");
+				else if (!_hexAscii && !_hexLow)
+					_hexLow = true;
+				else if (_hexCursor < last)
+					{
+					_hexCursor ++;
+					_hexLow = false;
+					}
+				}
+			break;
+			}
+		}
+	
+	_dirty = _hex.dirtyBlocks();
+	}
+
+/*****************************************************************************\
+|* Keep the cursor's row on the screen
+\*****************************************************************************/
+void Editor::_hexScroll(void)
+	{
+	off_t row = _hexCursor / HEX_ROW_BYTES;
+	if (row < _hexTop)
+		_hexTop = row;
+	if (row >= _hexTop + _screenRows)
+		_hexTop = row - _screenRows + 1;
+	}
+
+/*****************************************************************************\
+|* Hex digits in an offset: 8, or more if the file is over 4GB
+\*****************************************************************************/
+int Editor::_hexDigits(void)
+	{
+	int digits = 8;
+	for (off_t top = _hex.size() >> 32; top > 0; top >>= 4)
+		digits ++;
+	return digits;
+	}
+
+/*****************************************************************************\
+|* The screen column the cursor is in. A row is the offset, two spaces, the
+|* bytes in hex (with a space after each, and another after the eighth),
+|* then the bytes as ASCII between bars
+\*****************************************************************************/
+int Editor::_hexColumn(void)
+	{
+	int at	= (int)(_hexCursor % HEX_ROW_BYTES);
+	int hex	= _hexDigits() + 2;
+	if (_hexAscii)
+		return hex + 3 * HEX_ROW_BYTES + 3 + at;
+	return hex + 3 * at + ((at >= HEX_ROW_BYTES / 2) ? 1 : 0) + (_hexLow ? 1 : 0);
+	}
+
+/*****************************************************************************\
+|* Draw the rows in hex. Only the blocks on screen are read. Changed bytes
+|* are in the error colour, and the cursor's byte is shown inverted in the
+|* column it isn't in
+\*****************************************************************************/
+void Editor::_hexDrawRows(PooledString& buf)
+	{
+	int digits	= _hexDigits();
+	off_t size	= _hex.size();
+	int color	= (*_theme)[HL_ERROR];
+	char cell[32];
+	char mark[16];
+	int markLen = (color == 0) ? snprintf(mark, sizeof(mark), "\x1b[1m")
+							   : snprintf(mark, sizeof(mark), "\x1b[%dm", color);
+	
+	for (int y = 0; y < _screenRows; y++)
+		{
+		off_t at = (_hexTop + y) * HEX_ROW_BYTES;
+		if ((at >= size) && ((at > 0) || (y > 0)))
+			{
+			buf.append("~");
+			buf.append("\x1b[K");
+			buf.append("\r\n");
+			continue;
+			}
+		
+		// Anything past the right of the screen is left off
+		int column = 0;
+		auto put = [&](const char *text, int len)
+			{
+			int fits = MIN(len, _screenCols - column);
+			if (fits > 0)
+				buf.append(text, fits);
+			column += len;
+			};
+		
+		put(cell, snprintf(cell, sizeof(cell), "%0*llx  ", digits, (long long) at));
+		for (int ascii = 0; ascii < 2; ascii++)
+			{
+			if (ascii)
+				put(" |", 2);
+			for (int k = 0; k < HEX_ROW_BYTES; k++)
+				{
+				off_t here	= at + k;
+				int byte	= _hex.get(here);
+				int len;
+				if (here >= size)
+					len = snprintf(cell, sizeof(cell), ascii ? " " : "  ");
+				else if (byte < 0)
+					len = snprintf(cell, sizeof(cell), ascii ? "?" : "??");
+				else if (ascii)
+					len = snprintf(cell, sizeof(cell), "%c",
+								   ((byte >= ' ') && (byte < 0x7F)) ? byte : '.');
+				else
+					len = snprintf(cell, sizeof(cell), "%02x", byte);
+				
+				bool changed = _hex.changed(here);
+				bool cursor	 = (here == _hexCursor) && ((ascii != 0) != _hexAscii);
+				if (changed)
+					buf.append(mark, markLen);
+				if (cursor)
+					buf.append("\x1b[7m");
+				put(cell, len);
+				if (changed || cursor)
+					buf.append("\x1b[m");
+				
+				if (!ascii)
+					put("   ", (k == HEX_ROW_BYTES / 2 - 1) ? 2 : 1);
+				}
+			}
+		put("|", 1);
+		
+		buf.append("\x1b[K");
+		buf.append("\r\n");
+		}
+	}
+
+/*****************************************************************************\
+|* Patch the changed blocks into the file
+\*****************************************************************************/
+void Editor::_hexSave(void)
+	{
+	if (_hex.dirtyBlocks() == 0)
+		{
+		setStatus("No changes to save");
+		return;
+		}
+	
+	off_t written = _hex.save();
+	if (written < 0)
+		setStatus("Can't save! I/O error: %s", strerror(errno));
+	else
+		setStatus("%lld bytes patched in place", (long long) written);
+	_dirty = _hex.dirtyBlocks();
+	}
+
+/*****************************************************************************\
+|* Move the cursor to an offset, in decimal, or hex with 0x in front
+\*****************************************************************************/
+void Editor::_hexGoto(void)
+	{
+	bool cancelled;
+	std::string to = _prompt("Go to offset: %s (0x for hex, ESC to cancel)",
+							 nullptr,
+							 &cancelled);
+	if (cancelled || (to.length() == 0))
+		return;
+	
+	char *end;
+	errno			 = 0;
+	long long offset = strtoll(to.c_str(), &end, 0);
+	if ((*end != '\0') || (errno != 0) || (offset < 0))
+		{
+		setStatus("'%s' isn't an offset", to.c_str());
+		return;
+		}
+	
+	_hexCursor = MIN((off_t) offset, MAX(_hex.size() - 1, (off_t) 0));
+	_hexLow	   = false;
+	}
+
+#pragma mark - Undo / Redo
+
+/*****************************************************************************\
+|* Log a primitive edit into the current batch, and keep the search index in
+|* step with it
+\*****************************************************************************/
+void Editor::_logEdit(EditOp op, int row, int col, std::string_view text)
+	{
+	_foldedRow = -1;
+	_forgetRendered();
+	
+	switch (op)
+		{
+		case EDIT_INSERT_ROW:
+			_index.rowInserted(row);
+			_wraps.forget(row);
+			break;
+		case EDIT_DELETE_ROW:
+			_index.rowDeleted(row);
+			_wraps.forget(row);
+			break;
+		default:
+			_index.rowChanged(row);
+			_wraps.edited(row, col);
+			break;
+		}
+	
+	if (_batch.edits.size() == 0)
+		{
+		_batch.cx = _cx;
+		_batch.cy = _cy;
+		}
+	_batch.edits.push_back({.op	  = op,
+							.row  = row,
+							.col  = col,
+							.text = PooledString(text, _batch.edits.get_allocator())});
+	_journal.log(op, row, col, text);
+	}
+
+/*****************************************************************************\
+|* Close off the current batch, making it the next thing to undo
+\*****************************************************************************/
+void Editor::_closeBatch(void)
+	{
+	if (_batch.edits.size() == 0)
+		return;
+
+	_journal.endBatch(_batch.cx, _batch.cy);
+	_undo.push_back(std::move(_batch));
+	_batch.edits = EditList(StlAllocator<Edit>(_allocator));
+	_redo.clear();
+	
+	if (_undo.size() > EDIT_UNDO_LEVELS)
+		_undo.erase(_undo.begin());
+	}
+
+/*****************************************************************************\
+|* Apply an edit (or its inverse) to the rows. The row operations log the
+|* change as usual, so whatever we do here can itself be undone
+\*****************************************************************************/
+void Editor::_applyEdit(const Edit& edit, bool invert)
+	{
+	int op = edit.op;
+	if (invert)
+		switch (op)
+			{
+			case EDIT_INSERT_TEXT: op = EDIT_DELETE_TEXT; break;
+			case EDIT_DELETE_TEXT: op = EDIT_INSERT_TEXT; break;
+			case EDIT_INSERT_ROW:  op = EDIT_DELETE_ROW;  break;
+			case EDIT_DELETE_ROW:  op = EDIT_INSERT_ROW;  break;
+			}
+
+	switch (op)
+		{
+		case EDIT_INSERT_TEXT:
+			_rowInsertString(edit.row, edit.col, edit.text);
+			break;
+		case EDIT_DELETE_TEXT:
+			_rowDelString(edit.row, edit.col, (int) edit.text.length());
+			break;
+		case EDIT_INSERT_ROW:
+			_insertRow(edit.text, edit.row);
+			break;
+		case EDIT_DELETE_ROW:
+			_delRow(edit.row);
+			break;
+		}
+	}
+
+/*****************************************************************************\
+|* Undo (or redo) the last batch. The inverse edits are collected into a new
+|* batch which goes onto the opposite stack
+\*****************************************************************************/
+void Editor::_undoAction(bool redo)
+	{
+	EditBatchList& from = redo ? _redo : _undo;
+	EditBatchList& to   = redo ? _undo : _redo;
+	
+	if (from.size() == 0)
+		{
+		setStatus("Nothing to %s", redo ? "redo" : "undo");
+		return;
+		}
+	
+	EditBatch batch = std::move(from.back());
+	from.pop_back();
+	
+	// Undoing takes as much again as the edits being undone
+	size_t bytes = 0;
+	for (Edit& edit : batch.edits)
+		bytes += _editBytes(MIN(edit.row, (int) _rows.size() - 1),
+							(edit.op == EDIT_DELETE_ROW) ? 1 : 0,
+							edit.text.length());
+	if (!_makeRoom(bytes))
+		{
+		from.push_back(std::move(batch));
+		return;
+		}
+	
+	for (auto it = batch.edits.rbegin(); it != batch.edits.rend(); ++it)
+		_applyEdit(*it, true);
+	
+	// After a recovery this is just another edit, there's no redo
+	_journal.endBatch(_batch.cx, _batch.cy);
+	to.push_back(std::move(_batch));
+	_batch.edits = EditList(StlAllocator<Edit>(_allocator));
+	
+	_cy = MIN(batch.cy, (int) _rows.size());
+	_cx = batch.cx;
+	int rowLen = (_cy < _rows.size()) ? _rows.length(_cy) : 0;
+	_cx = MIN(_cx, rowLen);
+	}
+
+/*****************************************************************************\
+|* Replay the journal left by a session that didn't save, batch by batch, so
+|* the recovered edits can be undone just as they could before. Anything that
+|* doesn't fit the rows as they are is taken to be damage, and we stop there
+\*****************************************************************************/
+void Editor::_recover(void)
+	{
+	int edits = 0;
+	
+	int replayed = _journal.replay(
+		[&](int op, int row, int col, const std::string& text)
+			{
+			if (op == Journal::OP_BATCH)
+				{
+				_batch.cx = col;
+				_batch.cy = row;
+				_closeBatch();
+				_cx = col;
+				_cy = row;
+				return true;
+				}
+			
+			int numRows	= (int) _rows.size();
+			int len		= (int) text.length();
+			bool valid	= false;
+			switch (op)
+				{
+				case EDIT_INSERT_TEXT:
+					valid = (row >= 0) && (row < numRows)
+						 && (col >= 0) && (col <= _rows.length(row));
+					break;
+				case EDIT_DELETE_TEXT:
+					valid = (row >= 0) && (row < numRows)
+						 && (col >= 0) && (col + len <= _rows.length(row))
+						 && (_rows.text(row).substr(col, len) == text);
+					break;
+				case EDIT_INSERT_ROW:
+					valid = (row >= 0) && (row <= numRows);
+					break;
+				case EDIT_DELETE_ROW:
+					valid = (row >= 0) && (row < numRows)
+						 && (_rows.text(row) == text);
+					break;
+				}
+			
+			if (valid)
+				{
+				_applyEdit({.op = (uint8_t) op,
+							.row = row,
+							.col = col,
+							.text = PooledString(text)}, false);
+				edits ++;
+				}
+			return valid;
+			});
+	
+	_closeBatch();
+	
+	int numRows	= (int) _rows.size();
+	_cy			= MIN(MAX(_cy, 0), numRows);
+	int rowLen	= (_cy < numRows) ? _rows.length(_cy) : 0;
+	_cx			= MIN(MAX(_cx, 0), rowLen);
+	
+	if (replayed < 0)
+		setStatus("'%s' has changed since its journal was written. "
+				  "Journal moved to %s.old",
+				  _filename.c_str(), _journal.path().c_str());
+	else if (edits > 0)
+		setStatus("Recovered %d unsaved edit%s to '%s'",
+				  edits, (edits == 1) ? "" : "s", _filename.c_str());
+	}
+
+#pragma mark - Row operations
+
+/*****************************************************************************\
+|* Where a row is in _rows. When paging, _rows only holds a window onto the
+|* file, which is moved to cover the row if it doesn't already
+\*****************************************************************************/
+int Editor::_slot(int rowId)
+	{
+	if (_paging)
+		{
+		if ((rowId < _windowStart) || (rowId >= _windowStart + _rows.size()))
+			_loadWindow(rowId);
+		return rowId - _windowStart;
+		}
+	return rowId;
+	}
+
+/*****************************************************************************\
+|* The text of a row. This is only good until the rows next change
+\*****************************************************************************/
+std::string_view Editor::_text(int rowId)
+	{
+	return _rows.text(_slot(rowId));
+	}
+
+/*****************************************************************************\
+|* The length of a row
+\*****************************************************************************/
+int Editor::_rowSize(int rowId)
+	{
+	return _rows.length(_slot(rowId));
+	}
+
+/*****************************************************************************\
+|* How many rows there are (or have been found so far, when paging)
+\*****************************************************************************/
+int Editor::_numRows(void)
+	{
+	return _paging ? _pager.numRows() : (int) _rows.size();
+	}
+
+/*****************************************************************************\
+|* Load a window of rows around 'rowId' from the pager. The window is a few
+|* screens tall, so drawing the screen and moving the cursor about stay
+|* inside one window, and the cost of moving it is proportional to the
+|* screen rather than the file. Comment state isn't known above the window,
+|* so highlighting starts afresh at its top.
+|*
+|* The old window goes first, and if the new one still won't fit it's cut
+|* down around 'rowId', to just that row if need be. If even that won't
+|* fit, the row is shown empty rather than running out of memory
+\*****************************************************************************/
+void Editor::_loadWindow(int rowId)
+	{
+	int size	= MAX(4 * _screenRows, 256);
+	int start	= MAX(0, rowId - size / 2);
+	
+	StringList lines;
+	if (!_pager.read(start, size, lines) || (lines.size() == 0))
+		{
+		lines.clear();
+		_pager.read(rowId, 1, lines);
+		start = rowId;
+		}
+	for (int i = 0; i < (int) lines.size(); i++)
+		_decode(lines[i], start + i == 0);
+	
+	_rows.clear();
+	_foldedRow	 = -1;
+	_forgetRendered();
+	
+	auto bytes = [&](int from, int to)
+		{
+		size_t total = _rows.growth(to - from);
+		for (int i = from; i < to; i++)
+			total += 2 * lines[i].length();
+		return total;
+		};
+	
+	int at		= MIN(MAX(rowId - start, 0), MAX((int) lines.size() - 1, 0));
+	int first	= 0;
+	int last	= (int) lines.size();
+	while ((last - first > 1) && !_makeRoom(bytes(first, last)))
+		{
+		int half = (last - first) / 4;
+		first	 = MAX(first, at - half);
+		last	 = MIN(last, at + half + 1);
+		}
+	
+	bool fits = (last - first != 1) || _makeRoom(bytes(first, last));
+	if (!fits)
+		lines[first].clear();
+	if ((last - first < (int) lines.size()) || !fits)
+		setStatus("Out of memory (%s free): %s",
+				  readable(_allocator->available()).c_str(),
+				  fits ? "showing fewer lines at a time"
+					   : "this line is too long to show");
+	
+	_windowStart = start + first;
+	for (int i = first; i < last; i++)
+		{
+		_rows.append(lines[i]);
+		
+		int row = i - first;
+		int in	= (row > 0) ? _rows.state(row - 1) : 0;
+		_rows.setState(row, _updateSyntax(lines[i], nullptr, in));
+		}
+	_highlighted = _rows.size();
+	}
+
+/*****************************************************************************\
+|* Turn text read from the file into what the rows hold: the same, unless
+|* it's Latin-1, and without a byte order mark if it's the start of it
+\*****************************************************************************/
+void Editor::_decode(std::string& text, bool atStart)
+	{
+	if (atStart && _bom && (text.compare(0, Utf8::BOM_BYTES, "\xEF\xBB\xBF") == 0))
+		text.erase(0, Utf8::BOM_BYTES);
+	
+	if (_encoding == Utf8::ENC_LATIN1)
+		{
+		std::string utf8(text.length() + Utf8::latin1Growth(text.data(),
+															 text.length()),
+						 '\0');
+		utf8.resize(Utf8::fromLatin1(text.data(), text.length(), utf8.data()));
+		text.swap(utf8);
+		}
+	}
+
+/*****************************************************************************\
+|* Find the stops in a row (tabs, and anything that isn't a column a byte)
+|* and highlight it for drawing, unless it's already cached
+\*****************************************************************************/
+const Editor::Rendered& Editor::_render(int rowId)
+	{
+	Rendered& entry = _rendered[rowId % RENDER_CACHE_ROWS];
+	if (entry.row != rowId)
+		{
+		int slot			  = _slot(rowId);
+		std::string_view text = _rows.text(slot);
+		
+		// Plain ASCII is skipped a vector at a time, so only the tabs and
+		// anything that isn't ASCII are looked at. When wrapping the stops
+		// aren't wanted (the lines are laid out in _wraps), so a long row
+		// isn't measured all the way along just to draw the start of it
+		entry.stops.clear();
+		const char *chars = text.data();
+		int len			  = _wrapping ? 0 : (int) text.length();
+		int cx			  = 0;
+		int rx			  = 0;
+		int at			  = 0;
+		while ((at += (int) Utf8::plain(chars + at, len - at)) < len)
+			{
+			rx += at - cx;
+			
+			int bytes = 1;
+			int width;
+			if (chars[at] == '\t')
+				width = _tabStop - (rx % _tabStop);
+			else
+				bytes = Utf8::grapheme(chars + at, len - at, &width);
+			
+			// A mark that combines with the ASCII before it makes one
+			// grapheme with it
+			if ((width == 0) && (at > 0) && (chars[at - 1] != '\t'))
+				{
+				if (!entry.stops.empty()
+				 && (entry.stops.back().cx + entry.stops.back().bytes == at))
+					entry.stops.back().bytes += bytes;
+				else
+					entry.stops.push_back({.cx	  = at - 1,
+										   .rx	  = rx - 1,
+										   .bytes = bytes + 1,
+										   .width = 1});
+				}
+			else if ((bytes != 1) || (width != 1))
+				entry.stops.push_back({.cx		= at,
+									   .rx		= rx,
+									   .bytes	= bytes,
+									   .width	= width});
+			rx += width;
+			at += bytes;
+			cx	= at;
+			}
+		
+		// Highlight it if we know the state of the row above, or have a
+		// guess at it, otherwise leave it plain until we do
+		int preview = slot - _previewTop;
+		if (slot <= _highlighted.load(std::memory_order_acquire))
+			_updateSyntax(text,
+						  &entry.spans,
+						  (slot > 0) ? _rows.state(slot - 1) : 0);
+		else if ((preview >= 0) && (preview < (int) _preview.size())
+			  && (preview <= _previewDone.load(std::memory_order_acquire)))
+			_updateSyntax(text,
+						  &entry.spans,
+						  (preview > 0) ? _preview[preview - 1] : 0);
+		else
+			entry.spans.clear();
+		entry.row	 = rowId;
+		_renderedAny = true;
+		}
+	return entry;
+	}
+
+/*****************************************************************************\
+|* The rows have changed, so anything rendered is out of date
+\*****************************************************************************/
+void Editor::_forgetRendered(void)
+	{
+	if (!_renderedAny)
+		return;
+	
+	for (Rendered& entry : _rendered)
+		entry.row = -1;
+	_renderedAny = false;
+	}
+
+/*****************************************************************************\
+|* The last stop at or before column 'cx', or the end if there isn't one
+\*****************************************************************************/
+static Editor::StopList::const_iterator stopAt(const Editor::StopList& stops,
+											   int cx)
+	{
+	auto stop = std::upper_bound(stops.begin(), stops.end(), cx,
+		[](int cx, const Editor::Stop& s) { return cx < s.cx; });
+	return (stop == stops.begin()) ? stops.end() : stop - 1;
+	}
+
+/*****************************************************************************\
+|* Figure out the render x from the column x. Only the last stop before it
+|* matters. A column part of the way through a grapheme is where it starts
+\*****************************************************************************/
+int Editor::_rowCxToRx(int rowId, int cx)
+	{
+	const StopList& stops = _render(rowId).stops;
+	
+	auto stop = stopAt(stops, cx);
+	if (stop == stops.end())
+		return cx;
+	if (cx < stop->cx + stop->bytes)
+		return stop->rx;
+	return stop->rx + stop->width + (cx - stop->cx - stop->bytes);
+	}
+
+/*****************************************************************************\
+|* Figure out the column x from the render x, which may be part of the way
+|* through a tab or a wide character
+\*****************************************************************************/
+int Editor::_rowRxToCx(int rowId, int rx)
+	{
+	const StopList& stops = _render(rowId).stops;
+	
+	auto stop = std::upper_bound(stops.begin(), stops.end(), rx,
+		[](int rx, const Stop& s) { return rx < s.rx; });
+	
+	int cx = rx;
+	if (stop != stops.begin())
+		{
+		stop --;
+		if (rx < stop->rx + stop->width)
+			cx = stop->cx;
+		else
+			cx = stop->cx + stop->bytes + (rx - stop->rx - stop->width);
+		}
+	
+	return MIN(cx, _rowSize(rowId));
+	}
+
+/*****************************************************************************\
+|* The column of the grapheme before column 'cx'
+\*****************************************************************************/
+int Editor::_rowPrevCx(int rowId, int cx)
+	{
+	if (cx <= 0)
+		return 0;
+	if (_wrapping)
+		return _wraps.prev(rowId, _text(rowId), cx);
+	
+	const StopList& stops = _render(rowId).stops;
+	auto stop = stopAt(stops, cx - 1);
+	if ((stop != stops.end()) && (cx - 1 < stop->cx + stop->bytes))
+		return stop->cx;
+	return cx - 1;
+	}
+
+/*****************************************************************************\
+|* The column of the grapheme after the one at column 'cx'
+\*****************************************************************************/
+int Editor::_rowNextCx(int rowId, int cx)
+	{
+	if (_wrapping)
+		return _wraps.next(rowId, _text(rowId), cx);
+	
+	const StopList& stops = _render(rowId).stops;
+	auto stop = stopAt(stops, cx);
+	if ((stop != stops.end()) && (cx < stop->cx + stop->bytes))
+		return MIN(stop->cx + stop->bytes, _rowSize(rowId));
+	return MIN(cx + 1, _rowSize(rowId));
+	}
+
+/*****************************************************************************\
+|* The column of the grapheme that column 'cx' is part of
+\*****************************************************************************/
+int Editor::_rowSnapCx(int rowId, int cx)
+	{
+	if (_wrapping)
+		return _wraps.snap(rowId, _text(rowId), cx);
+	
+	const StopList& stops = _render(rowId).stops;
+	auto stop = stopAt(stops, cx);
+	if ((stop != stops.end()) && (cx < stop->cx + stop->bytes))
+		return stop->cx;
+	return cx;
+	}
+
+/*****************************************************************************\
+|* Find a string in a row, starting at column 'from'. Returns the column of
+|* the match, or -1. The string is the needle _needle() made of the query.
+|*
+|* Case-insensitive searches fold the row once into a scratch buffer, kept
+|* until the next edit since replace calls us repeatedly on the same row
+\*****************************************************************************/
+int Editor::_rowFind(int rowId, const std::string& needle, int from)
+	{
+	std::string_view chars = _text(rowId);
+	int size			   = (int) chars.length();
+	
+	if (!(_searchFlags & Search::SEARCH_CASELESS))
+		return Search::find(chars.data(), size, needle, from, _searchFlags);
+	
+	if (_foldedRow != rowId)
+		{
+		_folded.resize(size);
+		CharClass::fold(chars.data(), _folded.data(), size);
+		_foldedRow = rowId;
+		}
+	
+	return Search::find(_folded.data(), size, needle, from, _searchFlags);
+	}
+
+/*****************************************************************************\
+|* What _rowFind() looks for: the query, folded once per search if it's
+|* case-insensitive rather than once per row
+\*****************************************************************************/
+std::string Editor::_needle(const std::string& query)
+	{
+	return Search::needle(query, _searchFlags);
+	}
+
+/*****************************************************************************\
+|* Update a row
+\*****************************************************************************/
+void Editor::_update(int rowIndex)
+	{
+	_updateSyntaxRange(rowIndex, rowIndex);
+	}
+
+/*****************************************************************************\
+|* Insert a row
+\*****************************************************************************/
+void Editor::_insertRow(std::string_view s, int at)
+	{
+	if ((at >= 0) && (at <= _rows.size()))
+		{
+		_stopHighlighting();
+		_rows.insert(at, s);
+		if (at < _highlighted)
+			_highlighted ++;
+		_logEdit(EDIT_INSERT_ROW, at, 0, s);
 		_update(at);
 		_dirty ++;
 		}
@@ -1217,48 +3974,69 @@ void Editor::_delRow(int at)
 
 	if (at < 0 || at >= numRows)
 		return;
-	_rows.erase(_rows.begin()+at);
-	for (int j = at; j < numRows - 1; j++)
-		_rows.at(j).idx--;
+	
+	_logEdit(EDIT_DELETE_ROW, at, 0, _rows.string(at));
+	_stopHighlighting();
+	_rows.erase(at);
+	if (at < _highlighted)
+		_highlighted --;
+	
+	// The row that moved up may now start inside (or outside) a comment
+	if (at < numRows - 1)
+		_updateSyntaxRange(at, at);
 	_dirty++;
 	}
 
 /*****************************************************************************\
 |* Insert a character in a row
 \*****************************************************************************/
-void Editor::_rowInsertChar(Row& row, int at, int c)
+void Editor::_rowInsertChar(int rowId, int at, int c)
+	{
+	_rowInsertString(rowId, at, std::string(1, (char)c));
+	}
+
+/*****************************************************************************\
+|* Insert a string in a row
+\*****************************************************************************/
+void Editor::_rowInsertString(int rowId, int at, std::string_view s)
 	{
-	if ((at < 0) || (at > row.size))
-		at = row.size;
+	int size = _rows.length(rowId);
+	if ((at < 0) || (at > size))
+		at = size;
 		
-	row.chars.insert(at, 1, c);
+	_logEdit(EDIT_INSERT_TEXT, rowId, at, s);
+	std::string chars = _rows.string(rowId);
+	chars.insert(at, s);
+	_stopHighlighting();
+	_rows.set(rowId, chars);
 
-	row.size++;
-  	_update(row.idx);
+  	_update(rowId);
 	_dirty++;
 	}
 
 /*****************************************************************************\
 |* Append a string to a row
 \*****************************************************************************/
-void Editor::_rowAppendString(Row& row, std::string s)
+void Editor::_rowAppendString(int rowId, std::string s)
 	{
-	row.chars.append(s);
-	row.size += s.length();
-  	_update(row.idx);
-  	_dirty++;
+	_rowInsertString(rowId, _rows.length(rowId), s);
 	}
 
 /*****************************************************************************\
-|* Delete a character from a row
+|* Delete a run of characters from a row
 \*****************************************************************************/
-void Editor::_rowDelChar(Row& row, int at)
+void Editor::_rowDelString(int rowId, int at, int len)
 	{
-	if ((at < 0) || (at >= row.size))
+	int size = _rows.length(rowId);
+	if ((at < 0) || (at >= size) || (len <= 0))
 		return;
 	
-	row.chars.erase(row.chars.begin()+at);
-	row.size--;
-	_update(row.idx);
+	len = MIN(len, size - at);
+	std::string chars = _rows.string(rowId);
+	_logEdit(EDIT_DELETE_TEXT, rowId, at, chars.substr(at, len));
+	chars.erase(at, len);
+	_stopHighlighting();
+	_rows.set(rowId, chars);
+	_update(rowId);
 	_dirty++;
 	}
@@ -8,12 +8,30 @@
 #ifndef Editor_h
 #define Editor_h
 
+#include <array>
+#include <atomic>
 #include <cstdio>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include "properties.h"
 #include "macros.h"
+#include "Allocator.h"
+#include "FileWatcher.h"
+#include "FunctionRef.h"
+#include "HexFile.h"
+#include "HighlightCache.h"
+#include "Journal.h"
+#include "LexerStates.h"
+#include "LineStore.h"
+#include "Pager.h"
+#include "Syntax.h"
+#include "SyntaxCache.h"
+#include "Tokenizer.h"
+#include "TrigramIndex.h"
+#include "WrapCache.h"
 
 #define TERMIOS
 #ifdef TERMIOS
@@ -29,21 +47,7 @@ class Editor
     \*************************************************************************/
     public:
 		typedef std::vector<std::string> StringList;
-		typedef std::function<void(std::string, int key)> promptCallback;
-		
-		/*********************************************************************\
-		|* Syntax highlighting pattern control
-		\*********************************************************************/
-		typedef struct Syntax
-			{
-			std::string filetype;
-			StringList filematch;
-			StringList keywords;
-			std::string singleLineCommentStart;
-			std::string multiLineCommentStart;
-			std::string multilineCommentEnd;
-			int flags;
-			} Syntax;
+		typedef FunctionRef<void(std::string, int key)> promptCallback;
 
 		/*********************************************************************\
 		|* Special keys that we understand
@@ -59,42 +63,128 @@ class Editor
 			HOME_KEY,
 			END_KEY,
 			PAGE_UP,
-			PAGE_DOWN
+			PAGE_DOWN,
+			REFRESH_KEY						// Not a key: redraw please
 			} Key;
 
 		/*********************************************************************\
 		|* Highlight-types
 		\*********************************************************************/
-		enum
-			{
-			HIGHLIGHT_NUMBERS = (1<<0),
-			HIGHLIGHT_STRINGS = (1<<1)
-			};
-		
 		typedef enum Highlight
 			{
-			HL_NORMAL = 0,
-			HL_COMMENT,
-			HL_MLCOMMENT,
-			HL_KEYWORD1,
-			HL_KEYWORD2,
-			HL_STRING,
-			HL_NUMBER,
-			HL_MATCH
+			HL_NORMAL		= Tokenizer::TOKEN_TEXT,
+			HL_COMMENT		= Tokenizer::TOKEN_COMMENT,
+			HL_MLCOMMENT	= Tokenizer::TOKEN_MLCOMMENT,
+			HL_KEYWORD1		= Tokenizer::TOKEN_KEYWORD1,
+			HL_KEYWORD2		= Tokenizer::TOKEN_KEYWORD2,
+			HL_STRING		= Tokenizer::TOKEN_STRING,
+			HL_NUMBER		= Tokenizer::TOKEN_NUMBER,
+			HL_CONSTANT		= Tokenizer::TOKEN_CONSTANT,
+			HL_VARIABLE		= Tokenizer::TOKEN_VARIABLE,
+			HL_ERROR		= Tokenizer::TOKEN_ERROR,
+			HL_WARNING		= Tokenizer::TOKEN_WARNING,
+			HL_MATCH		= Tokenizer::NUM_TOKENS,
+			HL_COUNT
 			} Highlight;
 
-		typedef struct Row
+		/*********************************************************************\
+		|* Colours to draw each highlight in, as ANSI foreground colours (30
+		|* to 37, or 90 to 97 for the bright ones), or 0 for the terminal's
+		|* own. Indexed by HL_*
+		\*********************************************************************/
+		typedef std::array<uint8_t, HL_COUNT> Theme;
+
+		/*********************************************************************\
+		|* A run of columns highlighted the same way. Columns that aren't in
+		|* any span are HL_NORMAL
+		\*********************************************************************/
+		typedef struct Span
 			{
-			int 					idx;
-			int 					size;
-			int 					rsize;
-			std::string				chars;
-			std::string				render;
-			std::vector<uint8_t>	hl;
-			int 					hl_open_comment;
-			} Row;
-		
-		typedef std::vector<Row> RowList;
+			int						start;	// First column
+			int						length;	// Columns in the run
+			uint8_t					hl;		// Highlight
+			} Span;
+
+		typedef std::vector<Span, StlAllocator<Span>> SpanList;
+		typedef HighlightCache<Span> SpanCache;
+
+		/*********************************************************************\
+		|* Something in a row that isn't one column a byte: a tab, or a
+		|* grapheme that's more than one byte or not one column wide. Between
+		|* them every byte is a column, so these are all it takes to map
+		|* between columns and render columns
+		\*********************************************************************/
+		typedef struct Stop
+			{
+			int						cx;		// Column it starts at
+			int						rx;		// Render column it starts at
+			int						bytes;	// Columns it takes
+			int						width;	// ... and render columns
+			} Stop;
+
+		typedef std::vector<Stop, StlAllocator<Stop>> StopList;
+
+		/*********************************************************************\
+		|* What it takes to draw a row: its stops, to map between columns and
+		|* render columns and step over graphemes, and its highlighting by
+		|* column. Tabs are expanded as the row is drawn. Only the rows on
+		|* screen (and the cursor's) are worked out, into a small cache, so
+		|* a long row is only measured once until it changes
+		\*********************************************************************/
+		typedef struct Rendered
+			{
+			int						row;	// Row rendered here, or -1
+			StopList				stops;	// Its stops, in order
+			SpanList				spans;	// ... and its highlighting
+			} Rendered;
+
+		/*********************************************************************\
+		|* Primitive edits, recorded so they can be undone as a batch
+		\*********************************************************************/
+		typedef enum EditOp
+			{
+			EDIT_INSERT_TEXT = 0,
+			EDIT_DELETE_TEXT,
+			EDIT_INSERT_ROW,
+			EDIT_DELETE_ROW
+			} EditOp;
+
+		typedef struct Edit
+			{
+			uint8_t					op;
+			int						row;
+			int						col;
+			PooledString			text;
+			} Edit;
+
+		typedef std::vector<Edit, StlAllocator<Edit>> EditList;
+
+		typedef struct EditBatch
+			{
+			EditList				edits;
+			int						cx;
+			int						cy;
+			} EditBatch;
+
+		typedef std::vector<EditBatch, StlAllocator<EditBatch>> EditBatchList;
+
+		/*********************************************************************\
+		|* A highlighter, for a language. It takes the state the row above
+		|* left (see LexerStates.h) and returns the state this one leaves.
+		|* Without a span list that's all it works out
+		\*********************************************************************/
+		typedef int (Editor::*Highlighter)(std::string_view chars,
+										   SpanList *spans,
+										   int in);
+
+		/*********************************************************************\
+		|* A built-in language, and the highlighter made for it
+		\*********************************************************************/
+		typedef struct Language
+			{
+			const Syntax *			syntax;
+			Highlighter				highlighter;
+			} Language;
 		
 	/*************************************************************************\
     |* Properties
@@ -110,20 +200,133 @@ class Editor
     GET(std::string, filename);			// Path to the file
     GET(std::string, status);			// Status string at the bottom
     GET(time_t, statusTime);			// Cron for the status string
-    GET(Syntax*, syntax);				// Highlighting syntax control
-    GET(RowList, rows);					// List of rows of text
+    GET(const Syntax *, syntax);		// Highlighting syntax control
+    GET(SpanCache, highlightCache);		// Rows highlighted before
+    GET(SyntaxCache, syntaxFiles);		// Languages loaded at runtime
+    GET(LexerStates, lexerStates);		// What rows leave open, by number
+    GET(LineStore, rows);				// Text of the rows
+    GET(Allocator *, allocator);		// Where the rows' memory comes from
     GETSET(int, tabStop, TapStop);		// Tab stop value
+    GETSET(const Theme *, theme, Theme);	// Colours for the highlighting
+    GET(EditBatchList, undo);			// Batches of edits we can undo
+    GET(EditBatchList, redo);			// Batches of edits we can redo
+    GET(EditBatch, batch);				// Edits made by the current action
+    GET(TrigramIndex, index);			// Search index over the rows
+    GETSET(bool, useIndex, UseIndex);	// Index files when they're opened
+    GETSET(int, searchFlags, SearchFlags);	// Search::SEARCH_CASELESS etc.
+    GET(bool, paging);					// Read-only view of a huge file
+    GET(Pager, pager);					// Lines of the file when paging
+    GET(int, windowStart);				// Row held in _rows[0] when paging
+    GET(FileWatcher, watcher);			// Notices changes to the file
+    GET(bool, following);				// Tracking lines appended to the file
+    GET(off_t, tailOffset);				// Bytes of the file we've read
+    GET(bool, tailPartial);				// Last row had no newline yet
+    GET(int, encoding);					// Utf8::ENC_* the file is in
+    GET(bool, bom);						// ... and if it has a byte order mark
+    GET(Journal, journal);				// Unsaved edits, for recovery
+    GET(HexFile, hex);					// Bytes of the file, in hex mode
+    GET(bool, hexMode);					// Showing _hex rather than the rows
+    GET(bool, wrapping);				// Long rows wrap, not scroll sideways
+    GET(WrapCache, wraps);				// ... and where they wrap
+
+    protected:
+		int				_foldedRow;			// Row cached in _folded
+		PooledString	_folded;			// Case-folded copy of that row
+		int				_pagerRows;			// Rows the pager had last time
+		bool			_tailPending;		// Appended data not yet read
+		bool			_diskChanged;		// File changed under unsaved edits
+		bool			_waitingForKey;		// Safe to change rows when idle
+		std::vector<Rendered> _rendered;	// Rows rendered for drawing
+		bool			_renderedAny;		// ... if any are
+		int				_matchRow;			// Search match to show, or -1
+		int				_matchCx;			// ... its column
+		int				_matchLen;			// ... and length
+		PooledString	_frame;				// Screen update being built
+		Highlighter		_highlighter;		// For _syntax
+		static const Language _languages[];	// Built in (see Languages.h)
+
+		// Rows are highlighted from the top down in the background. Those
+		// above _highlighted have their final state, and the rest are drawn
+		// plain until the worker gets to them. The viewport can be guessed
+		// at first (see _highlightInBackground())
+		std::atomic<int>	_highlighted;	// Rows with a final state
+		int					_highlightSeen;	// ... when last drawn
+		std::atomic<bool>	_highlightCancel;	// Ask the worker to stop
+		std::thread			_highlightWorker;	// Highlights the rest
+		SpanCache			_backgroundCache;	// ... with a cache of its own
+		std::vector<uint32_t> _preview;		// Guessed states for the viewport
+		int					_previewTop;	// ... from this row
+		std::atomic<int>	_previewDone;	// ... and how many are done
+		int					_previewSeen;	// ... when last drawn
+		
+		// Hex mode is a view of the bytes of the file on disk, HEX_ROW_BYTES
+		// to a row, with the cursor on one of them, in hex or as ASCII
+		bool				_hexOnly;		// No text to go back to
+		off_t				_hexCursor;		// Byte the cursor's on
+		off_t				_hexTop;		// Row at the top of the screen
+		bool				_hexLow;		// Cursor on the low nybble
+		bool				_hexAscii;		// ... or in the ASCII column
+		
+		// When wrapping, the top of the screen can be part of the way down
+		// a row, and the cursor's line isn't just its row less _rowOffset
+		int					_wrapOffset;	// Line of _rowOffset at the top
+		int					_wrapY;			// Screen line the cursor's on
         
     public:
+        /*********************************************************************\
+        |* The colours we use unless we're given others
+        \*********************************************************************/
+		static const Theme defaultTheme;
+
         /*********************************************************************\
         |* Constructors and Destructor
         \*********************************************************************/
         explicit Editor();
+        ~Editor();
+
+        /*********************************************************************\
+        |* Keep the document in memory from 'allocator' (a budget, or a fixed
+        |* pool) rather than the heap. Call this before opening anything
+        \*********************************************************************/
+        void setAllocator(Allocator *allocator);
+
+        /*********************************************************************\
+        |* Load syntax definitions from a directory (see SyntaxCache.h). They
+        |* take precedence over the built-in languages. Returns how many
+        |* there were
+        \*********************************************************************/
+        int loadSyntax(std::string directory);
 
         /*********************************************************************\
         |* Open a file
         \*********************************************************************/
         void open(std::string filename);
+
+        /*********************************************************************\
+        |* View a file read-only, without loading it all into memory
+        \*********************************************************************/
+        void view(std::string filename);
+
+        /*********************************************************************\
+        |* Edit a file in hex, a block at a time, patching it in place
+        \*********************************************************************/
+        void hex(std::string filename, bool readOnly = false);
+
+        /*********************************************************************\
+        |* Wrap long rows onto as many lines as they take, rather than
+        |* scrolling sideways to see the rest of them
+        \*********************************************************************/
+        void wrap(bool on);
+
+        /*********************************************************************\
+        |* Follow lines appended to the file, like tail -f
+        \*********************************************************************/
+        void follow(bool on);
+ 
+        /*********************************************************************\
+        |* Time how fast a file highlights in each language, and print it
+        \*********************************************************************/
+        void benchmark(std::string filename);
  
         /*********************************************************************\
         |* Run the editor
@@ -140,6 +343,21 @@ class Editor
         |* Save a file
         \*********************************************************************/
         void _save(void);
+
+        /*********************************************************************\
+        |* Say how much memory the document is using, and how well the
+        |* highlight cache is doing
+        \*********************************************************************/
+        void _memoryReport(void);
+
+        /*********************************************************************\
+        |* Stay within the memory budget. Making room for an edit sheds the
+        |* caches, then the oldest undo history, and if it still won't fit
+        |* says so and returns false
+        \*********************************************************************/
+		bool _makeRoom(size_t bytes);
+		size_t _editBytes(int row, int rows, size_t text);
+		void _dropCaches(void);
  
         /*********************************************************************\
         |* Get the window size
@@ -169,24 +387,50 @@ class Editor
         /*********************************************************************\
         |* Refresh the screen
         \*********************************************************************/
-        void _drawRows(std::string& buf);
-		void _drawStatusBar(std::string& buf);
-		void _drawMessageBar(std::string& buf);
+        void _drawRows(PooledString& buf);
+		void _drawRow(PooledString& buf, int rowId, int x, int end, int rx);
+		int  _drawRun(PooledString& buf,
+					  const char *text,
+					  int len,
+					  int rx,
+					  int hl,
+					  int& color);
+		void _drawStatusBar(PooledString& buf);
+		void _drawMessageBar(PooledString& buf);
 
         /*********************************************************************\
         |* Figure out row, col offsets
         \*********************************************************************/
         void _scroll(void);
+		void _wrapScroll(void);
+		void _wrapMove(int& rowId, int& line, int by);
+		int  _wrapLines(int rowId, int most = INT_MAX);
 
         /*********************************************************************\
-        |* Colour map for different types of highlight
+        |* Highlighting. _highlight() is instantiated for each built-in
+        |* language, so its tables are constants there; with no language
+        |* given it uses whatever _syntax is. _updateSyntax() looks in
+        |* _highlightCache first, or in the given cache off the main thread
         \*********************************************************************/
-		int _syntaxToColor(int hl);
-
-        /*********************************************************************\
-        |* Colour map for different types of highlight
-        \*********************************************************************/
-		void _updateSyntax(Row& row);
+		int  _updateSyntax(std::string_view chars,
+						   SpanList *spans,
+						   int in,
+						   SpanCache *cache = nullptr);
+		template <const Syntax *Fixed>
+		int  _highlight(std::string_view chars,
+						SpanList *spans,
+						int in);
+		void _updateSyntaxRange(int from, int to);
+		void _rehighlight(void);
+		void _startHighlighting(void);
+		void _stopHighlighting(void);
+		void _highlightInBackground(int from,
+									int in,
+									int previewTop,
+									int previewRows);
+		bool _highlightProgress(void);
+		const Rendered& _render(int rowId);
+		void _forgetRendered(void);
 		void _selectSyntaxHighlight(void);
 		
         /*********************************************************************\
@@ -195,6 +439,10 @@ class Editor
         void _processKeypress(void);
         int  _readKey(void);
 		void _moveCursor(int key);
+		bool _idle(void);
+		bool _tail(void);
+		bool _fileChanged(void);
+		bool _reload(void);
 		
         /*********************************************************************\
         |* editor operations
@@ -204,22 +452,63 @@ class Editor
 		void _delChar(void);
 		void _find(void);
 		void _findAction(std::string query, int key);
+		void _replace(void);
+		int  _replaceAll(std::string query,
+						 std::string with,
+						 int row,
+						 int col,
+						 bool *stopped = nullptr);
+
+        /*********************************************************************\
+        |* Hex mode
+        \*********************************************************************/
+		void _toggleHex(void);
+		void _hexKeypress(int c);
+		void _hexScroll(void);
+		void _hexDrawRows(PooledString& buf);
+		int  _hexColumn(void);
+		int  _hexDigits(void);
+		void _hexSave(void);
+		void _hexGoto(void);
+
+        /*********************************************************************\
+        |* Undo / redo
+        \*********************************************************************/
+		void _logEdit(EditOp op, int row, int col, std::string_view text);
+		void _closeBatch(void);
+		void _applyEdit(const Edit& edit, bool invert);
+		void _undoAction(bool redo);
+		void _recover(void);
 		
         /*********************************************************************\
         |* row operations
         \*********************************************************************/
+		int  _slot(int rowId);
+		std::string_view _text(int rowId);
+		int  _rowSize(int rowId);
+		int  _numRows(void);
+		void _loadWindow(int rowId);
+		void _decode(std::string& text, bool atStart);
 		int  _rowCxToRx(int rowId, int cx);
 		int  _rowRxToCx(int rowId, int rx);
-		void _rowDelChar(Row& row, int at);
-		void _rowAppendString(Row& row, std::string s);
-		void _rowInsertChar(Row& row, int at, int c);
+		int  _rowPrevCx(int rowId, int cx);
+		int  _rowNextCx(int rowId, int cx);
+		int  _rowSnapCx(int rowId, int cx);
+		int  _rowFind(int rowId, const std::string& needle, int from);
+		std::string _needle(const std::string& query);
+		void _rowDelString(int rowId, int at, int len);
+		void _rowAppendString(int rowId, std::string s);
+		void _rowInsertChar(int rowId, int at, int c);
+		void _rowInsertString(int rowId, int at, std::string_view s);
 		void _delRow(int at);
-		void _insertRow(std::string, int at);
+		void _insertRow(std::string_view s, int at);
  
         /*********************************************************************\
         |* Prompt the user
         \*********************************************************************/
-		std::string _prompt(std::string prompt, promptCallback cb);
+		std::string _prompt(std::string prompt,
+							promptCallback cb,
+							bool *cancelled = nullptr);
 
 
 	};
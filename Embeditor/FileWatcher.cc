@@ -0,0 +1,167 @@
+//
+//  FileWatcher.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FileWatcher.h"
+
+#ifdef USE_INOTIFY
+#  include <sys/inotify.h>
+#endif
+
+#define WATCH_MASK	(IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB 				\
+					| IN_MOVE_SELF | IN_DELETE_SELF)
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+FileWatcher::FileWatcher()
+			:_filename("")
+			,_fd(-1)
+			,_wd(-1)
+			,_inode(0)
+			,_size(0)
+			,_mtime(0)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+FileWatcher::~FileWatcher()
+	{
+	stop();
+	}
+
+/*****************************************************************************\
+|* Start watching a file
+\*****************************************************************************/
+bool FileWatcher::watch(std::string filename)
+	{
+	stop();
+	_filename = filename;
+	_statChanges();
+
+	// If inotify isn't available we fall back to stat()
+	#ifdef USE_INOTIFY
+		_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (_fd >= 0)
+			{
+			_wd = inotify_add_watch(_fd, filename.c_str(), WATCH_MASK);
+			if (_wd < 0)
+				{
+				::close(_fd);
+				_fd = -1;
+				}
+			}
+	#endif
+	return true;
+	}
+
+/*****************************************************************************\
+|* Stop watching
+\*****************************************************************************/
+void FileWatcher::stop(void)
+	{
+	#ifdef USE_INOTIFY
+		if (_fd >= 0)
+			::close(_fd);
+	#endif
+	_fd			= -1;
+	_wd			= -1;
+	_filename	= "";
+	}
+
+/*****************************************************************************\
+|* Are we watching anything
+\*****************************************************************************/
+bool FileWatcher::watching(void)
+	{
+	return _filename.length() > 0;
+	}
+
+/*****************************************************************************\
+|* Collect everything that's happened since last time. When the file has
+|* been replaced (saved by rename, or deleted and recreated) the watch
+|* follows the path to the new file
+\*****************************************************************************/
+int FileWatcher::poll(void)
+	{
+	if (!watching())
+		return 0;
+
+	#ifdef USE_INOTIFY
+		if (_fd >= 0)
+			{
+			int changes = 0;
+			char buf[4096]
+				__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+			ssize_t got;
+			while ((got = read(_fd, buf, sizeof(buf))) > 0)
+				{
+				for (char *p = buf; p < buf + got; )
+					{
+					struct inotify_event *ev = (struct inotify_event *)p;
+					if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+						changes |= WATCH_REPLACED;
+					else
+						changes |= WATCH_CHANGED;
+					p += sizeof(struct inotify_event) + ev->len;
+					}
+				}
+
+			if (changes & WATCH_REPLACED)
+				{
+				inotify_rm_watch(_fd, _wd);
+				_wd = inotify_add_watch(_fd, _filename.c_str(), WATCH_MASK);
+				}
+
+			// Keep the stat() view current too, it spots a replacement
+			// that inotify only reported as an attribute change
+			if (changes != 0)
+				changes |= _statChanges();
+			return changes;
+			}
+	#endif
+
+	return _statChanges();
+	}
+
+/*****************************************************************************\
+|* Catch up without reporting anything
+\*****************************************************************************/
+void FileWatcher::sync(void)
+	{
+	poll();
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* Compare the file with how it was last time we looked
+\*****************************************************************************/
+int FileWatcher::_statChanges(void)
+	{
+	struct stat sb;
+	int changes = 0;
+
+	if (stat(_filename.c_str(), &sb) != 0)
+		return 0;
+
+	if (sb.st_ino != _inode)
+		changes |= WATCH_REPLACED;
+	if ((sb.st_size != _size) || (sb.st_mtime != _mtime))
+		changes |= WATCH_CHANGED;
+
+	_inode	= sb.st_ino;
+	_size	= sb.st_size;
+	_mtime	= sb.st_mtime;
+	return changes;
+	}
@@ -0,0 +1,83 @@
+//
+//  FileWatcher.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef FileWatcher_h
+#define FileWatcher_h
+
+#include <string>
+
+#include <sys/types.h>
+
+#include "properties.h"
+#include "macros.h"
+
+#if defined(__linux__)
+#  define USE_INOTIFY
+#endif
+
+/*****************************************************************************\
+|* Notice when a file changes on disk. On Linux this is driven by inotify, so
+|* polling costs one non-blocking read(); elsewhere we fall back to
+|* comparing stat() results. Either way, poll() reports everything that has
+|* happened since it was last called, so a burst of writes is seen as one
+|* change
+\*****************************************************************************/
+class FileWatcher
+	{
+    NON_COPYABLE_NOR_MOVEABLE(FileWatcher)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			WATCH_CHANGED	= (1<<0),		// Contents have changed
+			WATCH_REPLACED	= (1<<1)		// Path now names another file
+			};
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(std::string, filename);			// File being watched
+
+    protected:
+		int				_fd;				// inotify descriptor
+		int				_wd;				// inotify watch
+		ino_t			_inode;				// Last seen inode
+		off_t			_size;				// Last seen size
+		time_t			_mtime;				// Last seen modification time
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit FileWatcher();
+        ~FileWatcher();
+
+        /*********************************************************************\
+        |* Start and stop watching
+        \*********************************************************************/
+        bool watch(std::string filename);
+		void stop(void);
+		bool watching(void);
+
+        /*********************************************************************\
+        |* What has happened since the last call: WATCH_CHANGED etc.
+        \*********************************************************************/
+		int poll(void);
+
+        /*********************************************************************\
+        |* Forget what's happened so far, eg: changes we made ourselves
+        \*********************************************************************/
+		void sync(void);
+
+    private:
+		int _statChanges(void);
+	};
+
+#endif /* FileWatcher_h */
@@ -0,0 +1,92 @@
+//
+//  FunctionRef.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef FunctionRef_h
+#define FunctionRef_h
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/*****************************************************************************\
+|* A reference to something callable: a function, a lambda, or any object
+|* with an operator(). It's two pointers, and unlike std::function it never
+|* allocates, needs neither exceptions nor RTTI, and doesn't bring in a
+|* template instantiation of the type-erasure machinery per signature.
+|*
+|* It doesn't own what it refers to, so it's for passing callbacks down to
+|* something that calls them before it returns, not for keeping them:
+|*
+|*     auto cb = [&](int row) { ... };
+|*     walk(cb);                    // where walk(FunctionRef<void(int)> fn)
+\*****************************************************************************/
+template <typename Signature>
+class FunctionRef;
+
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)>
+	{
+    private:
+		void *					_object;	// What's called
+		R (*_call)(void *, Args...);		// ... and how
+
+		template <typename F>
+		static R _invoke(void *object, Args... args)
+			{
+			return (*(F *) object)(std::forward<Args>(args)...);
+			}
+
+		template <typename F>
+		static R _invokeFunction(void *object, Args... args)
+			{
+			return ((F) object)(std::forward<Args>(args)...);
+			}
+
+    public:
+        /*********************************************************************\
+        |* Nothing to call
+        \*********************************************************************/
+		FunctionRef(std::nullptr_t = nullptr)
+			:_object(nullptr)
+			,_call(nullptr)
+			{}
+
+        /*********************************************************************\
+        |* A plain function
+        \*********************************************************************/
+		FunctionRef(R (*fn)(Args...))
+			:_object((void *) fn)
+			,_call((fn == nullptr) ? nullptr : &_invokeFunction<R (*)(Args...)>)
+			{}
+
+        /*********************************************************************\
+        |* Anything else callable. It has to outlive the reference
+        \*********************************************************************/
+		template <typename F,
+				  typename = std::enable_if_t<
+						!std::is_same_v<std::decay_t<F>, FunctionRef>
+					 && std::is_invocable_r_v<R, F&, Args...>>>
+		FunctionRef(F&& fn)
+			:_object((void *) std::addressof(fn))
+			,_call(&_invoke<std::remove_reference_t<F>>)
+			{}
+
+        /*********************************************************************\
+        |* Call it
+        \*********************************************************************/
+		R operator() (Args... args) const
+			{
+			return _call(_object, std::forward<Args>(args)...);
+			}
+
+		explicit operator bool() const
+			{
+			return _call != nullptr;
+			}
+	};
+
+#endif /* FunctionRef_h */
@@ -0,0 +1,310 @@
+//
+//  HexFile.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HexFile.h"
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+HexFile::HexFile()
+		:_filename("")
+		,_fd(-1)
+		,_size(0)
+		,_readOnly(true)
+		,_dirtyBlocks(0)
+		,_allocator(Allocator::heap())
+		,_last(SIZE_MAX)
+		,_tick(0)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+HexFile::~HexFile()
+	{
+	close();
+	}
+
+/*****************************************************************************\
+|* Open a file. If it can't be written it's opened read-only instead
+\*****************************************************************************/
+bool HexFile::open(std::string filename, bool readOnly)
+	{
+	close();
+
+	int fd = readOnly ? -1 : ::open(filename.c_str(), O_RDWR);
+	if (fd < 0)
+		{
+		fd		 = ::open(filename.c_str(), O_RDONLY);
+		readOnly = true;
+		}
+	if (fd < 0)
+		return false;
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0)
+		{
+		::close(fd);
+		return false;
+		}
+
+	_filename	= filename;
+	_fd			= fd;
+	_size		= sb.st_size;
+	_readOnly	= readOnly;
+	return true;
+	}
+
+/*****************************************************************************\
+|* Close the file, and forget any changes
+\*****************************************************************************/
+void HexFile::close(void)
+	{
+	for (Block& block : _blocks)
+		_release(block);
+	BlockList(_blocks.get_allocator()).swap(_blocks);
+	_dirtyBlocks = 0;
+	_last		 = SIZE_MAX;
+
+	if (_fd >= 0)
+		::close(_fd);
+	_fd			= -1;
+	_size		= 0;
+	_readOnly	= true;
+	_filename	= "";
+	}
+
+/*****************************************************************************\
+|* Change where blocks come from
+\*****************************************************************************/
+void HexFile::setAllocator(Allocator *allocator)
+	{
+	if (_fd >= 0)
+		return;
+
+	_allocator	= allocator;
+	_blocks		= BlockList(StlAllocator<Block>(allocator));
+	}
+
+/*****************************************************************************\
+|* Get a byte
+\*****************************************************************************/
+int HexFile::get(off_t at)
+	{
+	if ((at < 0) || (at >= _size))
+		return -1;
+
+	Block *block = _block(at / BLOCK_BYTES);
+	return (block == nullptr) ? -1 : block->data[at % BLOCK_BYTES];
+	}
+
+/*****************************************************************************\
+|* Change a byte. A block that's changed back to what it was is clean again
+\*****************************************************************************/
+bool HexFile::set(off_t at, uint8_t value)
+	{
+	if (_readOnly || (at < 0) || (at >= _size))
+		return false;
+
+	off_t number = at / BLOCK_BYTES;
+	Block *block = _block(number);
+	if (block == nullptr)
+		return false;
+
+	size_t i = at % BLOCK_BYTES;
+	if (block->data[i] == value)
+		return true;
+
+	if (block->original == nullptr)
+		{
+		// Making room can move the blocks about, but won't take this one
+		// (it's the most recently used)
+		uint8_t *original = (uint8_t *) _allocator->allocate(BLOCK_BYTES);
+		while ((original == nullptr) && (_blocks.size() > 1) && _evict())
+			original = (uint8_t *) _allocator->allocate(BLOCK_BYTES);
+		block = _block(number);
+		if ((original == nullptr) || (block == nullptr))
+			{
+			if (original != nullptr)
+				_allocator->release(original, BLOCK_BYTES);
+			return false;
+			}
+
+		memcpy(original, block->data, block->length);
+		block->original = original;
+		_dirtyBlocks ++;
+		}
+
+	block->data[i] = value;
+	if (memcmp(block->data, block->original, block->length) == 0)
+		{
+		_allocator->release(block->original, BLOCK_BYTES);
+		block->original = nullptr;
+		_dirtyBlocks --;
+		}
+	return true;
+	}
+
+/*****************************************************************************\
+|* Has a byte changed. A block we don't have can't have
+\*****************************************************************************/
+bool HexFile::changed(off_t at)
+	{
+	if ((at < 0) || (at >= _size))
+		return false;
+
+	off_t number = at / BLOCK_BYTES;
+	auto block = std::lower_bound(_blocks.begin(), _blocks.end(), number,
+		[](const Block& b, off_t number) { return b.number < number; });
+	if ((block == _blocks.end()) || (block->number != number)
+	 || (block->original == nullptr))
+		return false;
+
+	size_t i = at % BLOCK_BYTES;
+	return block->data[i] != block->original[i];
+	}
+
+/*****************************************************************************\
+|* Write the changed blocks back, in the order they are in the file
+\*****************************************************************************/
+off_t HexFile::save(void)
+	{
+	off_t written = 0;
+	for (Block& block : _blocks)
+		{
+		if (block.original == nullptr)
+			continue;
+
+		ssize_t put = pwrite(_fd,
+							 block.data,
+							 block.length,
+							 block.number * BLOCK_BYTES);
+		if (put != (ssize_t) block.length)
+			{
+			if (put >= 0)
+				errno = EIO;
+			return -1;
+			}
+
+		written += put;
+		_allocator->release(block.original, BLOCK_BYTES);
+		block.original = nullptr;
+		_dirtyBlocks --;
+		}
+
+	if ((written > 0) && (fsync(_fd) != 0))
+		return -1;
+	return written;
+	}
+
+/*****************************************************************************\
+|* Bytes the blocks take
+\*****************************************************************************/
+size_t HexFile::footprint(void)
+	{
+	return (_blocks.size() + (size_t) _dirtyBlocks) * BLOCK_BYTES
+		 + _blocks.capacity() * sizeof(Block);
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* Find a block, reading it in if we don't have it. Returns nullptr if it's
+|* past the end, can't be read, or there's no memory for it
+\*****************************************************************************/
+HexFile::Block * HexFile::_block(off_t number)
+	{
+	_tick ++;
+	if ((_last < _blocks.size()) && (_blocks[_last].number == number))
+		{
+		_blocks[_last].used = _tick;
+		return &_blocks[_last];
+		}
+
+	auto lower = [&](void)
+		{
+		return std::lower_bound(_blocks.begin(), _blocks.end(), number,
+			[](const Block& b, off_t number) { return b.number < number; });
+		};
+	auto found = lower();
+	if ((found != _blocks.end()) && (found->number == number))
+		{
+		_last		= found - _blocks.begin();
+		found->used	= _tick;
+		return &*found;
+		}
+
+	off_t start = number * BLOCK_BYTES;
+	if ((start < 0) || (start >= _size))
+		return nullptr;
+
+	if ((int) _blocks.size() - _dirtyBlocks >= MAX_CLEAN_BLOCKS)
+		_evict();
+	uint8_t *data = (uint8_t *) _allocator->allocate(BLOCK_BYTES);
+	while ((data == nullptr) && _evict())
+		data = (uint8_t *) _allocator->allocate(BLOCK_BYTES);
+	if (data == nullptr)
+		return nullptr;
+
+	size_t want	= (size_t) MIN((off_t) BLOCK_BYTES, _size - start);
+	ssize_t got	= pread(_fd, data, want, start);
+	if (got != (ssize_t) want)
+		{
+		_allocator->release(data, BLOCK_BYTES);
+		return nullptr;
+		}
+
+	found = _blocks.insert(lower(), {.number	= number,
+									 .data		= data,
+									 .original	= nullptr,
+									 .length	= (uint32_t) want,
+									 .used		= _tick});
+	_last = found - _blocks.begin();
+	return &*found;
+	}
+
+/*****************************************************************************\
+|* Drop the least recently used block that hasn't changed. Returns false
+|* if there isn't one
+\*****************************************************************************/
+bool HexFile::_evict(void)
+	{
+	auto oldest = _blocks.end();
+	for (auto block = _blocks.begin(); block != _blocks.end(); block++)
+		if ((block->original == nullptr)
+		 && ((oldest == _blocks.end()) || (block->used < oldest->used)))
+			oldest = block;
+	if (oldest == _blocks.end())
+		return false;
+
+	_release(*oldest);
+	_blocks.erase(oldest);
+	_last = SIZE_MAX;
+	return true;
+	}
+
+/*****************************************************************************\
+|* Give back a block's memory
+\*****************************************************************************/
+void HexFile::_release(Block& block)
+	{
+	if (block.data != nullptr)
+		_allocator->release(block.data, BLOCK_BYTES);
+	if (block.original != nullptr)
+		_allocator->release(block.original, BLOCK_BYTES);
+	block.data		= nullptr;
+	block.original	= nullptr;
+	}
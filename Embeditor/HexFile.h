@@ -0,0 +1,131 @@
+//
+//  HexFile.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef HexFile_h
+#define HexFile_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "properties.h"
+#include "macros.h"
+#include "Allocator.h"
+
+/*****************************************************************************\
+|* The bytes of a file, for editing in hex. Files like this are firmware
+|* images and the like, often far bigger than the memory budget, and are
+|* patched rather than rewritten: a byte can be changed, but nothing can be
+|* inserted or deleted, so every byte stays where it is on disk.
+|*
+|* So the file is read a block at a time with pread(), and only the blocks
+|* that have been looked at are kept. Those that haven't been changed are a
+|* cache, and the least recently used go once there are MAX_CLEAN_BLOCKS of
+|* them (or the allocator runs short). A changed block keeps a copy of what
+|* it was, so we know which bytes have changed and whether it still has
+|* any, and stays until it's saved. Saving writes just the changed blocks
+|* back with pwrite().
+|*
+|* Blocks are kept sorted by number and found by binary search, after a
+|* check of the one found last, which is nearly always the one wanted
+\*****************************************************************************/
+class HexFile
+	{
+    NON_COPYABLE_NOR_MOVEABLE(HexFile)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			BLOCK_BYTES			= 4096,		// Read and written at once
+			MAX_CLEAN_BLOCKS	= 256		// Unchanged blocks kept, 1MB
+			};
+
+    protected:
+		typedef struct Block
+			{
+			off_t					number;	// Offset / BLOCK_BYTES
+			uint8_t *				data;	// What's there now
+			uint8_t *				original;	// ... and on disk, if changed
+			uint32_t				length;	// Bytes of the file in it
+			uint64_t				used;	// When last looked at
+			} Block;
+
+		typedef std::vector<Block, StlAllocator<Block>> BlockList;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(std::string, filename);			// File we're editing
+    GET(int, fd);						// ... and its descriptor
+    GET(off_t, size);					// Size of the file
+    GET(bool, readOnly);				// Couldn't (or mustn't) write it
+    GET(int, dirtyBlocks);				// Blocks with unsaved changes
+
+    protected:
+		Allocator *				_allocator;		// Where blocks come from
+		BlockList				_blocks;		// Blocks kept, by number
+		size_t					_last;			// Index of the last one found
+		uint64_t				_tick;			// Counts lookups, for LRU
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit HexFile();
+        ~HexFile();
+
+        /*********************************************************************\
+        |* Open a file, for writing unless 'readOnly' (or we can't)
+        \*********************************************************************/
+		bool open(std::string filename, bool readOnly);
+		void close(void);
+
+        /*********************************************************************\
+        |* Where the blocks come from. Only while nothing is open
+        \*********************************************************************/
+		void setAllocator(Allocator *allocator);
+
+        /*********************************************************************\
+        |* The byte at 'at', or -1 if it's past the end or can't be read
+        \*********************************************************************/
+		int get(off_t at);
+
+        /*********************************************************************\
+        |* Change a byte. Returns false if the file's read-only, 'at' is past
+        |* the end, or there's no memory for the block
+        \*********************************************************************/
+		bool set(off_t at, uint8_t value);
+
+        /*********************************************************************\
+        |* Is the byte at 'at' different from what's on disk
+        \*********************************************************************/
+		bool changed(off_t at);
+
+        /*********************************************************************\
+        |* Write the changed blocks back. Returns the bytes written, or -1 if
+        |* a write failed (with errno set), leaving what wasn't written still
+        |* changed
+        \*********************************************************************/
+		off_t save(void);
+
+        /*********************************************************************\
+        |* Bytes the blocks take
+        \*********************************************************************/
+		size_t footprint(void);
+
+    private:
+		Block * _block(off_t number);
+		bool _evict(void);
+		void _release(Block& block);
+	};
+
+#endif /* HexFile_h */
@@ -0,0 +1,264 @@
+//
+//  HighlightCache.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef HighlightCache_h
+#define HighlightCache_h
+
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "properties.h"
+#include "macros.h"
+#include "Allocator.h"
+
+/*****************************************************************************\
+|* What highlighting a row came to, keyed by the row's text and the state
+|* it was highlighted from. The highlighting of a row depends on nothing
+|* else, so a row that's the same as one seen before (a repeated log line,
+|* boilerplate, or an edit that's been undone) needn't be highlighted again.
+|*
+|* It's a fixed size and two-way set-associative, so a lookup is a hash of
+|* the text and at most two compares, and a new entry replaces the one in
+|* its set that was used least recently. The text isn't kept, only a 64-bit
+|* hash of it and its length. Rows too short to be worth hashing, and
+|* highlighting with more than MAX_SPANS runs, aren't kept at all (the
+|* latter only for its state).
+|*
+|* Nothing is kept (or allocated) until reserve(), and then only from the
+|* allocator it's given, so the owner decides when there's room for it. A
+|* cache is only for one thread, but its counts can be read from any thread
+\*****************************************************************************/
+template <typename Span>
+class HighlightCache
+	{
+    NON_COPYABLE_NOR_MOVEABLE(HighlightCache)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			MIN_LENGTH		= 16,			// Shorter rows aren't cached
+			MAX_SPANS		= 512,			// Nor spans past this many
+			WAYS			= 2				// Entries a row might be in
+			};
+
+		typedef std::vector<Span, StlAllocator<Span>> SpanList;
+
+    protected:
+		typedef struct Entry
+			{
+			uint64_t				hash;	// Of the row's text
+			uint32_t				length;	// ... and its length
+			uint32_t				in;		// State it started in
+			uint32_t				out;	// State it left
+			bool					full;	// Spans are here too
+			SpanList				spans;	// ... if so
+			} Entry;
+
+		typedef std::vector<Entry, StlAllocator<Entry>> EntryList;
+
+		enum
+			{
+			EMPTY			= UINT32_MAX	// An 'in' no row starts with
+			};
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(Allocator *, allocator);		// Where the entries come from
+    GET(int, size);						// Entries, a power of 2 (>= WAYS)
+
+    protected:
+		EntryList					_entries;	// Empty until reserve()
+		std::atomic<uint64_t>		_hits;		// Lookups we could answer
+		std::atomic<uint64_t>		_misses;	// ... and couldn't
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit HighlightCache(int size, Allocator *allocator = Allocator::heap())
+			:_allocator(allocator)
+			,_size(size)
+			,_entries(StlAllocator<Entry>(allocator))
+			,_hits(0)
+			,_misses(0)
+			{}
+
+        /*********************************************************************\
+        |* Draw on a different allocator. Everything cached is forgotten
+        \*********************************************************************/
+		void setAllocator(Allocator *allocator)
+			{
+			_allocator	= allocator;
+			_entries	= EntryList(StlAllocator<Entry>(allocator));
+			}
+
+        /*********************************************************************\
+        |* Make the table now, so a store won't allocate unless it keeps spans
+        \*********************************************************************/
+		void reserve(void)
+			{
+			if (_entries.size() > 0)
+				return;
+			_entries.reserve(_size);
+			for (int i = 0; i < _size; i++)
+				_entries.push_back({.hash	= 0,
+									.length	= 0,
+									.in		= EMPTY,
+									.out	= 0,
+									.full	= false,
+									.spans	= SpanList(StlAllocator<Span>(_allocator))});
+			}
+
+        /*********************************************************************\
+        |* Forget everything, and give the memory back
+        \*********************************************************************/
+		void clear(void)
+			{
+			EntryList(_entries.get_allocator()).swap(_entries);
+			}
+
+        /*********************************************************************\
+        |* Is a row worth looking up, and its key if so. The hash takes 8
+        |* bytes a step (the last step overlapping the one before, which is
+        |* why a row has to be MIN_LENGTH), so it costs a small part of
+        |* highlighting the row
+        \*********************************************************************/
+		static inline bool worthCaching(std::string_view text)
+			{ return text.length() >= MIN_LENGTH; }
+
+		static inline uint64_t hash(std::string_view text)
+			{
+			const uint64_t k = 0x9e3779b97f4a7c15ull;
+			const char *p	 = text.data();
+			const char *last = p + text.length() - 8;
+			uint64_t h		 = text.length() * k;
+			uint64_t word;
+			for (; p < last; p += 8)
+				{
+				memcpy(&word, p, 8);
+				h  = (h ^ word) * k;
+				h ^= h >> 32;
+				}
+			memcpy(&word, last, 8);
+			h = (h ^ word) * k;
+			return h ^ (h >> 29);
+			}
+
+        /*********************************************************************\
+        |* Look a row up. Without a span list only the state it leaves is
+        |* wanted, so an entry without spans will do
+        \*********************************************************************/
+		bool find(uint64_t hash, size_t length, int in, SpanList *spans, int *out)
+			{
+			Entry *set = _set(hash, in);
+			Entry *entry = _match(set, hash, length, in);
+			bool found	 = (entry != nullptr)
+						&& (entry->full || (spans == nullptr));
+			_count(found ? _hits : _misses);
+			if (!found)
+				return false;
+
+			// Most recently used first
+			if (entry != set)
+				std::swap(*entry, *set);
+			if (spans != nullptr)
+				spans->assign(set->spans.begin(), set->spans.end());
+			*out = (int) set->out;
+			return true;
+			}
+
+        /*********************************************************************\
+        |* Remember how a row came out, if there's a table to keep it in
+        \*********************************************************************/
+		void store(uint64_t hash,
+				   size_t length,
+				   int in,
+				   const SpanList *spans,
+				   int out)
+			{
+			Entry *set = _set(hash, in);
+			if (set == nullptr)
+				return;
+			
+			// The row's own entry if it has one (without spans, say), or
+			// the least recently used. Either way it moves to the front
+			Entry *entry = _match(set, hash, length, in);
+			if (entry == nullptr)
+				entry = set + WAYS - 1;
+			for (; entry > set; entry--)
+				std::swap(*entry, *(entry - 1));
+			
+			entry->hash		= hash;
+			entry->length	= (uint32_t) length;
+			entry->in		= (uint32_t) in;
+			entry->out		= (uint32_t) out;
+			entry->full		= (spans != nullptr) && (spans->size() <= MAX_SPANS);
+			if (entry->full)
+				entry->spans.assign(spans->begin(), spans->end());
+			else
+				entry->spans.clear();
+			}
+
+        /*********************************************************************\
+        |* How it's doing
+        \*********************************************************************/
+		inline uint64_t hits(void) const
+			{ return _hits.load(std::memory_order_relaxed); }
+		inline uint64_t misses(void) const
+			{ return _misses.load(std::memory_order_relaxed); }
+
+    private:
+        /*********************************************************************\
+        |* The set a row goes in. The state is mixed in, so the same row
+        |* highlighted from two states goes in two places
+        \*********************************************************************/
+		inline Entry * _set(uint64_t hash, int in)
+			{
+			if (_entries.size() == 0)
+				return nullptr;
+			uint64_t at = hash ^ ((uint64_t) in * 0xff51afd7ed558ccdull);
+			return &_entries[(at & (_size / WAYS - 1)) * WAYS];
+			}
+
+        /*********************************************************************\
+        |* The row's entry in its set, if it's there
+        \*********************************************************************/
+		static inline Entry * _match(Entry *set,
+									 uint64_t hash,
+									 size_t length,
+									 int in)
+			{
+			if (set == nullptr)
+				return nullptr;
+			for (Entry *entry = set; entry < set + WAYS; entry++)
+				if ((entry->hash == hash)
+				 && (entry->length == length)
+				 && (entry->in == (uint32_t) in))
+					return entry;
+			return nullptr;
+			}
+
+        /*********************************************************************\
+        |* Only the owning thread counts, so there's no need for an atomic
+        |* add, just a store others can read
+        \*********************************************************************/
+		static inline void _count(std::atomic<uint64_t>& counter)
+			{
+			counter.store(counter.load(std::memory_order_relaxed) + 1,
+						  std::memory_order_relaxed);
+			}
+	};
+
+#endif /* HighlightCache_h */
@@ -0,0 +1,284 @@
+//
+//  Journal.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Journal.h"
+
+#define JOURNAL_MAGIC		"EDJNL001"
+
+/*****************************************************************************\
+|* On-disk layout: this header, then a JournalRecord (and its text) per edit
+\*****************************************************************************/
+typedef struct JournalHeader
+	{
+	char		magic[8];
+	int64_t		size;
+	int64_t		mtime;
+	} JournalHeader;
+
+typedef struct JournalRecord
+	{
+	uint8_t		op;
+	uint8_t		unused[3];
+	int32_t		row;
+	int32_t		col;
+	uint32_t	len;
+	} JournalRecord;
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+Journal::Journal()
+		:_filename("")
+		,_path("")
+		,_fd(-1)
+		,_replaying(false)
+		,_unsynced(false)
+		,_lastSync(0)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+Journal::~Journal()
+	{
+	close();
+	}
+
+/*****************************************************************************\
+|* Set up to journal a file
+\*****************************************************************************/
+void Journal::begin(std::string filename)
+	{
+	close();
+	_filename = filename;
+
+	std::size_t slash = filename.rfind('/');
+	if (slash == std::string::npos)
+		_path = "." + filename + ".ejl";
+	else
+		_path = filename.substr(0, slash + 1)
+			  + "." + filename.substr(slash + 1) + ".ejl";
+	}
+
+/*****************************************************************************\
+|* Write out what we have and close the journal, leaving it on disk
+\*****************************************************************************/
+void Journal::close(void)
+	{
+	flush();
+	if (_fd >= 0)
+		{
+		fsync(_fd);
+		::close(_fd);
+		}
+	_fd			= -1;
+	_unsynced	= false;
+	}
+
+/*****************************************************************************\
+|* Is there a journal on disk
+\*****************************************************************************/
+bool Journal::exists(void)
+	{
+	return (_path.length() > 0) && (access(_path.c_str(), F_OK) == 0);
+	}
+
+/*****************************************************************************\
+|* Queue a record
+\*****************************************************************************/
+void Journal::log(int op, int row, int col, std::string_view text)
+	{
+	if (_replaying || (_path.length() == 0))
+		return;
+
+	JournalRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.op	= (uint8_t) op;
+	rec.row	= row;
+	rec.col	= col;
+	rec.len	= (uint32_t) text.length();
+
+	_pending.append((const char *)&rec, sizeof(rec));
+	_pending.append(text);
+	}
+
+/*****************************************************************************\
+|* End a batch. The cursor position is kept so undo works the same way
+|* after a recovery
+\*****************************************************************************/
+void Journal::endBatch(int cx, int cy)
+	{
+	if (_pending.length() == 0)
+		return;
+
+	log(OP_BATCH, cy, cx, "");
+	flush();
+	}
+
+/*****************************************************************************\
+|* Hand whatever's queued to the kernel. That's enough to survive the editor
+|* crashing; surviving the machine crashing is up to sync()
+\*****************************************************************************/
+void Journal::flush(void)
+	{
+	if (_pending.length() == 0)
+		return;
+
+	if ((_fd < 0) && !_create())
+		{
+		_pending.clear();
+		return;
+		}
+
+	const char *p	= _pending.data();
+	size_t left		= _pending.length();
+	while (left > 0)
+		{
+		ssize_t done = write(_fd, p, left);
+		if (done <= 0)
+			break;
+		p	 += done;
+		left -= done;
+		}
+
+	_pending.clear();
+	_unsynced = true;
+	}
+
+/*****************************************************************************\
+|* fsync() the journal, if it's been long enough since the last time
+\*****************************************************************************/
+void Journal::sync(void)
+	{
+	if (!_unsynced || (_fd < 0))
+		return;
+
+	time_t now = time(nullptr);
+	if (now - _lastSync < SYNC_SECONDS)
+		return;
+
+	fsync(_fd);
+	_lastSync = now;
+	_unsynced = false;
+	}
+
+/*****************************************************************************\
+|* Throw the journal away
+\*****************************************************************************/
+void Journal::remove(void)
+	{
+	_pending.clear();
+	if (_fd >= 0)
+		::close(_fd);
+	_fd			= -1;
+	_unsynced	= false;
+
+	if (_path.length() > 0)
+		unlink(_path.c_str());
+	}
+
+/*****************************************************************************\
+|* Replay the journal, stopping at the first record that's incomplete (the
+|* tail of a write we crashed during) or that the callback rejects. The
+|* journal is cut back to what was replayed and carries on from there
+\*****************************************************************************/
+int Journal::replay(ReplayCallback cb)
+	{
+	close();
+
+	int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	struct stat sb;
+	struct stat file;
+	JournalHeader hdr;
+	std::string data;
+
+	bool ok = (fstat(fd, &sb) == 0)
+		   && (stat(_filename.c_str(), &file) == 0)
+		   && (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr))
+		   && (memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic)) == 0)
+		   && (hdr.size == file.st_size)
+		   && (hdr.mtime == file.st_mtime);
+
+	if (ok)
+		{
+		data.resize(sb.st_size - sizeof(hdr));
+		ok = (read(fd, data.data(), data.length()) == (ssize_t)data.length());
+		}
+	::close(fd);
+
+	if (!ok)
+		{
+		std::string old = _path + ".old";
+		rename(_path.c_str(), old.c_str());
+		return -1;
+		}
+
+	int replayed	= 0;
+	size_t pos		= 0;
+	_replaying		= true;
+	while (pos + sizeof(JournalRecord) <= data.length())
+		{
+		JournalRecord rec;
+		memcpy(&rec, data.data() + pos, sizeof(rec));
+		if (pos + sizeof(rec) + rec.len > data.length())
+			break;
+
+		std::string text(data, pos + sizeof(rec), rec.len);
+		if (!cb(rec.op, rec.row, rec.col, text))
+			break;
+
+		pos += sizeof(rec) + rec.len;
+		replayed ++;
+		}
+	_replaying = false;
+
+	// Carry on appending after the last good record
+	_fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (_fd >= 0)
+		ftruncate(_fd, sizeof(hdr) + pos);
+	return replayed;
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* Start a new journal against the file as it is on disk
+\*****************************************************************************/
+bool Journal::_create(void)
+	{
+	struct stat sb;
+	if ((_path.length() == 0) || (stat(_filename.c_str(), &sb) != 0))
+		return false;
+
+	_fd = ::open(_path.c_str(),
+				 O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+				 0600);
+	if (_fd < 0)
+		return false;
+
+	JournalHeader hdr;
+	memcpy(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+	hdr.size	= sb.st_size;
+	hdr.mtime	= sb.st_mtime;
+	if (write(_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		{
+		remove();
+		return false;
+		}
+	_lastSync = time(nullptr);
+	return true;
+	}
@@ -0,0 +1,109 @@
+//
+//  Journal.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Journal_h
+#define Journal_h
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+#include "properties.h"
+#include "macros.h"
+#include "FunctionRef.h"
+
+/*****************************************************************************\
+|* An append-only journal of the edits made to a file since it was last
+|* saved, so they can be recovered if we (or the machine) go down.
+|*
+|* Each primitive edit is a small fixed-size binary record plus its text,
+|* collected in memory and written with one write() at the end of every
+|* batch (ie: keypress). The journal is fsync()d from the idle loop at most
+|* every SYNC_SECONDS, so a crash of the editor loses nothing and a crash of
+|* the machine loses at most that much typing. Nothing is ever rewritten.
+|*
+|* The journal lives next to the file as .<name>.ejl, and starts with the
+|* size and mtime of the file it applies to, so it's only ever replayed
+|* over the version of the file it was made against.
+\*****************************************************************************/
+class Journal
+	{
+    NON_COPYABLE_NOR_MOVEABLE(Journal)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			SYNC_SECONDS	= 2,			// Longest we'll leave it unsynced
+			OP_BATCH		= 0xFF			// Record op marking a batch end
+			};
+
+		// Called for each record replayed. Return false to stop
+		typedef FunctionRef<bool(int op,
+								 int row,
+								 int col,
+								 const std::string& text)> ReplayCallback;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(std::string, filename);			// File being journalled
+    GET(std::string, path);				// The journal itself
+    GET(int, fd);						// ... open for append, if it is
+
+    protected:
+		std::string		_pending;			// Records not yet written
+		bool			_replaying;			// Don't log what's replayed
+		bool			_unsynced;			// Written but not fsync()d
+		time_t			_lastSync;			// When we last fsync()d
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit Journal();
+        ~Journal();
+
+        /*********************************************************************\
+        |* Journal edits to a file. Nothing is created until there's an edit
+        \*********************************************************************/
+        void begin(std::string filename);
+		void close(void);
+		bool exists(void);
+
+        /*********************************************************************\
+        |* Record an edit, and mark the end of a batch of them
+        \*********************************************************************/
+		void log(int op, int row, int col, std::string_view text);
+		void endBatch(int cx, int cy);
+
+        /*********************************************************************\
+        |* Write out, and fsync() if it's been a while
+        \*********************************************************************/
+		void flush(void);
+		void sync(void);
+
+        /*********************************************************************\
+        |* The file has been saved: the journal isn't needed any more
+        \*********************************************************************/
+		void remove(void);
+
+        /*********************************************************************\
+        |* Replay the journal. Returns the number of records replayed, or -1
+        |* if the journal was made against another version of the file (it's
+        |* moved aside to <journal>.old in that case)
+        \*********************************************************************/
+		int replay(ReplayCallback cb);
+
+    private:
+		bool _create(void);
+	};
+
+#endif /* Journal_h */
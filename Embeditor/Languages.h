@@ -0,0 +1,220 @@
+//
+//  Languages.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Languages_h
+#define Languages_h
+
+#include "Syntax.h"
+
+/*****************************************************************************\
+|* The languages we know how to highlight. Each is constant data, checked
+|* when it's compiled, and gets a highlighter of its own with its tables
+|* built in. To add one, define it like those below and add it to
+|* Editor::_languages. The first that matches a file is used. Languages
+|* that needn't be built in can be loaded at runtime instead (see
+|* SyntaxCache.h)
+\*****************************************************************************/
+namespace Languages
+	{
+	/*************************************************************************\
+	|* C
+	\*************************************************************************/
+	inline constexpr std::string_view C_EXTENSIONS[] =
+		{
+		".c", ".h"
+		};
+
+	inline constexpr auto C_KEYWORDS = Syntax::keywordTable(
+		{
+		"switch", "if", "while", "for", "break", "continue", "return", "else",
+		"struct", "union", "typedef", "static", "enum", "class", "case",
+		"int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+		"void|"
+		});
+
+	inline constexpr Syntax C = Syntax::make("c",
+											 C_EXTENSIONS,
+											 C_KEYWORDS,
+											 "//", "/*", "*/",
+											 Syntax::HIGHLIGHT_NUMBERS
+										   | Syntax::HIGHLIGHT_STRINGS);
+	static_assert(C.valid(), "Bad C syntax definition");
+
+	/*************************************************************************\
+	|* C++, with raw strings
+	\*************************************************************************/
+	inline constexpr std::string_view CPP_EXTENSIONS[] =
+		{
+		".cpp", ".cc", ".cxx", ".hpp", ".hh", ".hxx"
+		};
+
+	inline constexpr auto CPP_KEYWORDS = Syntax::keywordTable(
+		{
+		"switch", "if", "while", "for", "do", "break", "continue", "return",
+		"else", "goto", "struct", "union", "typedef", "static", "enum",
+		"class", "case", "default", "namespace", "template", "typename",
+		"public", "private", "protected", "virtual", "override", "final",
+		"explicit", "inline", "friend", "operator", "using", "new", "delete",
+		"try", "catch", "throw", "noexcept", "const", "constexpr", "consteval",
+		"volatile", "mutable", "extern", "static_assert", "sizeof", "this",
+		"static_cast", "dynamic_cast", "const_cast", "reinterpret_cast",
+		"int|", "long|", "short|", "double|", "float|", "char|", "unsigned|",
+		"signed|", "void|", "bool|", "auto|", "size_t|", "int8_t|",
+		"int16_t|", "int32_t|", "int64_t|", "uint8_t|", "uint16_t|",
+		"uint32_t|", "uint64_t|", "true=", "false=", "nullptr=", "NULL="
+		});
+
+	inline constexpr Syntax CPP = Syntax::make("c++",
+											   CPP_EXTENSIONS,
+											   CPP_KEYWORDS,
+											   "//", "/*", "*/",
+											   Syntax::HIGHLIGHT_NUMBERS
+											 | Syntax::HIGHLIGHT_STRINGS,
+											   "",
+											   "",
+											   "R\"");
+	static_assert(CPP.valid(), "Bad C++ syntax definition");
+
+	/*************************************************************************\
+	|* Python. Docstrings are shown as comments, and @decorators as variables
+	\*************************************************************************/
+	inline constexpr std::string_view PYTHON_EXTENSIONS[] =
+		{
+		".py", ".pyw"
+		};
+
+	inline constexpr auto PYTHON_KEYWORDS = Syntax::keywordTable(
+		{
+		"and", "as", "assert", "async", "await", "break", "class", "continue",
+		"def", "del", "elif", "else", "except", "finally", "for", "from",
+		"global", "if", "import", "in", "is", "lambda", "nonlocal", "not",
+		"or", "pass", "raise", "return", "try", "while", "with", "yield",
+		"int|", "float|", "str|", "bytes|", "bool|", "list|", "dict|",
+		"set|", "tuple|", "object|", "self|", "cls|", "len|", "print|",
+		"range|", "True=", "False=", "None="
+		});
+
+	inline constexpr Syntax PYTHON = Syntax::make("python",
+												  PYTHON_EXTENSIONS,
+												  PYTHON_KEYWORDS,
+												  "#", "\"\"\"", "\"\"\"",
+												  Syntax::HIGHLIGHT_NUMBERS
+												| Syntax::HIGHLIGHT_STRINGS,
+												  "@");
+	static_assert(PYTHON.valid(), "Bad Python syntax definition");
+
+	/*************************************************************************\
+	|* Shell scripts. $variables are picked out, and the usual punctuation
+	|* ends a word. Strings can go on over rows and have $(commands) in
+	|* them, which can have strings (and heredocs) of their own
+	\*************************************************************************/
+	inline constexpr std::string_view SHELL_EXTENSIONS[] =
+		{
+		".sh", ".bash", ".zsh", ".bashrc", ".bash_profile", ".profile",
+		".zshrc"
+		};
+
+	inline constexpr auto SHELL_KEYWORDS = Syntax::keywordTable(
+		{
+		"if", "then", "else", "elif", "fi", "for", "while", "until", "do",
+		"done", "case", "esac", "in", "function", "return", "break",
+		"continue", "select", "local", "export", "readonly", "declare",
+		"unset", "shift", "exit", "echo|", "printf|", "cd|", "read|",
+		"test|", "source|", "eval|", "exec|", "set|", "trap|", "alias|",
+		"pwd|", "kill|", "wait|", "true=", "false="
+		});
+
+	inline constexpr Syntax SHELL = Syntax::make("shell",
+												 SHELL_EXTENSIONS,
+												 SHELL_KEYWORDS,
+												 "#", "", "",
+												 Syntax::HIGHLIGHT_NUMBERS
+											   | Syntax::HIGHLIGHT_STRINGS
+											   | Syntax::HIGHLIGHT_HEREDOCS
+											   | Syntax::HIGHLIGHT_LONG_STRINGS,
+												 "$",
+												 "|&!",
+												 "",
+												 "$(");
+	static_assert(SHELL.valid(), "Bad shell syntax definition");
+
+	/*************************************************************************\
+	|* JSON, which is mostly strings and numbers
+	\*************************************************************************/
+	inline constexpr std::string_view JSON_EXTENSIONS[] =
+		{
+		".json"
+		};
+
+	inline constexpr auto JSON_KEYWORDS = Syntax::keywordTable(
+		{
+		"true=", "false=", "null="
+		});
+
+	inline constexpr Syntax JSON = Syntax::make("json",
+												JSON_EXTENSIONS,
+												JSON_KEYWORDS,
+												"", "", "",
+												Syntax::HIGHLIGHT_NUMBERS
+											  | Syntax::HIGHLIGHT_STRINGS,
+												"",
+												"{}:");
+	static_assert(JSON.valid(), "Bad JSON syntax definition");
+
+	/*************************************************************************\
+	|* YAML. &anchors and *aliases are shown as variables
+	\*************************************************************************/
+	inline constexpr std::string_view YAML_EXTENSIONS[] =
+		{
+		".yaml", ".yml"
+		};
+
+	inline constexpr auto YAML_KEYWORDS = Syntax::keywordTable(
+		{
+		"true=", "false=", "null=", "yes=", "no=", "on=", "off=", "True=",
+		"False=", "Null=", "Yes=", "No=", "On=", "Off="
+		});
+
+	inline constexpr Syntax YAML = Syntax::make("yaml",
+												YAML_EXTENSIONS,
+												YAML_KEYWORDS,
+												"#", "", "",
+												Syntax::HIGHLIGHT_NUMBERS
+											  | Syntax::HIGHLIGHT_STRINGS,
+												"&*",
+												"{}:");
+	static_assert(YAML.valid(), "Bad YAML syntax definition");
+
+	/*************************************************************************\
+	|* Our log files: "2026-10-16 12:00:01.234 [ERROR] ...". There are no
+	|* strings, since messages are full of apostrophes, but the numbers and
+	|* levels stand out
+	\*************************************************************************/
+	inline constexpr std::string_view LOG_EXTENSIONS[] =
+		{
+		".log"
+		};
+
+	inline constexpr auto LOG_KEYWORDS = Syntax::keywordTable(
+		{
+		"FATAL!", "fatal!", "Fatal!", "CRITICAL!", "critical!", "Critical!",
+		"ERROR!", "error!", "Error!", "WARNING?", "warning?", "Warning?",
+		"WARN?", "warn?", "Warn?", "INFO", "info", "Info", "NOTICE", "notice",
+		"Notice", "DEBUG|", "debug|", "Debug|", "TRACE|", "trace|", "Trace|"
+		});
+
+	inline constexpr Syntax LOG = Syntax::make("log",
+											   LOG_EXTENSIONS,
+											   LOG_KEYWORDS,
+											   "", "", "",
+											   Syntax::HIGHLIGHT_NUMBERS,
+											   "",
+											   ":{}|");
+	static_assert(LOG.valid(), "Bad log syntax definition");
+	}
+
+#endif /* Languages_h */
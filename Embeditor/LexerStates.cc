@@ -0,0 +1,255 @@
+//
+//  LexerStates.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include "LexerStates.h"
+
+#define MIN_INDEX			1024		// Smallest hash table we'll have
+
+/*****************************************************************************\
+|* Constructor. State 0 is the empty stack, so there's never a node for it
+\*****************************************************************************/
+LexerStates::LexerStates(Allocator *allocator)
+			:_allocator(allocator)
+			,_count(1)
+			,_index(nullptr)
+			,_indexSize(0)
+	{
+	for (std::atomic<Node *>& chunk : _chunks)
+		chunk = nullptr;
+	}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+LexerStates::~LexerStates()
+	{
+	clear();
+	}
+
+/*****************************************************************************\
+|* Use a different allocator, giving everything back to the old one first
+\*****************************************************************************/
+void LexerStates::setAllocator(Allocator *allocator)
+	{
+	clear();
+	_allocator = allocator;
+	}
+
+/*****************************************************************************\
+|* Forget every state, and give back the memory
+\*****************************************************************************/
+void LexerStates::clear(void)
+	{
+	std::lock_guard<std::mutex> guard(_lock);
+	for (std::atomic<Node *>& chunk : _chunks)
+		{
+		_allocator->release(chunk.load(), CHUNK_STATES * sizeof(Node));
+		chunk = nullptr;
+		}
+	_count = 1;
+	_allocator->release(_index, _indexSize * sizeof(uint32_t));
+	_index		= nullptr;
+	_indexSize	= 0;
+	}
+
+/*****************************************************************************\
+|* Allocate the chunk the next state goes in, and the one after it once
+|* that's half used, so there's always half a chunk to spare. The hash table
+|* is made big enough to hold all of them at most half full
+\*****************************************************************************/
+bool LexerStates::reserve(void)
+	{
+	std::lock_guard<std::mutex> guard(_lock);
+	uint32_t count	= _count.load(std::memory_order_relaxed);
+	int chunks		= MIN((int)((count + CHUNK_STATES / 2) / CHUNK_STATES) + 1,
+						  (int) MAX_CHUNKS);
+	for (int c = 0; c < chunks; c++)
+		if (_chunks[c].load(std::memory_order_relaxed) == nullptr)
+			{
+			void *nodes = _allocator->allocate(CHUNK_STATES * sizeof(Node));
+			if (nodes == nullptr)
+				return false;
+			_chunks[c].store((Node *) nodes, std::memory_order_release);
+			}
+
+	size_t size = MIN_INDEX;
+	while (size < 2 * (size_t) chunks * CHUNK_STATES)
+		size <<= 1;
+	return (_indexSize >= size) || _rehash(size);
+	}
+
+/*****************************************************************************\
+|* Bytes we've taken from the allocator
+\*****************************************************************************/
+size_t LexerStates::footprint(void)
+	{
+	std::lock_guard<std::mutex> guard(_lock);
+	size_t bytes = _indexSize * sizeof(uint32_t);
+	for (std::atomic<Node *>& chunk : _chunks)
+		if (chunk.load(std::memory_order_relaxed) != nullptr)
+			bytes += CHUNK_STATES * sizeof(Node);
+	return bytes;
+	}
+
+/*****************************************************************************\
+|* Make a frame
+\*****************************************************************************/
+LexerStates::Frame LexerStates::frame(int kind, int arg, std::string_view closer)
+	{
+	Frame f;
+	memset(&f, 0, sizeof(f));
+	if (closer.length() > MAX_DELIMITER)
+		return f;
+
+	f.kind		= (uint8_t) kind;
+	f.arg		= (uint8_t) arg;
+	f.length	= (uint8_t) closer.length();
+	memcpy(f.closer, closer.data(), closer.length());
+	return f;
+	}
+
+/*****************************************************************************\
+|* Unpack a state, from the top frame down
+\*****************************************************************************/
+void LexerStates::unpack(uint32_t state, Stack& stack) const
+	{
+	stack.size	= 0;
+	stack.known	= 0;
+	if ((state == 0) || (state >= size()))
+		return;
+
+	const Node *node = &_node(state);
+	stack.size		 = (int) node->depth;
+	stack.known		 = stack.size;
+	for (int k = stack.size - 1; k >= 0; k--)
+		{
+		stack.frames[k]	= node->frame;
+		stack.ids[k]	= state;
+		state			= node->parent;
+		if (k > 0)
+			node = &_node(state);
+		}
+	}
+
+/*****************************************************************************\
+|* Find the state a stack is, adding it if it's new. The frames that are
+|* as they were unpacked are checked against their old states, without the
+|* lock. If we run out of states the top of the stack is lost, which only
+|* means some rows are highlighted wrongly
+\*****************************************************************************/
+uint32_t LexerStates::intern(Stack& stack)
+	{
+	uint32_t state = 0;
+	for (int k = 0; k < stack.size; k++)
+		{
+		if (k < stack.known)
+			{
+			const Node& node = _node(stack.ids[k]);
+			if ((node.parent == state) && (node.frame == stack.frames[k]))
+				{
+				state = stack.ids[k];
+				continue;
+				}
+			}
+
+		if (!_push(state, stack.frames[k], &state))
+			{
+			stack.size = k;
+			break;
+			}
+		stack.ids[k] = state;
+		}
+	stack.known = stack.size;
+	return state;
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* The state that's 'frame' on top of 'parent', adding it if need be. This
+|* doesn't allocate: if reserve() hasn't made room for it, it fails
+\*****************************************************************************/
+bool LexerStates::_push(uint32_t parent, const Frame& frame, uint32_t *state)
+	{
+	std::lock_guard<std::mutex> guard(_lock);
+	uint32_t count = _count.load(std::memory_order_relaxed);
+	if (_index == nullptr)
+		return false;
+
+	size_t mask	= _indexSize - 1;
+	size_t at	= _hash(parent, frame) & mask;
+	for (; _index[at] != 0; at = (at + 1) & mask)
+		{
+		const Node& node = _node(_index[at]);
+		if ((node.parent == parent) && (node.frame == frame))
+			{
+			*state = _index[at];
+			return true;
+			}
+		}
+
+	if (count >= (uint32_t) MAX_CHUNKS * CHUNK_STATES)
+		return false;
+
+	std::atomic<Node *>& chunk = _chunks[count / CHUNK_STATES];
+	if (chunk.load(std::memory_order_relaxed) == nullptr)
+		return false;
+
+	// The node is filled in before the count says it's there
+	Node& node	= chunk.load(std::memory_order_relaxed)[count % CHUNK_STATES];
+	node.parent	= parent;
+	node.depth	= (parent == 0) ? 1 : _node(parent).depth + 1;
+	node.frame	= frame;
+	_index[at]	= count;
+	_count.store(count + 1, std::memory_order_release);
+
+	*state = count;
+	return true;
+	}
+
+/*****************************************************************************\
+|* Make the hash table 'size' entries, and put the states back in it
+\*****************************************************************************/
+bool LexerStates::_rehash(size_t size)
+	{
+	uint32_t *index = (uint32_t *) _allocator->allocate(size * sizeof(uint32_t));
+	if (index == nullptr)
+		return false;
+	memset(index, 0, size * sizeof(uint32_t));
+
+	uint32_t count = _count.load(std::memory_order_relaxed);
+	for (uint32_t s = 1; s < count; s++)
+		{
+		const Node& node = _node(s);
+		size_t at = _hash(node.parent, node.frame) & (size - 1);
+		while (index[at] != 0)
+			at = (at + 1) & (size - 1);
+		index[at] = s;
+		}
+
+	_allocator->release(_index, _indexSize * sizeof(uint32_t));
+	_index		= index;
+	_indexSize	= size;
+	return true;
+	}
+
+/*****************************************************************************\
+|* FNV-1a over the parent and the frame
+\*****************************************************************************/
+uint64_t LexerStates::_hash(uint32_t parent, const Frame& frame)
+	{
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void *data, size_t len)
+		{
+		const uint8_t *p = (const uint8_t *) data;
+		for (size_t i = 0; i < len; i++)
+			hash = (hash ^ p[i]) * 1099511628211ull;
+		};
+	mix(&parent, sizeof(parent));
+	mix(&frame, sizeof(frame));
+	return hash ^ (hash >> 32);
+	}
@@ -0,0 +1,190 @@
+//
+//  LexerStates.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef LexerStates_h
+#define LexerStates_h
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+
+#include "properties.h"
+#include "macros.h"
+#include "Allocator.h"
+
+/*****************************************************************************\
+|* What the highlighter has open at the end of a row, which used to be just
+|* "in a comment or not". Some things nest: a shell "string" can hold a
+|* $(command) that has "strings" of its own, or a heredoc, and all of them
+|* can run on over many rows. So the state between rows is a stack of
+|* frames, each a region that's open: a comment, a string, a raw string or
+|* heredoc (with what closes it), or code inside a substitution.
+|*
+|* Stacks are hash-consed: each is a frame on top of the (shared) stack
+|* below it, and every distinct stack is kept once and known by a number,
+|* with 0 the empty stack. A row stores just that number, which fits in the
+|* 24 bits LineStore has for it, and two rows are in the same state exactly
+|* when their numbers are the same. That's what keeps re-highlighting after
+|* an edit bounded: it stops at the first row whose number hasn't changed,
+|* however deep the nesting.
+|*
+|* While a row is highlighted its stack is unpacked into a Stack (on the C
+|* stack, there's no allocating), changed as it goes, and interned again at
+|* the end, which only takes the lock if the stack is one we haven't seen.
+|* States are shared by the main thread and the background highlighter, so
+|* they're read without a lock: a state is never changed or moved once it's
+|* been handed out, only forgotten all at once by clear().
+|*
+|* The memory comes from the editor's allocator, which is only for the main
+|* thread, so interning never allocates. reserve() keeps half a chunk of
+|* states (and room for them in the hash table) ready ahead of the count,
+|* and is called on the main thread before the worker starts and as it goes.
+|* If the worker still gets there first, the stack is cut short
+\*****************************************************************************/
+class LexerStates
+	{
+    NON_COPYABLE_NOR_MOVEABLE(LexerStates)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			F_COMMENT		= 1,			// In a multi-line comment
+			F_STRING,						// In a string ('arg' is the quote)
+			F_RAW,							// In a raw string, up to 'closer'
+			F_HEREDOC,						// Up to a row that's 'closer'
+			F_CODE							// In a substitution ('arg' deep)
+			};
+
+		enum
+			{
+			MAX_DELIMITER	= 20,			// Longest closer we'll keep
+			MAX_DEPTH		= 16,			// Deepest stack we'll keep
+			CHUNK_STATES	= 4096,			// States allocated at once
+			MAX_CHUNKS		= 256			// ... up to 1M of them
+			};
+
+		typedef struct Frame
+			{
+			uint8_t					kind;	// F_*
+			uint8_t					arg;	// Quote, depth, or <<- if heredoc
+			uint8_t					length;	// Of the closer
+			char					closer[MAX_DELIMITER];
+
+			inline std::string_view delimiter(void) const
+				{ return std::string_view(closer, length); }
+			inline bool operator==(const Frame& other) const
+				{ return memcmp(this, &other, sizeof(Frame)) == 0; }
+			} Frame;
+
+		/*********************************************************************\
+		|* A stack being worked on. 'ids' are the states of each depth as it
+		|* was unpacked (or last interned), so interning it again only has to
+		|* look up the frames that have changed
+		\*********************************************************************/
+		typedef struct Stack
+			{
+			int						size;
+			int						known;	// ids[] that may still be good
+			uint32_t				ids[MAX_DEPTH];
+			Frame					frames[MAX_DEPTH];
+
+			inline Frame& top(void)
+				{ return frames[size - 1]; }
+			inline void pop(void)
+				{ size--; }
+			inline void push(const Frame& frame)
+				{
+				if (size < MAX_DEPTH)
+					frames[size++] = frame;
+				}
+			} Stack;
+
+    protected:
+		typedef struct Node
+			{
+			uint32_t				parent;	// State below this one
+			uint32_t				depth;	// Frames in the stack
+			Frame					frame;	// ... and the top one
+			} Node;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    protected:
+		Allocator *				_allocator;		// Where the memory comes from
+		std::atomic<Node *>		_chunks[MAX_CHUNKS];	// States, by number
+		std::atomic<uint32_t>	_count;			// ... handed out so far
+		std::mutex				_lock;			// Guards adding a state
+		uint32_t *				_index;			// States by hash, 0 if free
+		size_t					_indexSize;		// ... a power of two
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit LexerStates(Allocator *allocator = Allocator::heap());
+        ~LexerStates();
+
+        /*********************************************************************\
+        |* Where the states come from. This forgets them all, as clear() does
+        \*********************************************************************/
+		void setAllocator(Allocator *allocator);
+
+        /*********************************************************************\
+        |* Forget every state. Nothing may be highlighting, and the numbers
+        |* rows have are meaningless afterwards
+        \*********************************************************************/
+		void clear(void);
+
+        /*********************************************************************\
+        |* Make sure there's room for another chunk of states past the ones
+        |* handed out. Only on the main thread. Returns false if there wasn't
+        |* the memory
+        \*********************************************************************/
+		bool reserve(void);
+
+        /*********************************************************************\
+        |* A frame, with the rest of it zeroed so frames compare as bytes. A
+        |* closer too long to keep makes an empty frame (kind 0)
+        \*********************************************************************/
+		static Frame frame(int kind, int arg, std::string_view closer = "");
+
+        /*********************************************************************\
+        |* Unpack a state into a stack, and get the state a stack is. An
+        |* unknown state unpacks as the empty stack
+        \*********************************************************************/
+		void unpack(uint32_t state, Stack& stack) const;
+		uint32_t intern(Stack& stack);
+
+        /*********************************************************************\
+        |* How many states there are
+        \*********************************************************************/
+		inline uint32_t size(void) const
+			{ return _count.load(std::memory_order_acquire); }
+
+        /*********************************************************************\
+        |* Bytes the states and their hash table take
+        \*********************************************************************/
+		size_t footprint(void);
+
+    private:
+		inline const Node& _node(uint32_t state) const
+			{
+			Node *chunk = _chunks[state / CHUNK_STATES].load(std::memory_order_acquire);
+			return chunk[state % CHUNK_STATES];
+			}
+		bool _push(uint32_t parent, const Frame& frame, uint32_t *state);
+		bool _rehash(size_t size);
+		static uint64_t _hash(uint32_t parent, const Frame& frame);
+	};
+
+#endif /* LexerStates_h */
@@ -0,0 +1,350 @@
+//
+//  LineStore.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <cstdlib>
+#include <cstring>
+
+#include "LineStore.h"
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+LineStore::LineStore()
+		  :_lines(StlAllocator<Line>(Allocator::heap()))
+		  ,_allocator(Allocator::heap())
+		  ,_liveBytes(0)
+		  ,_deadBytes(0)
+		  ,_spareBytes(0)
+		  ,_free(nullptr)
+		  ,_left(0)
+		  ,_pools{}
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+LineStore::~LineStore()
+	{
+	clear();
+	}
+
+/*****************************************************************************\
+|* Draw on a different allocator from now on
+\*****************************************************************************/
+void LineStore::setAllocator(Allocator *allocator)
+	{
+	clear();
+	_allocator	= allocator;
+	_lines		= LineList(StlAllocator<Line>(allocator));
+	}
+
+/*****************************************************************************\
+|* Everything we've got from the allocator
+\*****************************************************************************/
+size_t LineStore::footprint(void)
+	{
+	size_t bytes = _lines.capacity() * sizeof(Line);
+	for (Chunk& chunk : _chunks)
+		bytes += chunk.size;
+	return bytes;
+	}
+
+/*****************************************************************************\
+|* What more lines would cost, as the list grows
+\*****************************************************************************/
+size_t LineStore::growth(int lines) const
+	{
+	size_t want = _lines.size() + MAX(lines, 0);
+	if (want <= _lines.capacity())
+		return 0;
+	return _capacityFor(want) * sizeof(Line);
+	}
+
+/*****************************************************************************\
+|* A chunk of its own for a whole file to be read into
+\*****************************************************************************/
+char * LineStore::buffer(size_t bytes)
+	{
+	return _chunk(bytes);
+	}
+
+/*****************************************************************************\
+|* Add a line whose text is already in the arena
+\*****************************************************************************/
+void LineStore::push(const char *text, size_t len)
+	{
+	_grow();
+	_lines.push_back({.text = text, .size = (uint32_t)len, .state = 0, .pool = 0});
+	_liveBytes += len;
+	}
+
+/*****************************************************************************\
+|* Add a line at the end
+\*****************************************************************************/
+void LineStore::append(std::string_view s)
+	{
+	Line line = make(s);
+	_grow();
+	_lines.push_back(line);
+	}
+
+/*****************************************************************************\
+|* Insert a line
+\*****************************************************************************/
+void LineStore::insert(int at, std::string_view s)
+	{
+	Line line = make(s);
+	_grow();
+	_lines.insert(_lines.begin() + at, line);
+	}
+
+/*****************************************************************************\
+|* Replace the text of a line. If there's room it's done in place, otherwise
+|* it moves to a bigger block. The highlighter state is left alone, it's up
+|* to the highlighter to update it
+\*****************************************************************************/
+void LineStore::set(int at, std::string_view s)
+	{
+	Line& line	= _lines[at];
+	size_t size	= line.size;
+
+	if (s.length() <= room(line))
+		{
+		memmove((char *) line.text, s.data(), s.length());
+		if (line.pool == 0)
+			_deadBytes += size - s.length();
+		}
+	else
+		{
+		uint8_t pool;
+		char *text = _take(s.length(), pool);
+		memcpy(text, s.data(), s.length());
+
+		_recycle(line);
+		line.text = text;
+		line.pool = pool;
+		}
+
+	_liveBytes	= _liveBytes - size + s.length();
+	line.size	= (uint32_t) s.length();
+
+	// Only now, since 's' may have pointed into the arena
+	compact();
+	}
+
+/*****************************************************************************\
+|* Remove lines
+\*****************************************************************************/
+void LineStore::erase(int at, int count)
+	{
+	for (int i = at; i < at + count; i++)
+		release(_lines[i]);
+	_lines.erase(_lines.begin() + at, _lines.begin() + at + count);
+	compact();
+	}
+
+/*****************************************************************************\
+|* Make room for lines
+\*****************************************************************************/
+void LineStore::reserve(int lines)
+	{
+	_lines.reserve(lines);
+	}
+
+/*****************************************************************************\
+|* Drop everything
+\*****************************************************************************/
+void LineStore::clear(void)
+	{
+	for (Chunk& chunk : _chunks)
+		_allocator->release(chunk.base, chunk.size);
+	_chunks.clear();
+	LineList(_lines.get_allocator()).swap(_lines);
+
+	_free		= nullptr;
+	_left		= 0;
+	_liveBytes	= 0;
+	_deadBytes	= 0;
+	_spareBytes	= 0;
+	for (char *& pool : _pools)
+		pool = nullptr;
+	}
+
+/*****************************************************************************\
+|* Copy text into the arena
+\*****************************************************************************/
+LineStore::Line LineStore::make(std::string_view s)
+	{
+	uint8_t pool;
+	char *text = _take(s.length(), pool);
+	memcpy(text, s.data(), s.length());
+	_liveBytes += s.length();
+	return {.text = text, .size = (uint32_t) s.length(), .state = 0, .pool = pool};
+	}
+
+/*****************************************************************************\
+|* A line has gone
+\*****************************************************************************/
+void LineStore::release(const Line& line)
+	{
+	_liveBytes -= line.size;
+	_recycle(line);
+	}
+
+/*****************************************************************************\
+|* Copy the live lines into one new chunk, and give back all the old ones
+\*****************************************************************************/
+void LineStore::compact(bool force)
+	{
+	size_t waste = _deadBytes + _spareBytes;
+	if (!force && ((waste < COMPACT_BYTES) || (waste < _liveBytes)))
+		return;
+
+	// Not having the memory to compact isn't fatal, it just costs memory
+	size_t size = MAX(_liveBytes, (size_t)1);
+	char *chunk = (char *) _allocator->allocate(size);
+	if (chunk == nullptr)
+		return;
+
+	char *p = chunk;
+	for (Line& line : _lines)
+		{
+		memcpy(p, line.text, line.size);
+		line.text = p;
+		line.pool = 0;
+		p += line.size;
+		}
+
+	for (Chunk& old : _chunks)
+		_allocator->release(old.base, old.size);
+	_chunks.clear();
+	_chunks.push_back({.base = chunk, .size = size});
+
+	_free		= nullptr;
+	_left		= 0;
+	_deadBytes	= 0;
+	_spareBytes	= 0;
+	for (char *& pool : _pools)
+		pool = nullptr;
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* Carve space out of the arena, starting a new chunk if need be. When the
+|* budget's too tight for a whole chunk, we just take what's needed. If even
+|* that fails the caller didn't check there was room, and all we can do is
+|* stop
+\*****************************************************************************/
+char * LineStore::_alloc(size_t bytes)
+	{
+	if (bytes > _left)
+		{
+		size_t size	= MAX(bytes, (size_t) CHUNK_BYTES);
+		char *chunk	= _chunk(size);
+		if (chunk == nullptr)
+			{
+			size	= bytes;
+			chunk	= _chunk(size);
+			}
+		if (chunk == nullptr)
+			abort();
+
+		_deadBytes += _left;
+		_free		= chunk;
+		_left		= size;
+		}
+
+	char *space	 = _free;
+	_free		+= bytes;
+	_left		-= bytes;
+	return space;
+	}
+
+/*****************************************************************************\
+|* Get a new chunk from the allocator, or nullptr if it's out of memory
+\*****************************************************************************/
+char * LineStore::_chunk(size_t bytes)
+	{
+	bytes		= MAX(bytes, (size_t)1);
+	char *chunk	= (char *) _allocator->allocate(bytes);
+	if (chunk == nullptr)
+		return nullptr;
+
+	_chunks.push_back({.base = chunk, .size = bytes});
+	return chunk;
+	}
+
+/*****************************************************************************\
+|* Get a block for a line of 'bytes': one of its size class if it's small
+|* enough, from the free list if there's one there, and say which class
+\*****************************************************************************/
+char * LineStore::_take(size_t bytes, uint8_t& pool)
+	{
+	if (bytes > ((size_t) MIN_CLASS_BYTES << (NUM_CLASSES - 1)))
+		{
+		pool = 0;
+		return _alloc(bytes);
+		}
+
+	int k = 0;
+	while (((size_t) MIN_CLASS_BYTES << k) < bytes)
+		k++;
+	pool = k + 1;
+
+	size_t size	= (size_t) MIN_CLASS_BYTES << k;
+	char *block	= _pools[k];
+	if (block == nullptr)
+		return _alloc(size);
+
+	// Free blocks hold the next one's address
+	memcpy(&_pools[k], block, sizeof(char *));
+	_spareBytes -= size;
+	return block;
+	}
+
+/*****************************************************************************\
+|* A line's block is no longer used: back on its free list, or garbage
+\*****************************************************************************/
+void LineStore::_recycle(const Line& line)
+	{
+	if (line.pool == 0)
+		{
+		_deadBytes += line.size;
+		return;
+		}
+
+	char *block	= (char *) line.text;
+	int k		= line.pool - 1;
+	memcpy(block, &_pools[k], sizeof(char *));
+	_pools[k]	 = block;
+	_spareBytes += room(line);
+	}
+
+/*****************************************************************************\
+|* How big the list should be to hold 'lines'. Doubling is quickest, but with
+|* a budget the old and new lists both have to fit while it's copied, so we
+|* go up by an eighth instead
+\*****************************************************************************/
+size_t LineStore::_capacityFor(size_t lines) const
+	{
+	size_t capacity = _lines.capacity();
+	if (_allocator->capacity() > 0)
+		capacity += capacity / 8 + 16;
+	else
+		capacity  = MAX(2 * capacity, (size_t) 16);
+	return MAX(capacity, lines);
+	}
+
+/*****************************************************************************\
+|* Make room for one more line in the list
+\*****************************************************************************/
+void LineStore::_grow(void)
+	{
+	if (_lines.size() == _lines.capacity())
+		_lines.reserve(_capacityFor(_lines.size() + 1));
+	}
@@ -0,0 +1,171 @@
+//
+//  LineStore.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef LineStore_h
+#define LineStore_h
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "properties.h"
+#include "macros.h"
+#include "Allocator.h"
+
+/*****************************************************************************\
+|* Compact storage for the lines of a file.
+|*
+|* Line text lives in a few large arena chunks rather than a heap block per
+|* line, and each line costs one 16-byte Line: where its text is, how long
+|* it is, and the state the highlighter leaves at its end. A line's number
+|* is just its position. A file is read straight into a chunk of its own
+|* and its lines point into that, so loading copies nothing.
+|*
+|* Lines that are edited or added come from size-class pools within the
+|* arena: a line gets the smallest power-of-two block (from MIN_CLASS_BYTES
+|* up) it fits in, so it can grow a little in place, and when it outgrows
+|* that, or goes, the block is kept on a free list for the next line of that
+|* size. Lines bigger than the largest class, or loaded from the file, have
+|* exactly the space they need, which becomes garbage when they change. Once
+|* the garbage and unused pool blocks outweigh the live text, the live lines
+|* are copied into a fresh chunk and the old ones freed. Anything returned
+|* by text() is only good until the next change.
+|*
+|* All the memory comes from an Allocator, so a document can be given a
+|* budget (or a fixed pool) of its own. With a budget the line list grows by
+|* an eighth at a time rather than doubling, and growth() says what adding
+|* lines would cost, so the caller can check before it runs out.
+\*****************************************************************************/
+class LineStore
+	{
+    NON_COPYABLE_NOR_MOVEABLE(LineStore)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			CHUNK_BYTES		= 1 << 20,		// Arena grows this much at once
+			COMPACT_BYTES	= 1 << 20,		// Least garbage worth compacting
+			MIN_CLASS_BYTES	= 16,			// Smallest pooled block
+			NUM_CLASSES		= 13			// ... up to 64K
+			};
+
+		typedef struct Line
+			{
+			const char *			text;	// In one of the chunks
+			uint32_t				size;	// Length, without the newline
+			uint32_t				state:24;	// Highlighter state at the end
+			uint32_t				pool:8;		// Size class + 1, 0 if unpooled
+			} Line;
+
+		typedef std::vector<Line, StlAllocator<Line>> LineList;
+
+		typedef struct Chunk
+			{
+			char *					base;	// From the allocator
+			size_t					size;	// ... and how big
+			} Chunk;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(LineList, lines);				// The lines, in order
+    GET(Allocator *, allocator);		// Where the memory comes from
+    GET(size_t, liveBytes);				// Text referenced by lines
+    GET(size_t, deadBytes);				// Text that's been replaced
+    GET(size_t, spareBytes);			// Pooled blocks not in use
+
+    protected:
+		std::vector<Chunk>	_chunks;		// Arena chunks
+		char *				_free;			// Unused space in the last one
+		size_t				_left;			// ... and how much of it
+		char *				_pools[NUM_CLASSES];	// Free blocks by class
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit LineStore();
+        ~LineStore();
+
+        /*********************************************************************\
+        |* Draw on a different allocator. This empties the store
+        \*********************************************************************/
+		void setAllocator(Allocator *allocator);
+
+        /*********************************************************************\
+        |* All the memory we have from the allocator, in use or not
+        \*********************************************************************/
+		size_t footprint(void);
+
+        /*********************************************************************\
+        |* Accessors. Lines aren't range-checked, there's nothing to throw
+        \*********************************************************************/
+		inline int size(void) const
+			{ return (int) _lines.size(); }
+		inline int length(int at) const
+			{ return (int) _lines[at].size; }
+		inline std::string_view text(int at) const
+			{ return std::string_view(_lines[at].text, _lines[at].size); }
+		inline std::string string(int at) const
+			{ return std::string(text(at)); }
+		inline uint32_t state(int at) const
+			{ return _lines[at].state; }
+		inline void setState(int at, uint32_t state)
+			{ _lines[at].state = state; }
+		inline size_t room(const Line& line) const
+			{ return line.pool ? (size_t) MIN_CLASS_BYTES << (line.pool - 1)
+							   : line.size; }
+
+        /*********************************************************************\
+        |* Bytes the line list would need to hold 'lines' more
+        \*********************************************************************/
+		size_t growth(int lines) const;
+
+        /*********************************************************************\
+        |* Loading: get a chunk to read a file into (or nullptr if there's not
+        |* the memory), then add lines that point into it
+        \*********************************************************************/
+		char * buffer(size_t bytes);
+		void push(const char *text, size_t len);
+
+        /*********************************************************************\
+        |* Editing
+        \*********************************************************************/
+		void append(std::string_view s);
+		void insert(int at, std::string_view s);
+		void set(int at, std::string_view s);
+		void erase(int at, int count = 1);
+		void reserve(int lines);
+		void clear(void);
+
+        /*********************************************************************\
+        |* Lower level: copy text into the arena as a Line that isn't in the
+        |* list yet, and give back one taken out of it. For callers that
+        |* rebuild the list wholesale
+        \*********************************************************************/
+		Line make(std::string_view s);
+		void release(const Line& line);
+
+        /*********************************************************************\
+        |* Copy the live lines together if there's enough garbage
+        \*********************************************************************/
+		void compact(bool force = false);
+
+    private:
+		char * _alloc(size_t bytes);
+		char * _chunk(size_t bytes);
+		char * _take(size_t bytes, uint8_t& pool);
+		void _recycle(const Line& line);
+		size_t _capacityFor(size_t lines) const;
+		void _grow(void);
+	};
+
+#endif /* LineStore_h */
@@ -0,0 +1,454 @@
+//
+//  Pager.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Pager.h"
+#include "Search.h"
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+Pager::Pager()
+	  :_filename("")
+	  ,_fd(-1)
+	  ,_size(0)
+	  ,_numRows(0)
+	  ,_lines(0)
+	  ,_lastChar('\n')
+	  ,_complete(false)
+	  ,_cancel(false)
+	  ,_lastRow(-1)
+	  ,_stopSearch(false)
+	  ,_searchState(SEARCH_IDLE)
+	  ,_searchResult(-1)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+Pager::~Pager()
+	{
+	close();
+	}
+
+/*****************************************************************************\
+|* Open a file and start the scanner off on it
+\*****************************************************************************/
+bool Pager::open(std::string filename)
+	{
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0)
+		{
+		::close(fd);
+		return false;
+		}
+
+	_filename	= filename;
+	_fd			= fd;
+	_size		= sb.st_size;
+	_checkpoints.push_back(0);
+	_scanner	= std::thread(&Pager::_scan, this);
+	return true;
+	}
+
+/*****************************************************************************\
+|* Stop the workers and close the file
+\*****************************************************************************/
+void Pager::close(void)
+	{
+	stopSearch();
+
+	if (_scanner.joinable())
+		{
+		_cancel = true;
+		_scanner.join();
+		}
+
+	if (_fd >= 0)
+		::close(_fd);
+
+	_fd			= -1;
+	_size		= 0;
+	_numRows	= 0;
+	_lines		= 0;
+	_lastChar	= '\n';
+	_complete	= false;
+	_cancel		= false;
+	_lastRow	= -1;
+	_lastOffsets.clear();
+	_checkpoints.clear();
+	_readScratch	= Scratch();
+	_searchScratch	= Scratch();
+	}
+
+/*****************************************************************************\
+|* Read a run of lines. Reading on from the end of the last run (as when
+|* scrolling) carries straight on, otherwise we start from a checkpoint
+\*****************************************************************************/
+bool Pager::read(int first, int count, StringList& lines)
+	{
+	off_t offset = _offsetOf(first);
+	if (offset < 0)
+		return false;
+
+	std::vector<off_t> offsets;
+	lines.clear();
+
+	off_t next = _stream(_readScratch, offset, first, first + count,
+		[&](int, off_t at, const char *text, int len)
+			{
+			lines.emplace_back(text, len);
+			offsets.push_back(at);
+			return true;
+			});
+
+	offsets.push_back(next);
+	_lastRow		= first;
+	_lastOffsets	= std::move(offsets);
+	return true;
+	}
+
+/*****************************************************************************\
+|* Start a search off in the background
+\*****************************************************************************/
+void Pager::search(std::string query, int flags, int from, int direction)
+	{
+	stopSearch();
+
+	off_t offset = _offsetOf(from);
+	if (offset < 0)
+		{
+		from	= 0;
+		offset	= 0;
+		}
+
+	_searchResult	= -1;
+	_searchState	= SEARCH_RUNNING;
+	_searcher		= std::thread(&Pager::_search,
+								  this,
+								  query,
+								  flags,
+								  from,
+								  offset,
+								  direction);
+	}
+
+/*****************************************************************************\
+|* Abandon any search in progress
+\*****************************************************************************/
+void Pager::stopSearch(void)
+	{
+	if (_searcher.joinable())
+		{
+		_stopSearch = true;
+		_searcher.join();
+		}
+	_stopSearch		= false;
+	_searchState	= SEARCH_IDLE;
+	}
+
+/*****************************************************************************\
+|* Collect the result of a finished search
+\*****************************************************************************/
+int Pager::searchResult(void)
+	{
+	if (_searchState != SEARCH_DONE)
+		return -1;
+
+	_searcher.join();
+	_searchState = SEARCH_IDLE;
+	return _searchResult;
+	}
+
+/*****************************************************************************\
+|* Pick up lines appended since we last looked. Not while the scanner or a
+|* search is still running though, since they're reading _size; the caller
+|* can try again later
+\*****************************************************************************/
+int Pager::grow(void)
+	{
+	if (!_complete || (_searchState == SEARCH_RUNNING))
+		return 0;
+
+	struct stat sb;
+	if (fstat(_fd, &sb) != 0)
+		return 0;
+	if (sb.st_size < _size)
+		return -1;
+	if (sb.st_size == _size)
+		return 0;
+
+	off_t from	= _size;
+	_size		= sb.st_size;
+	_scanRange(from, _size);
+	_numRows	= _lines + ((_lastChar != '\n') ? 1 : 0);
+
+	// The last line we read may have been partial
+	_lastRow 	= -1;
+	_lastOffsets.clear();
+	return 1;
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* Scan the whole file, then count a last line without a newline
+\*****************************************************************************/
+void Pager::_scan(void)
+	{
+	_scanRange(0, _size);
+
+	if (!_cancel)
+		{
+		_numRows  = _lines + ((_lastChar != '\n') ? 1 : 0);
+		_complete = true;
+		}
+	}
+
+/*****************************************************************************\
+|* Scan part of the file for line starts, recording a checkpoint every so
+|* often and publishing the count as we go so the UI can use what we've
+|* found so far
+\*****************************************************************************/
+void Pager::_scanRange(off_t pos, off_t end)
+	{
+	std::vector<char> buf(CHUNK_BYTES);
+	int rows	= _lines;
+
+	while ((pos < end) && !_cancel)
+		{
+		size_t want = (size_t) MIN((off_t) buf.size(), end - pos);
+		ssize_t got = pread(_fd, buf.data(), want, pos);
+		if (got <= 0)
+			break;
+
+		const char *p	 = buf.data();
+		const char *last = p + got;
+		while ((p = (const char *) memchr(p, '\n', last - p)) != nullptr)
+			{
+			p ++;
+			rows ++;
+			if ((rows % CHECKPOINT_ROWS) == 0)
+				{
+				std::lock_guard<std::mutex> guard(_lock);
+				_checkpoints.push_back(pos + (p - buf.data()));
+				}
+			}
+
+		_lastChar	= last[-1];
+		pos		   += got;
+		_lines		= rows;
+		_numRows	= rows;
+		}
+	}
+
+/*****************************************************************************\
+|* Search the file a line at a time, wrapping round at the ends. Going
+|* backwards we want the last match before 'from', so each block of rows
+|* between checkpoints is streamed forwards remembering the last match
+|* seen, working back a block at a time until one has a match. Rows below
+|* 'lowest' don't count, for the block 'from' is in when we've wrapped
+\*****************************************************************************/
+void Pager::_search(std::string query,
+					int flags,
+					int from,
+					off_t offset,
+					int direction)
+	{
+	std::string needle = Search::needle(query, flags);
+	std::string scratch;
+	int found	= -1;
+	int lowest	= 0;
+
+	auto test = [&](int row, off_t, const char *text, int len)
+		{
+		if (_stopSearch)
+			return false;
+		if ((row >= lowest)
+		 && (Search::find(text, len, needle, 0, flags, scratch) >= 0))
+			{
+			found = row;
+			return (direction < 0);
+			}
+		return true;
+		};
+
+	if (direction > 0)
+		{
+		_stream(_searchScratch, offset, from, INT_MAX, test);
+		if ((found < 0) && (from > 0))
+			_stream(_searchScratch, 0, 0, from, test);
+		}
+	else
+		{
+		int blocks;
+			{
+			std::lock_guard<std::mutex> guard(_lock);
+			blocks = (int) _checkpoints.size();
+			}
+
+		int start = from / CHECKPOINT_ROWS;
+		for (int block = start; (block >= 0) && (found < 0); block --)
+			{
+			int last = (block == start) ? from + 1
+										: (block + 1) * CHECKPOINT_ROWS;
+			_stream(_searchScratch, _checkpoint(block),
+					block * CHECKPOINT_ROWS, last, test);
+			if (_stopSearch)
+				break;
+			}
+
+		// The last block runs on to the end, checkpointed or not
+		lowest = from + 1;
+		for (int block = blocks - 1; (block >= start) && (found < 0); block --)
+			{
+			int last = (block == blocks - 1) ? INT_MAX
+											 : (block + 1) * CHECKPOINT_ROWS;
+			_stream(_searchScratch, _checkpoint(block),
+					block * CHECKPOINT_ROWS, last, test);
+			if (_stopSearch)
+				break;
+			}
+		}
+
+	if (!_stopSearch)
+		{
+		_searchResult	= found;
+		_searchState	= SEARCH_DONE;
+		}
+	}
+
+/*****************************************************************************\
+|* Find where a row starts, from the last read or the nearest checkpoint
+\*****************************************************************************/
+off_t Pager::_offsetOf(int row)
+	{
+	if ((row < 0) || (row > _numRows) || ((row == _numRows) && _complete))
+		return -1;
+
+	if ((_lastRow >= 0) && (row >= _lastRow)
+	 && (row < _lastRow + (int) _lastOffsets.size()))
+		return _lastOffsets[row - _lastRow];
+
+	int checkpoint	= row / CHECKPOINT_ROWS;
+	off_t offset	= _checkpoint(checkpoint);
+	if (offset < 0)
+		return -1;
+
+	int first = checkpoint * CHECKPOINT_ROWS;
+	if (first == row)
+		return offset;
+
+	return _stream(_readScratch, offset, first, row,
+				   [](int, off_t, const char *, int)
+						{
+						return true;
+						});
+	}
+
+/*****************************************************************************\
+|* Where a block of CHECKPOINT_ROWS rows starts, if the scanner's got there
+\*****************************************************************************/
+off_t Pager::_checkpoint(int block)
+	{
+	std::lock_guard<std::mutex> guard(_lock);
+	if ((block < 0) || (block >= (int) _checkpoints.size()))
+		return -1;
+	return _checkpoints[block];
+	}
+
+/*****************************************************************************\
+|* Stream lines [first, last) starting at 'offset'. Line endings (\n or \r\n)
+|* are stripped, and anything past LINE_BYTES in a line is dropped, though
+|* we still read on to find where it ends. Returns the offset just past the
+|* last line handed to 'fn', or -1 if 'offset' was invalid
+\*****************************************************************************/
+template <typename F>
+off_t Pager::_stream(Scratch& scratch, off_t offset, int first, int last, F fn)
+	{
+	if (offset < 0)
+		return -1;
+
+	std::vector<char>& buf	= scratch.buf;
+	std::string& carry		= scratch.carry;
+	if (buf.size() != CHUNK_BYTES)
+		buf.resize(CHUNK_BYTES);
+	carry.clear();
+
+	auto keep = [&](const char *text, size_t len)
+		{
+		carry.append(text, MIN(len, LINE_BYTES - carry.length()));
+		};
+
+	off_t lineStart	= offset;
+	off_t pos		= offset;
+	int row			= first;
+
+	while ((row < last) && (pos < _size))
+		{
+		ssize_t got = pread(_fd, buf.data(), buf.size(), pos);
+		if (got <= 0)
+			break;
+
+		const char *p	= buf.data();
+		const char *end	= p + got;
+
+		while (row < last)
+			{
+			const char *nl = (const char *) memchr(p, '\n', end - p);
+			if (nl == nullptr)
+				{
+				keep(p, end - p);
+				break;
+				}
+
+			const char *text = p;
+			int len			 = (int) MIN(nl - p, (off_t) LINE_BYTES);
+			if (carry.length() > 0)
+				{
+				keep(p, nl - p);
+				text = carry.data();
+				len	 = (int) carry.length();
+				}
+			while ((len > 0) && (text[len - 1] == '\r'))
+				len --;
+
+			bool more = fn(row, lineStart, text, len);
+			carry.clear();
+			row ++;
+			lineStart = pos + (nl + 1 - buf.data());
+			p = nl + 1;
+
+			if (!more)
+				return lineStart;
+			}
+		pos += got;
+		}
+
+	// The last line in the file needn't have a newline
+	if ((row < last) && (carry.length() > 0) && (pos >= _size))
+		{
+		int len = (int) carry.length();
+		while ((len > 0) && (carry[len - 1] == '\r'))
+			len --;
+		fn(row, lineStart, carry.data(), len);
+		lineStart = _size;
+		}
+	return lineStart;
+	}
@@ -0,0 +1,163 @@
+//
+//  Pager.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Pager_h
+#define Pager_h
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "properties.h"
+#include "macros.h"
+
+/*****************************************************************************\
+|* Read-only access to the lines of a file too big to load. Nothing is held
+|* in memory apart from a sparse index of line offsets (one every
+|* CHECKPOINT_ROWS lines), built by a worker thread scanning the file, and
+|* the offsets of the last run of lines read. Lines are read on demand with
+|* pread(), starting from the nearest checkpoint.
+|*
+|* Searches stream through the file on another worker, so the UI can keep
+|* going while a multi-GB file is scanned. Lines longer than LINE_BYTES are
+|* cut short, so one enormous line can't take all the memory there is.
+\*****************************************************************************/
+class Pager
+	{
+    NON_COPYABLE_NOR_MOVEABLE(Pager)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		typedef std::vector<std::string> StringList;
+
+		enum
+			{
+			CHECKPOINT_ROWS	= 1024,			// Lines between index entries
+			CHUNK_BYTES		= 1 << 20,		// Read size when streaming
+			LINE_BYTES		= 1 << 20		// Longest line we hand out
+			};
+
+		typedef enum SearchState
+			{
+			SEARCH_IDLE = 0,				// No search, or result taken
+			SEARCH_RUNNING,					// Worker is still going
+			SEARCH_DONE						// Result is ready to take
+			} SearchState;
+
+	protected:
+		typedef struct Scratch
+			{
+			std::vector<char>	buf;			// Last chunk read
+			std::string			carry;			// Line running on from it
+			} Scratch;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(std::string, filename);			// File we're paging through
+    GET(int, fd);						// ... and its descriptor
+    GET(off_t, size);					// Size of the file
+
+    protected:
+		std::mutex				_lock;			// Guards _checkpoints
+		std::vector<off_t>		_checkpoints;	// Offset of every Nth line
+		std::atomic<int>		_numRows;		// Lines found so far
+		int						_lines;			// ... that end in a newline
+		char					_lastChar;		// Last byte scanned
+		std::atomic<bool>		_complete;		// Scan has reached EOF
+		std::atomic<bool>		_cancel;		// Ask the workers to stop
+		std::thread				_scanner;		// Builds _checkpoints
+
+		int						_lastRow;		// First row of the last read
+		std::vector<off_t>		_lastOffsets;	// Offsets of the rows read,
+												// and of the row after them
+
+		std::thread				_searcher;		// Streams through searches
+		std::atomic<bool>		_stopSearch;	// Ask the searcher to stop
+		std::atomic<int>		_searchState;	// SearchState
+		int						_searchResult;	// Row found, or -1
+
+		Scratch					_readScratch;	// For streaming on the UI
+		Scratch					_searchScratch;	// ... and the searcher
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit Pager();
+        ~Pager();
+
+        /*********************************************************************\
+        |* Open a file, and start indexing its lines
+        \*********************************************************************/
+        bool open(std::string filename);
+		void close(void);
+
+        /*********************************************************************\
+        |* How many lines we know about, and whether that's all of them
+        \*********************************************************************/
+		int numRows(void)		{ return _numRows; }
+		bool complete(void)		{ return _complete; }
+
+        /*********************************************************************\
+        |* Read 'count' lines starting at 'first'. Returns false if 'first'
+        |* isn't a line we know about yet
+        \*********************************************************************/
+		bool read(int first, int count, StringList& lines);
+
+        /*********************************************************************\
+        |* Search for a line containing 'query', starting at 'from' and going
+        |* in 'direction', wrapping at the ends. The result is collected with
+        |* searchResult() once searchState() is SEARCH_DONE
+        \*********************************************************************/
+		void search(std::string query, int flags, int from, int direction);
+		void stopSearch(void);
+		int searchState(void)	{ return _searchState; }
+		int searchResult(void);
+
+        /*********************************************************************\
+        |* Pick up anything appended to the file since it was scanned.
+        |* Returns 1 if it grew, 0 if not (or we're busy), -1 if it shrank
+        \*********************************************************************/
+		int grow(void);
+
+    private:
+        /*********************************************************************\
+        |* Worker threads
+        \*********************************************************************/
+		void _scan(void);
+		void _scanRange(off_t pos, off_t end);
+		void _search(std::string query,
+					 int flags,
+					 int from,
+					 off_t offset,
+					 int direction);
+
+        /*********************************************************************\
+        |* Where does a row start, and where does the Nth block of
+        |* CHECKPOINT_ROWS rows start. Both return -1 if we don't know yet
+        \*********************************************************************/
+		off_t _offsetOf(int row);
+		off_t _checkpoint(int block);
+
+        /*********************************************************************\
+        |* Stream the lines [first, last) from 'offset', calling 'fn' on each
+        |* until it returns false. 'scratch' is the buffer to read into, one
+        |* per thread that streams
+        \*********************************************************************/
+		template <typename F>
+		off_t _stream(Scratch& scratch, off_t offset, int first, int last, F fn);
+	};
+
+#endif /* Pager_h */
@@ -0,0 +1,73 @@
+//
+//  Search.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <string_view>
+
+#include "CharClass.h"
+#include "Search.h"
+
+/*****************************************************************************\
+|* Find a (pre-folded) query in some (pre-folded) text. Whole-word matches
+|* are checked against the shared character table
+\*****************************************************************************/
+int Search::find(const char *text,
+				 int len,
+				 const std::string& query,
+				 int from,
+				 int flags)
+	{
+	if ((from < 0) || (from > len) || (query.length() == 0))
+		return -1;
+
+	std::string_view haystack(text, len);
+	int qlen = (int) query.length();
+	std::size_t pos;
+
+	while ((pos = haystack.find(query, from)) != std::string_view::npos)
+		{
+		int at = (int) pos;
+
+		if (!(flags & SEARCH_WORD))
+			return at;
+
+		bool startOk = (at == 0) || !CharClass::isWord(text[at - 1]);
+		bool endOk	 = (at + qlen == len) || !CharClass::isWord(text[at + qlen]);
+		if (startOk && endOk)
+			return at;
+		from = at + 1;
+		}
+	return -1;
+	}
+
+/*****************************************************************************\
+|* Find a needle in some text, folding the text first for caseless searches
+\*****************************************************************************/
+int Search::find(const char *text,
+				 int len,
+				 const std::string& needle,
+				 int from,
+				 int flags,
+				 std::string& scratch)
+	{
+	if (!(flags & SEARCH_CASELESS))
+		return find(text, len, needle, from, flags);
+
+	scratch.resize(len);
+	CharClass::fold(text, scratch.data(), len);
+	return find(scratch.data(), len, needle, from, flags);
+	}
+
+/*****************************************************************************\
+|* Fold a query for a caseless search, so it's only done once
+\*****************************************************************************/
+std::string Search::needle(const std::string& query, int flags)
+	{
+	std::string needle = query;
+	if (flags & SEARCH_CASELESS)
+		CharClass::fold(query.data(), needle.data(), query.length());
+	return needle;
+	}
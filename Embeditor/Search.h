@@ -0,0 +1,58 @@
+//
+//  Search.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Search_h
+#define Search_h
+
+#include <string>
+
+/*****************************************************************************\
+|* The string matcher behind find and replace, usable on any run of bytes so
+|* that the rows in memory and text streamed from disk search the same way
+\*****************************************************************************/
+class Search
+	{
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			SEARCH_CASELESS	= (1<<0),
+			SEARCH_WORD		= (1<<1)
+			};
+
+    public:
+        /*********************************************************************\
+        |* Find 'query' in 'text' from column 'from', returning the column of
+        |* the match or -1. For caseless searches both text and query must
+        |* already be folded
+        \*********************************************************************/
+		static int find(const char *text,
+						int len,
+						const std::string& query,
+						int from,
+						int flags);
+
+        /*********************************************************************\
+        |* As above, folding the text into 'scratch' first if need be. The
+        |* query is a needle from needle(), made once per search
+        \*********************************************************************/
+		static int find(const char *text,
+						int len,
+						const std::string& needle,
+						int from,
+						int flags,
+						std::string& scratch);
+
+        /*********************************************************************\
+        |* The query as find() wants it: folded, for caseless searches
+        \*********************************************************************/
+		static std::string needle(const std::string& query, int flags);
+	};
+
+#endif /* Search_h */
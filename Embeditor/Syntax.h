@@ -0,0 +1,332 @@
+//
+//  Syntax.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Syntax_h
+#define Syntax_h
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "CharClass.h"
+#include "Tokenizer.h"
+
+/*****************************************************************************\
+|* How to highlight a language. These are built at compile time (see
+|* Languages.h), so a language costs no allocation or static constructor at
+|* startup, only its constant tables.
+|*
+|* Keywords are written as they always have been, with a trailing '|' for a
+|* secondary keyword (a type, say), and there are a few more of those marks
+|* for other sorts of keyword:
+|*
+|*     word     a keyword
+|*     word|    a type
+|*     word=    a constant (true, None)
+|*     word!    an error, in a log
+|*     word?    a warning, in a log
+|*
+|* The mark is dealt with when the table is built rather than every time a
+|* keyword is tried. They're sorted by first character and then length, and
+|* indexed by first character, so a word is only compared with the keywords
+|* it could be. A second table gives the class of every byte for the
+|* highlighter's state machine (see Tokenizer.h): what it is in this
+|* language, and whether it might start a keyword or a comment delimiter.
+|* A language can add to the usual separators (JSON's ':', say), and name
+|* sigils that start a variable.
+|*
+|* Some regions go on past the end of a row, or have other regions inside
+|* them, and their state is kept on a stack between rows (LexerStates.h).
+|* A language can have raw strings (C++'s R"delim(...)delim"), heredocs
+|* (<<WORD up to a row that's just WORD), strings that carry on over rows,
+|* and a substitution that opens code inside a "string" ("$(...)"), up to
+|* the bracket that matches its last character.
+\*****************************************************************************/
+class Syntax
+	{
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			HIGHLIGHT_NUMBERS	= (1<<0),
+			HIGHLIGHT_STRINGS	= (1<<1),
+			HIGHLIGHT_HEREDOCS	= (1<<2),		// <<WORD ... WORD
+			HIGHLIGHT_LONG_STRINGS = (1<<3)		// Strings go on over rows
+			};
+
+		typedef struct Keyword
+			{
+			std::string_view	word;		// Without any mark
+			uint8_t				token;		// Tokenizer TOKEN_*, from it
+			} Keyword;
+
+		template <size_t N>
+		using KeywordTable = std::array<Keyword, N>;
+
+	/*************************************************************************\
+    |* The definition
+    \*************************************************************************/
+    public:
+		std::string_view		filetype;			// Shown in the status bar
+		const std::string_view *filematch;			// ".ext", or whole names
+		int						numFilematch;
+		const Keyword *			keywords;			// Sorted, see above
+		int						numKeywords;
+		std::string_view		singleLineCommentStart;
+		std::string_view		multiLineCommentStart;
+		std::string_view		multiLineCommentEnd;
+		int						flags;				// HIGHLIGHT_*
+		std::string_view		sigils;				// Start a $variable
+		std::string_view		separators;			// As well as the usual
+		std::string_view		rawStringStart;		// Then delim(...)delim"
+		std::string_view		substitutionStart;	// Code in a "string"
+		CharClass::Table		classes;			// Tokenizer K_* by byte
+		std::array<uint16_t, 256> first;			// First keyword by char
+		CharClass::Table		count;				// ... and how many
+
+    public:
+        /*********************************************************************\
+        |* A keyword as written, with its mark (if any) taken off
+        \*********************************************************************/
+		static constexpr Keyword parseKeyword(std::string_view word)
+			{
+			uint8_t token = Tokenizer::TOKEN_KEYWORD1;
+			switch (word.empty() ? '\0' : word.back())
+				{
+				case '|':	token = Tokenizer::TOKEN_KEYWORD2;	break;
+				case '=':	token = Tokenizer::TOKEN_CONSTANT;	break;
+				case '!':	token = Tokenizer::TOKEN_ERROR;		break;
+				case '?':	token = Tokenizer::TOKEN_WARNING;	break;
+				}
+			if (token != Tokenizer::TOKEN_KEYWORD1)
+				word.remove_suffix(1);
+			return {.word = word, .token = token};
+			}
+
+        /*********************************************************************\
+        |* Build a keyword table from the usual "word" / "word|" list
+        \*********************************************************************/
+		template <size_t N>
+		static constexpr KeywordTable<N> keywordTable(const char * const (&words)[N])
+			{
+			KeywordTable<N> table = {};
+			for (size_t i = 0; i < N; i++)
+				table[i] = parseKeyword(words[i]);
+
+			sortKeywords(table.data(), (int) N);
+			return table;
+			}
+
+        /*********************************************************************\
+        |* Sort keywords by first character and then length, for the index.
+        |* An insertion sort, since this runs in the compiler
+        \*********************************************************************/
+		static constexpr void sortKeywords(Keyword *keywords, int n)
+			{
+			auto before = [](const Keyword& a, const Keyword& b)
+				{
+				uint8_t ca = a.word.empty() ? 0 : (uint8_t) a.word[0];
+				uint8_t cb = b.word.empty() ? 0 : (uint8_t) b.word[0];
+				return (ca < cb)
+					|| ((ca == cb) && (a.word.length() < b.word.length()));
+				};
+			for (int i = 1; i < n; i++)
+				for (int j = i; (j > 0) && before(keywords[j], keywords[j - 1]); j--)
+					{
+					Keyword tmp		= keywords[j];
+					keywords[j]		= keywords[j - 1];
+					keywords[j - 1]	= tmp;
+					}
+			}
+
+        /*********************************************************************\
+        |* Put a language together, and work out its tables
+        \*********************************************************************/
+		template <size_t M, size_t N>
+		static constexpr Syntax make(std::string_view filetype,
+									 const std::string_view (&filematch)[M],
+									 const KeywordTable<N>& keywords,
+									 std::string_view singleLineCommentStart,
+									 std::string_view multiLineCommentStart,
+									 std::string_view multiLineCommentEnd,
+									 int flags,
+									 std::string_view sigils = "",
+									 std::string_view separators = "",
+									 std::string_view rawStringStart = "",
+									 std::string_view substitutionStart = "")
+			{
+			Syntax s = {};
+			s.filetype					= filetype;
+			s.filematch					= filematch;
+			s.numFilematch				= (int) M;
+			s.keywords					= keywords.data();
+			s.numKeywords				= (int) N;
+			s.singleLineCommentStart	= singleLineCommentStart;
+			s.multiLineCommentStart		= multiLineCommentStart;
+			s.multiLineCommentEnd		= multiLineCommentEnd;
+			s.flags						= flags;
+			s.sigils					= sigils;
+			s.separators				= separators;
+			s.rawStringStart			= rawStringStart;
+			s.substitutionStart			= substitutionStart;
+			s.index();
+			return s;
+			}
+
+        /*********************************************************************\
+        |* Work out the tables from the (sorted) keywords, delimiters, flags,
+        |* sigils and separators. A substitution's brackets nest, so while
+        |* we're in one they have to be counted
+        \*********************************************************************/
+		constexpr void index(void)
+			{
+			first	= {};
+			count	= {};
+			for (int i = numKeywords - 1; i >= 0; i--)
+				{
+				uint8_t c = (uint8_t) keywords[i].word[0];
+				first[c]	= (uint16_t) i;
+				count[c] ++;
+				}
+
+			// What a byte is, in the order the highlighter has always tried
+			// things: strings, then numbers, then sigils and keywords
+			bool strings = (flags & HIGHLIGHT_STRINGS) != 0;
+			bool numbers = (flags & HIGHLIGHT_NUMBERS) != 0;
+			for (int c = 0; c < 256; c++)
+				{
+				bool separates = CharClass::isSeparator(c)
+							  || (separators.find((char) c) != std::string_view::npos);
+				uint8_t cls	   = separates
+							   ? Tokenizer::K_SEPARATOR
+							   : Tokenizer::K_TEXT;
+				if (strings && (c == '"'))
+					cls = Tokenizer::K_DQUOTE;
+				else if (strings && (c == '\''))
+					cls = Tokenizer::K_SQUOTE;
+				else if (numbers && CharClass::isDigit(c))
+					cls = Tokenizer::K_DIGIT;
+				else if (numbers && (c == '.'))
+					cls = Tokenizer::K_DOT;
+				else if (sigils.find((char) c) != std::string_view::npos)
+					cls = Tokenizer::K_SIGIL;
+				else if (count[c] > 0)
+					cls = Tokenizer::K_KEYWORD;
+
+				if (strings && (c == '\\'))
+					cls |= Tokenizer::ESCAPES;
+				classes[c] = cls;
+				}
+
+			bool multiLine = (multiLineCommentStart.length() > 0)
+						  && (multiLineCommentEnd.length() > 0);
+			if (singleLineCommentStart.length() > 0)
+				classes[(uint8_t) singleLineCommentStart[0]] |= Tokenizer::OPENS;
+			if (multiLine)
+				{
+				classes[(uint8_t) multiLineCommentStart[0]] |= Tokenizer::OPENS;
+				classes[(uint8_t) multiLineCommentEnd[0]]	|= Tokenizer::CLOSES;
+				}
+			if (rawStringStart.length() > 0)
+				classes[(uint8_t) rawStringStart[0]] |= Tokenizer::OPENS;
+			if (flags & HIGHLIGHT_HEREDOCS)
+				classes['<'] |= Tokenizer::OPENS;
+			if (substitutionEnd() != '\0')
+				{
+				classes[(uint8_t) substitutionStart[0]]		|= Tokenizer::OPENS
+															 | Tokenizer::NESTS;
+				classes[(uint8_t) substitutionStart.back()]	|= Tokenizer::NESTS;
+				classes[(uint8_t) substitutionEnd()]		|= Tokenizer::NESTS;
+				}
+			}
+
+        /*********************************************************************\
+        |* What closes a substitution, or '\0' if there aren't any
+        \*********************************************************************/
+		constexpr char substitutionEnd(void) const
+			{
+			switch (substitutionStart.empty() ? '\0' : substitutionStart.back())
+				{
+				case '(':	return ')';
+				case '[':	return ']';
+				case '{':	return '}';
+				default:	return '\0';
+				}
+			}
+
+        /*********************************************************************\
+        |* Is this language for a file: its extension (".c") or its name
+        |* ("Makefile") has to be one we match
+        \*********************************************************************/
+		constexpr bool matches(std::string_view filename) const
+			{
+			size_t slash		= filename.rfind('/');
+			std::string_view name = (slash == std::string_view::npos)
+								  ? filename
+								  : filename.substr(slash + 1);
+			size_t dot			= name.rfind('.');
+			std::string_view ext = (dot == std::string_view::npos)
+								 ? std::string_view()
+								 : name.substr(dot);
+
+			for (int i = 0; i < numFilematch; i++)
+				{
+				std::string_view match = filematch[i];
+				bool isExt = (match.length() > 0) && (match[0] == '.');
+				if (isExt ? (ext == match) : (name == match))
+					return true;
+				}
+			return false;
+			}
+
+        /*********************************************************************\
+        |* Check a definition, for a static_assert. Keywords have to be words
+        |* in this language (the highlighter matches a whole word at a time),
+        |* and there can't be more starting with one character than the
+        |* count can hold. A substitution has to end in a bracket, and open
+        |* with something else
+        \*********************************************************************/
+		constexpr bool valid(void) const
+			{
+			for (int i = 0; i < numKeywords; i++)
+				{
+				if (keywords[i].word.empty())
+					return false;
+				for (char c : keywords[i].word)
+					if (Tokenizer::endsWord(classes[(uint8_t) c]))
+						return false;
+				}
+
+			if ((substitutionStart.length() > 0)
+			 && ((substitutionEnd() == '\0') || (substitutionStart.length() < 2)))
+				return false;
+
+			int total = 0;
+			for (int c = 0; c < 256; c++)
+				total += count[c];
+			return total == numKeywords;
+			}
+
+        /*********************************************************************\
+        |* The keyword (if any) that a whole word is
+        \*********************************************************************/
+		constexpr const Keyword * keyword(std::string_view word) const
+			{
+			uint8_t c = (uint8_t) word[0];
+			const Keyword *k	= keywords + first[c];
+			const Keyword *end	= k + count[c];
+			for (; (k < end) && (k->word.length() <= word.length()); k++)
+				if (k->word == word)
+					return k;
+			return nullptr;
+			}
+	};
+
+#endif /* Syntax_h */
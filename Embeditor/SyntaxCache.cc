@@ -0,0 +1,513 @@
+//
+//  SyntaxCache.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SyntaxCache.h"
+
+#define CACHE_MAGIC			"EDSYN004"
+#define CACHE_NAME			".syntax.cache"
+#define SYNTAX_SUFFIX		".syntax"
+
+/*****************************************************************************\
+|* On-disk layout of the cache: this header, the languages, then the
+|* filematch strings and keywords they index into, then the text of all the
+|* strings. Everything is a multiple of 4 bytes, so it's all aligned
+|* wherever it's mapped
+\*****************************************************************************/
+typedef struct CacheHeader
+	{
+	char		magic[8];
+	uint64_t	stamp;				// Of the definitions it was built from
+	uint32_t	languages;			// CacheLanguage entries
+	uint32_t	matches;			// CacheString entries, for filematch
+	uint32_t	keywords;			// CacheKeyword entries
+	uint32_t	textBytes;			// Bytes of string text
+	} CacheHeader;
+
+typedef struct CacheString
+	{
+	uint32_t	offset;				// Into the text
+	uint32_t	length;
+	} CacheString;
+
+typedef struct CacheKeyword
+	{
+	CacheString	word;
+	uint32_t	token;				// Tokenizer TOKEN_*
+	} CacheKeyword;
+
+typedef struct CacheLanguage
+	{
+	CacheString	filetype;
+	CacheString	singleLineCommentStart;
+	CacheString	multiLineCommentStart;
+	CacheString	multiLineCommentEnd;
+	CacheString	rawStringStart;
+	CacheString	substitutionStart;
+	uint32_t	match;				// First CacheString
+	uint32_t	numMatch;
+	uint32_t	keyword;			// First CacheKeyword
+	uint32_t	numKeywords;
+	int32_t		flags;
+	uint8_t		classes[256];		// As in Syntax
+	uint16_t	first[256];
+	uint8_t		count[256];
+	} CacheLanguage;
+
+/*****************************************************************************\
+|* Split a line into whitespace-separated words
+\*****************************************************************************/
+static std::vector<std::string_view> split(std::string_view line)
+	{
+	std::vector<std::string_view> list;
+	size_t at = 0;
+	while (at < line.length())
+		{
+		while ((at < line.length()) && CharClass::isSpace(line[at]))
+			at ++;
+		size_t end = at;
+		while ((end < line.length()) && !CharClass::isSpace(line[end]))
+			end ++;
+		if (end > at)
+			list.push_back(line.substr(at, end - at));
+		at = end;
+		}
+	return list;
+	}
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+SyntaxCache::SyntaxCache()
+			:_directory("")
+			,_path("")
+			,_compiled(false)
+			,_data(nullptr)
+			,_size(0)
+			,_mapped(nullptr)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+SyntaxCache::~SyntaxCache()
+	{
+	clear();
+	}
+
+/*****************************************************************************\
+|* Load the definitions in a directory, from the cache if it's current
+\*****************************************************************************/
+int SyntaxCache::load(std::string directory)
+	{
+	clear();
+	_directory	= directory;
+	_path		= directory + "/" + CACHE_NAME;
+
+	std::vector<std::string> files;
+	uint64_t stamp = _stamp(files);
+	if (files.size() == 0)
+		return 0;
+
+	if (!_map(stamp))
+		{
+		_compile(files, stamp);
+		_save();
+		_attach(_built.data(), _built.size(), stamp);
+		_compiled = true;
+		}
+	return size();
+	}
+
+/*****************************************************************************\
+|* Forget everything
+\*****************************************************************************/
+void SyntaxCache::clear(void)
+	{
+	_syntaxes.clear();
+	_matches.clear();
+	_keywords.clear();
+	_built.clear();
+
+	if (_mapped != nullptr)
+		munmap(_mapped, _size);
+	_mapped		= nullptr;
+	_data		= nullptr;
+	_size		= 0;
+	_compiled	= false;
+	}
+
+/*****************************************************************************\
+|* The first language that matches the file
+\*****************************************************************************/
+const Syntax * SyntaxCache::find(std::string_view filename) const
+	{
+	for (const Syntax& syntax : _syntaxes)
+		if (syntax.matches(filename))
+			return &syntax;
+	return nullptr;
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* List the definitions, in name order, and hash their names, sizes and
+|* mtimes. That's a stat() each, but no reading
+\*****************************************************************************/
+uint64_t SyntaxCache::_stamp(std::vector<std::string>& files)
+	{
+	DIR *dir = opendir(_directory.c_str());
+	if (dir == nullptr)
+		return 0;
+
+	struct dirent *entry;
+	size_t suffix = strlen(SYNTAX_SUFFIX);
+	while ((entry = readdir(dir)) != nullptr)
+		{
+		std::string name = entry->d_name;
+		if ((name.length() > suffix) && (name[0] != '.')
+		 && (name.compare(name.length() - suffix, suffix, SYNTAX_SUFFIX) == 0))
+			files.push_back(_directory + "/" + name);
+		}
+	closedir(dir);
+	std::sort(files.begin(), files.end());
+
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void *data, size_t len)
+		{
+		const uint8_t *p = (const uint8_t *) data;
+		for (size_t i = 0; i < len; i++)
+			hash = (hash ^ p[i]) * 1099511628211ull;
+		};
+
+	for (std::string& file : files)
+		{
+		struct stat sb;
+		int64_t size	= -1;
+		int64_t mtime	= -1;
+		if (stat(file.c_str(), &sb) == 0)
+			{
+			size	= sb.st_size;
+			mtime	= sb.st_mtime;
+			}
+		mix(file.data(), file.length() + 1);
+		mix(&size, sizeof(size));
+		mix(&mtime, sizeof(mtime));
+		}
+	return hash;
+	}
+
+/*****************************************************************************\
+|* Parse the definitions and lay them out as the cache. Lines we don't
+|* understand and keywords that aren't words are skipped, as is a
+|* definition without any files to match
+\*****************************************************************************/
+void SyntaxCache::_compile(const std::vector<std::string>& files,
+						   uint64_t stamp)
+	{
+	std::vector<CacheLanguage> languages;
+	std::vector<CacheString> matches;
+	std::vector<CacheKeyword> keywords;
+	std::string text;
+
+	auto add = [&](std::string_view s)
+		{
+		CacheString str = {.offset = (uint32_t) text.length(),
+						   .length = (uint32_t) s.length()};
+		text.append(s);
+		return str;
+		};
+
+	for (const std::string& file : files)
+		{
+		FILE *fp = fopen(file.c_str(), "r");
+		if (fp == nullptr)
+			continue;
+
+		std::string data;
+		char buf[4096];
+		size_t got;
+		while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+			data.append(buf, got);
+		fclose(fp);
+
+		// Everything the Syntax views point at lives in 'data'
+		std::string_view filetype;
+		std::vector<std::string_view> match;
+		std::vector<Syntax::Keyword> listed;
+		Syntax s = {};
+
+		size_t from = 0;
+		while (from < data.length())
+			{
+			size_t nl = data.find('\n', from);
+			if (nl == std::string::npos)
+				nl = data.length();
+			std::string_view line(data.data() + from, nl - from);
+			from = nl + 1;
+
+			std::vector<std::string_view> w = split(line);
+			if ((w.size() < 2) || (w[0][0] == '#'))
+				continue;
+
+			if (w[0] == "filetype")
+				filetype = w[1];
+			else if (w[0] == "match")
+				match.insert(match.end(), w.begin() + 1, w.end());
+			else if (w[0] == "comment")
+				s.singleLineCommentStart = w[1];
+			else if ((w[0] == "multiline") && (w.size() >= 3))
+				{
+				s.multiLineCommentStart	= w[1];
+				s.multiLineCommentEnd	= w[2];
+				}
+			else if (w[0] == "sigils")
+				s.sigils = w[1];
+			else if (w[0] == "separators")
+				s.separators = w[1];
+			else if (w[0] == "rawstrings")
+				s.rawStringStart = w[1];
+			else if (w[0] == "substitution")
+				s.substitutionStart = w[1];
+			else if (w[0] == "highlight")
+				{
+				for (size_t i = 1; i < w.size(); i++)
+					if (w[i] == "numbers")
+						s.flags |= Syntax::HIGHLIGHT_NUMBERS;
+					else if (w[i] == "strings")
+						s.flags |= Syntax::HIGHLIGHT_STRINGS;
+					else if (w[i] == "heredocs")
+						s.flags |= Syntax::HIGHLIGHT_HEREDOCS;
+					else if (w[i] == "longstrings")
+						s.flags |= Syntax::HIGHLIGHT_LONG_STRINGS;
+				}
+			else if (w[0] == "keywords")
+				{
+				for (size_t i = 1; i < w.size(); i++)
+					listed.push_back(Syntax::parseKeyword(w[i]));
+				}
+			}
+
+		if (match.size() == 0)
+			continue;
+
+		// Keywords have to be words, which we only know once we have the
+		// separators
+		std::vector<Syntax::Keyword> words;
+		for (Syntax::Keyword& keyword : listed)
+			{
+			bool ok = (keyword.word.length() > 0);
+			for (char c : keyword.word)
+				ok = ok
+				  && !CharClass::isSeparator(c)
+				  && (s.separators.find(c) == std::string_view::npos);
+			if (ok)
+				words.push_back(keyword);
+			}
+
+		// Let Syntax work out the tables, as it would at compile time
+		if (filetype.length() == 0)
+			{
+			filetype = file;
+			filetype.remove_prefix(filetype.rfind('/') + 1);
+			filetype.remove_suffix(strlen(SYNTAX_SUFFIX));
+			}
+		Syntax::sortKeywords(words.data(), (int) words.size());
+		s.keywords		= words.data();
+		s.numKeywords	= (int) words.size();
+		s.index();
+		if (!s.valid())
+			continue;
+
+		CacheLanguage lang;
+		lang.filetype				= add(filetype);
+		lang.singleLineCommentStart	= add(s.singleLineCommentStart);
+		lang.multiLineCommentStart	= add(s.multiLineCommentStart);
+		lang.multiLineCommentEnd	= add(s.multiLineCommentEnd);
+		lang.rawStringStart			= add(s.rawStringStart);
+		lang.substitutionStart		= add(s.substitutionStart);
+		lang.match					= (uint32_t) matches.size();
+		lang.numMatch				= (uint32_t) match.size();
+		lang.keyword				= (uint32_t) keywords.size();
+		lang.numKeywords			= (uint32_t) words.size();
+		lang.flags					= s.flags;
+		memcpy(lang.classes, s.classes.data(), sizeof(lang.classes));
+		memcpy(lang.first, s.first.data(), sizeof(lang.first));
+		memcpy(lang.count, s.count.data(), sizeof(lang.count));
+		languages.push_back(lang);
+
+		for (std::string_view m : match)
+			matches.push_back(add(m));
+		for (Syntax::Keyword& k : words)
+			keywords.push_back({.word = add(k.word), .token = k.token});
+		}
+
+	// Pad the text out, so the whole thing stays a multiple of 4
+	text.resize((text.length() + 3) & ~(size_t)3, '\0');
+
+	CacheHeader hdr;
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.stamp		= stamp;
+	hdr.languages	= (uint32_t) languages.size();
+	hdr.matches		= (uint32_t) matches.size();
+	hdr.keywords	= (uint32_t) keywords.size();
+	hdr.textBytes	= (uint32_t) text.length();
+
+	auto put = [&](const void *data, size_t len)
+		{
+		const char *p = (const char *) data;
+		_built.insert(_built.end(), p, p + len);
+		};
+	_built.clear();
+	put(&hdr, sizeof(hdr));
+	put(languages.data(), languages.size() * sizeof(CacheLanguage));
+	put(matches.data(), matches.size() * sizeof(CacheString));
+	put(keywords.data(), keywords.size() * sizeof(CacheKeyword));
+	put(text.data(), text.length());
+	}
+
+/*****************************************************************************\
+|* Write the cache out, via a temporary so a reader never sees half of it.
+|* The directory may well not be ours to write to, which is fine
+\*****************************************************************************/
+void SyntaxCache::_save(void)
+	{
+	std::string tmp = _path + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (fp == nullptr)
+		return;
+
+	bool ok = (fwrite(_built.data(), 1, _built.size(), fp) == _built.size());
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || (rename(tmp.c_str(), _path.c_str()) != 0))
+		unlink(tmp.c_str());
+	}
+
+/*****************************************************************************\
+|* Map the cache in, if there's one for these definitions
+\*****************************************************************************/
+bool SyntaxCache::_map(uint64_t stamp)
+	{
+	int fd = ::open(_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat sb;
+	void *map = MAP_FAILED;
+	if ((fstat(fd, &sb) == 0) && (sb.st_size >= (off_t) sizeof(CacheHeader)))
+		map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (map == MAP_FAILED)
+		return false;
+
+	if (!_attach((const char *) map, sb.st_size, stamp))
+		{
+		munmap(map, sb.st_size);
+		return false;
+		}
+	_mapped = map;
+	return true;
+	}
+
+/*****************************************************************************\
+|* Check a cache over, since it came from disk, and point the Syntax
+|* entries into it
+\*****************************************************************************/
+bool SyntaxCache::_attach(const char *data, size_t size, uint64_t stamp)
+	{
+	const CacheHeader *hdr = (const CacheHeader *) data;
+	if ((size < sizeof(CacheHeader))
+	 || (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0)
+	 || (hdr->stamp != stamp))
+		return false;
+
+	size_t need = sizeof(CacheHeader)
+				+ (size_t) hdr->languages * sizeof(CacheLanguage)
+				+ (size_t) hdr->matches * sizeof(CacheString)
+				+ (size_t) hdr->keywords * sizeof(CacheKeyword)
+				+ (size_t) hdr->textBytes;
+	if (size != need)
+		return false;
+
+	auto languages = (const CacheLanguage *)(hdr + 1);
+	auto matches   = (const CacheString *)(languages + hdr->languages);
+	auto keywords  = (const CacheKeyword *)(matches + hdr->matches);
+	const char *text = (const char *)(keywords + hdr->keywords);
+
+	bool ok = true;
+	auto str = [&](const CacheString& s)
+		{
+		ok = ok && ((size_t) s.offset + s.length <= hdr->textBytes);
+		return ok ? std::string_view(text + s.offset, s.length)
+				  : std::string_view();
+		};
+
+	_matches.clear();
+	_keywords.clear();
+	_syntaxes.clear();
+	for (uint32_t i = 0; i < hdr->matches; i++)
+		_matches.push_back(str(matches[i]));
+	for (uint32_t i = 0; i < hdr->keywords; i++)
+		{
+		ok = ok && (keywords[i].token < Tokenizer::NUM_TOKENS);
+		_keywords.push_back({.word	= str(keywords[i].word),
+							 .token	= (uint8_t) keywords[i].token});
+		}
+
+	for (uint32_t i = 0; ok && (i < hdr->languages); i++)
+		{
+		const CacheLanguage& lang = languages[i];
+		ok = ((size_t) lang.match + lang.numMatch <= hdr->matches)
+		  && ((size_t) lang.keyword + lang.numKeywords <= hdr->keywords);
+		for (int c = 0; ok && (c < 256); c++)
+			ok = ((size_t) lang.first[c] + lang.count[c] <= lang.numKeywords)
+			  && (lang.classes[c] < Tokenizer::NUM_CLASSES);
+		if (!ok)
+			break;
+
+		Syntax s = {};
+		s.filetype					= str(lang.filetype);
+		s.filematch					= _matches.data() + lang.match;
+		s.numFilematch				= (int) lang.numMatch;
+		s.keywords					= _keywords.data() + lang.keyword;
+		s.numKeywords				= (int) lang.numKeywords;
+		s.singleLineCommentStart	= str(lang.singleLineCommentStart);
+		s.multiLineCommentStart		= str(lang.multiLineCommentStart);
+		s.multiLineCommentEnd		= str(lang.multiLineCommentEnd);
+		s.rawStringStart			= str(lang.rawStringStart);
+		s.substitutionStart			= str(lang.substitutionStart);
+		s.flags						= lang.flags;
+		memcpy(s.classes.data(), lang.classes, sizeof(lang.classes));
+		memcpy(s.first.data(), lang.first, sizeof(lang.first));
+		memcpy(s.count.data(), lang.count, sizeof(lang.count));
+		_syntaxes.push_back(s);
+		}
+
+	if (!ok)
+		{
+		_matches.clear();
+		_keywords.clear();
+		_syntaxes.clear();
+		return false;
+		}
+
+	_data = data;
+	_size = size;
+	return true;
+	}
@@ -0,0 +1,122 @@
+//
+//  SyntaxCache.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef SyntaxCache_h
+#define SyntaxCache_h
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "properties.h"
+#include "macros.h"
+#include "Syntax.h"
+
+/*****************************************************************************\
+|* Syntax definitions loaded from a directory of '.syntax' files, for
+|* languages that aren't built in. A definition is a few lines of text:
+|*
+|*     # Our log files
+|*     filetype   log
+|*     match      .log .out messages
+|*     keywords   ERROR! FATAL! WARN? true= false=
+|*     keywords   INFO DEBUG|
+|*     comment    #
+|*     multiline  (* *)
+|*     highlight  numbers strings
+|*     sigils     $
+|*     separators :{}
+|*
+|* and for languages with regions that nest or carry on over rows:
+|*
+|*     highlight     heredocs longstrings
+|*     rawstrings    R"
+|*     substitution  $(
+|*
+|* 'keywords' can be given more than once, and a keyword can be marked as
+|* another sort (a type, a constant, an error or a warning) as for the
+|* built-in languages (see Syntax.h). 'sigils' start a variable, and
+|* 'separators' end a word as well as the usual ones. 'heredocs' are
+|* <<WORD up to a row that's WORD, 'longstrings' go on past the end of a
+|* row, 'rawstrings' are R"delim(...)delim", and a 'substitution' is code
+|* inside a "string", up to the bracket that matches its last character.
+|*
+|* Parsing only happens the first time round. The definitions are compiled
+|* into the form Syntax wants (keywords sorted and indexed, character
+|* tables worked out) and written to a cache file in the directory. After
+|* that the cache is mapped in and the Syntax entries just point into it.
+|* The cache is keyed on the names, sizes and mtimes of the definitions, so
+|* changing any of them compiles it again. If the cache can't be written
+|* the compiled form is used from memory instead.
+\*****************************************************************************/
+class SyntaxCache
+	{
+    NON_COPYABLE_NOR_MOVEABLE(SyntaxCache)
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(std::string, directory);		// Where the definitions are
+    GET(std::string, path);				// ... and their compiled form
+    GET(bool, compiled);				// We compiled them this time
+
+    protected:
+		std::vector<char>			_built;		// Compiled here, if not mapped
+		const char *				_data;		// Built or mapped cache
+		size_t						_size;		// ... and its size
+		void *						_mapped;	// mmap()d cache, if any
+		std::vector<Syntax>			_syntaxes;	// Views onto _data
+		std::vector<std::string_view> _matches;	// ... their filematch lists
+		std::vector<Syntax::Keyword> _keywords;	// ... and keywords
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit SyntaxCache();
+        ~SyntaxCache();
+
+        /*********************************************************************\
+        |* Load the definitions in a directory. Returns how many there are
+        \*********************************************************************/
+		int load(std::string directory);
+		void clear(void);
+
+        /*********************************************************************\
+        |* The language for a file, if we have one
+        \*********************************************************************/
+		const Syntax * find(std::string_view filename) const;
+
+        /*********************************************************************\
+        |* What we've got
+        \*********************************************************************/
+		inline int size(void) const
+			{ return (int) _syntaxes.size(); }
+		inline const Syntax& at(int i) const
+			{ return _syntaxes[i]; }
+
+    private:
+        /*********************************************************************\
+        |* A key for the definitions as they are on disk
+        \*********************************************************************/
+		uint64_t _stamp(std::vector<std::string>& files);
+
+        /*********************************************************************\
+        |* Compile the definitions into _built, then save that
+        \*********************************************************************/
+		void _compile(const std::vector<std::string>& files, uint64_t stamp);
+		void _save(void);
+
+        /*********************************************************************\
+        |* Map the cache in, if it's current, and set up the Syntax views
+        \*********************************************************************/
+		bool _map(uint64_t stamp);
+		bool _attach(const char *data, size_t size, uint64_t stamp);
+	};
+
+#endif /* SyntaxCache_h */
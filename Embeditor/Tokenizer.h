@@ -0,0 +1,220 @@
+//
+//  Tokenizer.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Tokenizer_h
+#define Tokenizer_h
+
+#include <array>
+#include <cstdint>
+
+#include "CharClass.h"
+
+/*****************************************************************************\
+|* The state machine the highlighter runs. Each language maps every byte
+|* to a class (Syntax::classes), and one table, the same for every
+|* language, gives the step to take for each state and class: the state
+|* to go to, what to highlight the byte as, and whether there's more to do
+|* than that.
+|*
+|* Nearly every step is OP_ONE, which is a lookup and a compare. The rest
+|* are where a byte might be the start of something longer: a keyword (the
+|* whole word has to be looked up), an escape in a string (which takes the
+|* next byte with it), or a comment delimiter (which has to be compared).
+|* A byte that turns out not to open a comment is stepped again without
+|* OPENS, as what it otherwise is.
+|*
+|* The states are what the highlighter used to track in flags: whether the
+|* last byte was a separator (so a keyword or number can start), whether
+|* it was part of a number (so '.' carries on), which quote a string is
+|* in, and whether we're in a multi-line comment. There's one more, for a
+|* word started by a sigil ($VAR in shell, @decorator in Python), which is
+|* highlighted as a variable whatever it is.
+|*
+|* Keywords aren't all the same sort of thing, so each says what it's
+|* highlighted as: a keyword, a type, a constant (true, None), or in a log,
+|* an error or a warning.
+|*
+|* Regions that can nest or need a delimiter remembered (raw strings,
+|* heredocs, and $(substitutions) inside strings) are kept on a stack
+|* between rows (see LexerStates.h). The machine only has to say where one
+|* might start or end: NESTS marks bytes that might open or close a
+|* substitution, and S_RAW is a raw string, whose end is looked for
+|* directly
+\*****************************************************************************/
+class Tokenizer
+	{
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			S_SEPARATOR		= 0,		// After a separator, or at the start
+			S_WORD,						// In a word
+			S_NUMBER,					// In a number
+			S_SIGIL,					// In a $word
+			S_DQUOTE,					// In a "string"
+			S_SQUOTE,					// In a 'string'
+			S_COMMENT,					// In a multi-line comment
+			S_RAW,						// In a raw string
+			NUM_STATES
+			};
+
+		enum
+			{
+			K_SEPARATOR		= 0,		// Ends a word
+			K_TEXT,						// Part of a word
+			K_KEYWORD,					// ... that might start a keyword
+			K_DIGIT,					// Starts or continues a number
+			K_DOT,						// Continues a number
+			K_DQUOTE,					// Opens or closes a "string"
+			K_SQUOTE,					// Opens or closes a 'string'
+			K_SIGIL,					// Starts a $word
+			K_MASK			= 0x07,
+
+			ESCAPES			= (1<<3),	// Escapes the next byte in a string
+			OPENS			= (1<<4),	// Might open a comment, raw string...
+			CLOSES			= (1<<5),	// Might close a multi-line comment
+			NESTS			= (1<<6),	// Might open or close a substitution
+			NUM_CLASSES		= (1<<7)
+			};
+
+		enum
+			{
+			OP_ONE			= 0,		// Just this byte
+			OP_KEYWORD,					// Look the word up
+			OP_ESCAPE,					// This byte and the next
+			OP_OPEN,					// Compare with the openers
+			OP_CLOSE,					// Compare with the comment closer
+			OP_NEST						// Compare with the substitution
+			};
+
+		enum
+			{
+			TOKEN_TEXT		= 0,		// What the editor's HL_* are
+			TOKEN_COMMENT,
+			TOKEN_MLCOMMENT,
+			TOKEN_KEYWORD1,
+			TOKEN_KEYWORD2,
+			TOKEN_STRING,
+			TOKEN_NUMBER,
+			TOKEN_CONSTANT,
+			TOKEN_VARIABLE,
+			TOKEN_ERROR,
+			TOKEN_WARNING,
+			NUM_TOKENS
+			};
+
+		typedef struct Step
+			{
+			uint8_t			next;		// State to go to
+			uint8_t			op;			// OP_*
+			uint8_t			token;		// TOKEN_*
+			} Step;
+
+		typedef std::array<Step, (size_t) NUM_STATES * NUM_CLASSES> Table;
+
+    private:
+        /*********************************************************************\
+        |* Work out one step. The table is built from this at compile time
+        \*********************************************************************/
+		static constexpr Step _step(int state, int cls)
+			{
+			int kind = cls & K_MASK;
+
+			if (state == S_COMMENT)
+				return {S_COMMENT,
+						(uint8_t)((cls & CLOSES) ? OP_CLOSE : OP_ONE),
+						TOKEN_MLCOMMENT};
+
+			if (state == S_RAW)
+				return {S_RAW, OP_ONE, TOKEN_STRING};
+
+			// Only "strings" have substitutions in them
+			if ((state == S_DQUOTE) || (state == S_SQUOTE))
+				{
+				if (cls & ESCAPES)
+					return {(uint8_t) state, OP_ESCAPE, TOKEN_STRING};
+				if ((state == S_DQUOTE) && (cls & NESTS))
+					return {(uint8_t) state, OP_NEST, TOKEN_STRING};
+				bool closes = (state == S_DQUOTE) ? (kind == K_DQUOTE)
+												  : (kind == K_SQUOTE);
+				return {(uint8_t)(closes ? S_SEPARATOR : state),
+						OP_ONE,
+						TOKEN_STRING};
+				}
+
+			if (cls & OPENS)
+				return {(uint8_t) state, OP_OPEN, TOKEN_TEXT};
+			if (cls & NESTS)
+				return {(uint8_t) state, OP_NEST, TOKEN_TEXT};
+
+			// A sigil's word goes on until something that isn't a word
+			bool word = (kind == K_TEXT) || (kind == K_KEYWORD) || (kind == K_DIGIT);
+			if ((kind == K_SIGIL) || ((state == S_SIGIL) && word))
+				return {S_SIGIL, OP_ONE, TOKEN_VARIABLE};
+
+			switch (kind)
+				{
+				case K_DQUOTE:
+					return {S_DQUOTE, OP_ONE, TOKEN_STRING};
+				case K_SQUOTE:
+					return {S_SQUOTE, OP_ONE, TOKEN_STRING};
+				case K_DIGIT:
+					return (state == S_WORD)
+						 ? Step{S_WORD, OP_ONE, TOKEN_TEXT}
+						 : Step{S_NUMBER, OP_ONE, TOKEN_NUMBER};
+				case K_DOT:
+					return (state == S_NUMBER)
+						 ? Step{S_NUMBER, OP_ONE, TOKEN_NUMBER}
+						 : Step{S_SEPARATOR, OP_ONE, TOKEN_TEXT};
+				case K_KEYWORD:
+					return {S_WORD,
+							(uint8_t)((state == S_SEPARATOR) ? OP_KEYWORD : OP_ONE),
+							TOKEN_TEXT};
+				case K_TEXT:
+					return {S_WORD, OP_ONE, TOKEN_TEXT};
+				default:
+					return {S_SEPARATOR, OP_ONE, TOKEN_TEXT};
+				}
+			}
+
+		static constexpr Table _table(void)
+			{
+			Table t = {};
+			for (int state = 0; state < NUM_STATES; state++)
+				for (int cls = 0; cls < NUM_CLASSES; cls++)
+					t[state * NUM_CLASSES + cls] = _step(state, cls);
+			return t;
+			}
+
+    public:
+		static const Table table;
+
+        /*********************************************************************\
+        |* The step for a byte of class 'cls' in 'state'
+        \*********************************************************************/
+		static constexpr Step step(int state, int cls)
+			{
+			return table[state * NUM_CLASSES + cls];
+			}
+
+        /*********************************************************************\
+        |* Does a byte of class 'cls' end a word (and so a keyword)
+        \*********************************************************************/
+		static constexpr bool endsWord(int cls)
+			{
+			return ((cls & K_MASK) == K_SEPARATOR) || ((cls & K_MASK) == K_DOT);
+			}
+	};
+
+inline constexpr Tokenizer::Table Tokenizer::table = Tokenizer::_table();
+
+// K_DOT leaves a number as a separator would, so '.' had better be one
+static_assert(CharClass::isSeparator('.'), "'.' should be a separator");
+
+#endif /* Tokenizer_h */
@@ -0,0 +1,434 @@
+//
+//  TrigramIndex.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TrigramIndex.h"
+
+#define SIGNATURE_SHIFT		13
+#define SIGNATURE_WORDS		(SIGNATURE_BITS / 64)
+#define SIDECAR_MAGIC		"EDTGI001"
+
+/*****************************************************************************\
+|* On-disk layout of the sidecar: this header then the block signatures
+\*****************************************************************************/
+typedef struct SidecarHeader
+	{
+	char		magic[8];
+	uint32_t	blockRows;
+	uint32_t	signatureBits;
+	int64_t		size;
+	int64_t		mtime;
+	int64_t		rows;
+	int64_t		blocks;
+	} SidecarHeader;
+
+/*****************************************************************************\
+|* Bit for a trigram. Case is folded, so the index serves case-insensitive
+|* searches too
+\*****************************************************************************/
+static inline uint8_t fold(uint8_t c)
+	{
+	return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+	}
+
+static inline int trigramBit(const uint8_t *s)
+	{
+	uint32_t t = (fold(s[0]) << 16) | (fold(s[1]) << 8) | fold(s[2]);
+	return (int)((t * 2654435761u) >> (32 - SIGNATURE_SHIFT));
+	}
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+TrigramIndex::TrigramIndex()
+			 :_filename("")
+			 ,_sidecar("")
+			 ,_numRows(0)
+			 ,_numBlocks(0)
+			 ,_valid(false)
+			 ,_ready(false)
+			 ,_cancel(false)
+			 ,_signatures(nullptr)
+			 ,_mapped(nullptr)
+			 ,_mappedLen(0)
+			 ,_lastBlock(-1)
+			 ,_lastResult(true)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+TrigramIndex::~TrigramIndex()
+	{
+	clear();
+	}
+
+/*****************************************************************************\
+|* Index a file. If there's a sidecar for this version of the file, it's
+|* mapped in and the index is ready immediately, otherwise a worker thread
+|* builds it
+\*****************************************************************************/
+void TrigramIndex::build(std::string filename, int numRows)
+	{
+	clear();
+
+	struct stat sb;
+	if (stat(filename.c_str(), &sb) != 0)
+		return;
+
+	_filename	= filename;
+	_numRows	= numRows;
+	_numBlocks	= (numRows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+	_valid		= true;
+	_stale.assign(_numBlocks, false);
+	_runs.assign(1, {.row = 0, .original = 0});
+
+	std::size_t slash = filename.rfind('/');
+	if (slash == std::string::npos)
+		_sidecar = "." + filename + ".tgi";
+	else
+		_sidecar = filename.substr(0, slash + 1)
+				 + "." + filename.substr(slash + 1) + ".tgi";
+
+	if (!_load(sb.st_size, sb.st_mtime))
+		_worker = std::thread(&TrigramIndex::_build,
+							  this,
+							  (int64_t)sb.st_size,
+							  (int64_t)sb.st_mtime);
+	}
+
+/*****************************************************************************\
+|* Drop the index, stopping any build in progress
+\*****************************************************************************/
+void TrigramIndex::clear(void)
+	{
+	if (_worker.joinable())
+		{
+		_cancel = true;
+		_worker.join();
+		}
+	_cancel = false;
+	_ready  = false;
+	_valid  = false;
+
+	if (_mapped != nullptr)
+		{
+		munmap(_mapped, _mappedLen);
+		_mapped 	= nullptr;
+		_mappedLen	= 0;
+		}
+
+	_built.clear();
+	_runs.clear();
+	_stale.clear();
+	_signatures = nullptr;
+	_lastBlock	= -1;
+	}
+
+/*****************************************************************************\
+|* Is the index usable yet
+\*****************************************************************************/
+bool TrigramIndex::ready(void)
+	{
+	return _valid && _ready.load(std::memory_order_acquire);
+	}
+
+/*****************************************************************************\
+|* A row has been edited: its block has to be searched from now on
+\*****************************************************************************/
+void TrigramIndex::rowChanged(int row)
+	{
+	if (!_valid)
+		return;
+
+	int original = _originalRow(row);
+	if ((original >= 0) && (original < _numRows))
+		_stale[original / BLOCK_ROWS] = true;
+	_lastBlock = -1;
+	}
+
+/*****************************************************************************\
+|* A row has been inserted: it's a run of one that wasn't indexed, unless
+|* it can join one next to it, and everything after it moves down
+\*****************************************************************************/
+void TrigramIndex::rowInserted(int at)
+	{
+	if (!_valid)
+		return;
+
+	int run = _split(at);
+	_runs.insert(_runs.begin() + run, {.row = at, .original = -1});
+	_shift(run + 1, 1);
+	_merge(run + 1);
+	_merge(run);
+	_lastBlock = -1;
+	}
+
+/*****************************************************************************\
+|* A row has been deleted: it's cut out of its run, and everything after it
+|* moves up
+\*****************************************************************************/
+void TrigramIndex::rowDeleted(int at)
+	{
+	if (!_valid)
+		return;
+
+	int run = _split(at);
+	_split(at + 1);
+	_runs.erase(_runs.begin() + run);
+	_shift(run, -1);
+	_merge(run);
+	_lastBlock = -1;
+	}
+
+/*****************************************************************************\
+|* Set the query to test rows against. Queries shorter than a trigram can't
+|* use the index, so every row is a candidate for them
+\*****************************************************************************/
+void TrigramIndex::setQuery(const std::string& query)
+	{
+	_query.clear();
+	_lastBlock = -1;
+
+	const uint8_t *q = (const uint8_t *) query.data();
+	for (int i = 0; i + 3 <= (int) query.length(); i++)
+		_query.push_back(trigramBit(q + i));
+
+	std::sort(_query.begin(), _query.end());
+	_query.erase(std::unique(_query.begin(), _query.end()), _query.end());
+	}
+
+/*****************************************************************************\
+|* Could this row contain the query. Rows are tested in runs, so the answer
+|* for the last block is kept
+\*****************************************************************************/
+bool TrigramIndex::mayContain(int row)
+	{
+	if ((_query.size() == 0) || !ready())
+		return true;
+
+	int original = _originalRow(row);
+	if ((original < 0) || (original >= _numRows))
+		return true;
+
+	int block = original / BLOCK_ROWS;
+	if (block == _lastBlock)
+		return _lastResult;
+
+	bool result = _stale[block];
+	if (!result)
+		{
+		const uint64_t *sig = _signatures + (size_t)block * SIGNATURE_WORDS;
+
+		result = true;
+		for (int bit : _query)
+			if ((sig[bit >> 6] & (1ULL << (bit & 63))) == 0)
+				{
+				result = false;
+				break;
+				}
+		}
+
+	_lastBlock	= block;
+	_lastResult = result;
+	return result;
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* Build the signatures. Rows are split exactly as Editor::open() splits them
+|* so the row numbers line up
+\*****************************************************************************/
+void TrigramIndex::_build(int64_t size, int64_t mtime)
+	{
+	FILE *fp = fopen(_filename.c_str(), "r");
+	if (fp == nullptr)
+		return;
+
+	std::vector<uint64_t> sigs((size_t)_numBlocks * SIGNATURE_WORDS, 0);
+
+	char *line		= nullptr;
+	size_t lineCap	= 0;
+	ssize_t lineLen;
+	int row			= 0;
+
+	while ((lineLen = getline(&line, &lineCap, fp)) != -1)
+		{
+		if ((row >= _numRows) || _cancel)
+			break;
+
+		uint64_t *sig 		= sigs.data()
+							+ (size_t)(row / BLOCK_ROWS) * SIGNATURE_WORDS;
+		const uint8_t *s	= (const uint8_t *)line;
+		for (ssize_t i = 0; i + 3 <= lineLen; i++)
+			{
+			int bit = trigramBit(s + i);
+			sig[bit >> 6] |= (1ULL << (bit & 63));
+			}
+		row ++;
+		}
+	FREE(line);
+	fclose(fp);
+
+	// Don't publish anything if the file changed underneath us
+	if (_cancel || (row != _numRows))
+		return;
+
+	_built		= std::move(sigs);
+	_signatures = _built.data();
+	_ready.store(true, std::memory_order_release);
+
+	_save(size, mtime);
+	}
+
+/*****************************************************************************\
+|* Map in the sidecar, if it describes this version of the file
+\*****************************************************************************/
+bool TrigramIndex::_load(int64_t size, int64_t mtime)
+	{
+	int fd = ::open(_sidecar.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat sb;
+	SidecarHeader hdr;
+
+	size_t sigBytes = (size_t)_numBlocks * SIGNATURE_WORDS * sizeof(uint64_t);
+	bool ok = (fstat(fd, &sb) == 0)
+		   && (sb.st_size == (off_t)(sizeof(hdr) + sigBytes))
+		   && (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr))
+		   && (memcmp(hdr.magic, SIDECAR_MAGIC, sizeof(hdr.magic)) == 0)
+		   && (hdr.blockRows == BLOCK_ROWS)
+		   && (hdr.signatureBits == SIGNATURE_BITS)
+		   && (hdr.size == size)
+		   && (hdr.mtime == mtime)
+		   && (hdr.rows == _numRows)
+		   && (hdr.blocks == _numBlocks);
+
+	if (ok)
+		{
+		void *map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+			ok = false;
+		else
+			{
+			_mapped		= map;
+			_mappedLen	= sb.st_size;
+			_signatures	= (const uint64_t *)((char *)map + sizeof(hdr));
+			_ready.store(true, std::memory_order_release);
+			}
+		}
+
+	::close(fd);
+	return ok;
+	}
+
+/*****************************************************************************\
+|* Write the sidecar out, via a temporary so a reader never sees half of it
+\*****************************************************************************/
+void TrigramIndex::_save(int64_t size, int64_t mtime)
+	{
+	SidecarHeader hdr;
+	memcpy(hdr.magic, SIDECAR_MAGIC, sizeof(hdr.magic));
+	hdr.blockRows		= BLOCK_ROWS;
+	hdr.signatureBits	= SIGNATURE_BITS;
+	hdr.size			= size;
+	hdr.mtime			= mtime;
+	hdr.rows			= _numRows;
+	hdr.blocks			= _numBlocks;
+
+	std::string tmp = _sidecar + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (fp == nullptr)
+		return;
+
+	bool ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1)
+		   && (fwrite(_built.data(), sizeof(uint64_t), _built.size(), fp)
+				== _built.size());
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || (rename(tmp.c_str(), _sidecar.c_str()) != 0))
+		unlink(tmp.c_str());
+	}
+
+/*****************************************************************************\
+|* Find where a row was when it was indexed, from the run it's in. Returns
+|* -1 for inserted rows
+\*****************************************************************************/
+int TrigramIndex::_originalRow(int row)
+	{
+	if (_runs.size() == 0)
+		return row;
+
+	const Run& run = _runs[_run(row)];
+	return (run.original < 0) ? -1 : run.original + (row - run.row);
+	}
+
+/*****************************************************************************\
+|* The run a row is in. The first run starts at row 0 and the last goes on
+|* forever, so there always is one
+\*****************************************************************************/
+int TrigramIndex::_run(int row)
+	{
+	auto found = std::upper_bound(_runs.begin(),
+								  _runs.end(),
+								  row,
+		[](int row, const Run& run) { return row < run.row; }) - 1;
+	return (int)(found - _runs.begin());
+	}
+
+/*****************************************************************************\
+|* Make sure a run starts at 'row', splitting the one it's in if need be,
+|* and return it
+\*****************************************************************************/
+int TrigramIndex::_split(int row)
+	{
+	int run		 = _run(row);
+	Run& in		 = _runs[run];
+	if (in.row == row)
+		return run;
+
+	int original = (in.original < 0) ? -1 : in.original + (row - in.row);
+	_runs.insert(_runs.begin() + run + 1, {.row = row, .original = original});
+	return run + 1;
+	}
+
+/*****************************************************************************\
+|* Move the runs from 'from' on by 'delta' rows
+\*****************************************************************************/
+void TrigramIndex::_shift(int from, int delta)
+	{
+	for (int i = from; i < (int) _runs.size(); i++)
+		_runs[i].row += delta;
+	}
+
+/*****************************************************************************\
+|* Join a run to the one before it if it carries straight on from it, or
+|* both are of inserted rows
+\*****************************************************************************/
+void TrigramIndex::_merge(int run)
+	{
+	if ((run <= 0) || (run >= (int) _runs.size()))
+		return;
+
+	const Run& prev = _runs[run - 1];
+	const Run& next = _runs[run];
+	bool joins		= (prev.original < 0)
+					? (next.original < 0)
+					: (next.original == prev.original + (next.row - prev.row));
+	if (joins)
+		_runs.erase(_runs.begin() + run);
+	}
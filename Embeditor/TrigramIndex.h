@@ -0,0 +1,133 @@
+//
+//  TrigramIndex.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef TrigramIndex_h
+#define TrigramIndex_h
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "properties.h"
+#include "macros.h"
+
+/*****************************************************************************\
+|* A coarse trigram index over the rows of a file, to let repeated searches of
+|* large read-mostly files skip straight to the rows that might match.
+|*
+|* Rows are grouped into blocks of BLOCK_ROWS, and each block gets a bitmap of
+|* SIGNATURE_BITS bits with one bit set per (hashed, case-folded) trigram in
+|* any of its rows. A query can only match in a block with all of the query's
+|* trigram bits set, so anything else can be skipped without looking at it.
+|*
+|* The index is built on a worker thread from the file on disk, and persisted
+|* to a sidecar file keyed on the file's size and mtime, so reopening the file
+|* just maps the sidecar back in. Edits made after the index was built are
+|* tracked here rather than folded into the index: changed blocks are always
+|* candidates, and inserted/deleted rows are mapped back to their original
+|* row numbers through runs of rows that have moved together.
+\*****************************************************************************/
+class TrigramIndex
+	{
+    NON_COPYABLE_NOR_MOVEABLE(TrigramIndex)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			BLOCK_ROWS		= 64,			// Rows summarised per block
+			SIGNATURE_BITS	= 8192			// Bits in each block signature
+			};
+
+		typedef struct Run
+			{
+			int						row;		// First row of the run now
+			int						original;	// ... and when indexed, or -1
+			} Run;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(std::string, filename);			// File we're indexing
+    GET(std::string, sidecar);			// Where we persist the index
+    GET(int, numRows);					// Rows in the file when indexed
+    GET(int, numBlocks);				// Number of blocks in the index
+    GET(bool, valid);					// There's a file being indexed
+
+    protected:
+		std::atomic<bool>		_ready;			// Signatures can be read
+		std::atomic<bool>		_cancel;		// Ask the worker to stop
+		std::thread				_worker;		// Background builder
+		std::vector<uint64_t>	_built;			// Signatures we built
+		const uint64_t *		_signatures;	// Built or mapped signatures
+		void *					_mapped;		// mmap()d sidecar, if any
+		size_t					_mappedLen;		// ... and its length
+		std::vector<Run>		_runs;			// Rows moved since, in order
+		std::vector<bool>		_stale;			// Blocks edited since
+		std::vector<int>		_query;			// Bits for the current query
+		int						_lastBlock;		// Cached candidate block
+		bool					_lastResult;	// ... and whether it matched
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit TrigramIndex();
+        ~TrigramIndex();
+
+        /*********************************************************************\
+        |* Index a file: map in a matching sidecar, or build in the background
+        \*********************************************************************/
+        void build(std::string filename, int numRows);
+		void clear(void);
+
+        /*********************************************************************\
+        |* Is the index usable yet
+        \*********************************************************************/
+		bool ready(void);
+
+        /*********************************************************************\
+        |* Track edits to the rows since the index was built
+        \*********************************************************************/
+		void rowChanged(int row);
+		void rowInserted(int at);
+		void rowDeleted(int at);
+
+        /*********************************************************************\
+        |* Set the query, then ask whether a row could possibly match it
+        \*********************************************************************/
+		void setQuery(const std::string& query);
+		bool mayContain(int row);
+
+    private:
+        /*********************************************************************\
+        |* Build the signatures (runs on the worker thread)
+        \*********************************************************************/
+		void _build(int64_t size, int64_t mtime);
+
+        /*********************************************************************\
+        |* Load or save the sidecar
+        \*********************************************************************/
+		bool _load(int64_t size, int64_t mtime);
+		void _save(int64_t size, int64_t mtime);
+
+        /*********************************************************************\
+        |* Map a current row number back to the row number in the index, and
+        |* keep the runs that do it up to date
+        \*********************************************************************/
+		int _originalRow(int row);
+		int _run(int row);
+		int _split(int row);
+		void _shift(int from, int delta);
+		void _merge(int run);
+	};
+
+#endif /* TrigramIndex_h */
@@ -0,0 +1,182 @@
+//
+//  Utf8.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef Utf8_h
+#define Utf8_h
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*****************************************************************************\
+|* Decoding UTF-8, and how many columns a terminal gives what's decoded.
+|* Widths come from a table built from the Unicode data at compile time,
+|* rather than wcwidth(), which depends on the locale and is slow.
+|*
+|* The table is two levels: the top bits of a code point pick a block of
+|* 256, and the block has 2 bits a code point. Most blocks are all one
+|* width, so they're shared, and the whole thing is about 14KB.
+|*
+|* What the editor moves over is a grapheme, which is near enough a code
+|* point and the marks that combine with it. The full rules (UAX #29) are
+|* more than an editor needs: here a grapheme is a code point, anything of
+|* no width after it, anything joined to it by a zero width joiner, and
+|* a pair of regional indicators (a flag).
+|*
+|* Not every file is UTF-8, so when one's loaded detect() decides what it
+|* is, a vector at a time: UTF-8 if it all decodes, Latin-1 (which the
+|* editor holds as UTF-8, and turns back when it's saved) if it doesn't,
+|* and binary if it has a NUL in it
+\*****************************************************************************/
+class Utf8
+	{
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			INVALID			= 0xFFFFFFFF,	// Not a code point
+			ZWJ				= 0x200D,		// Zero width joiner
+			FLAG_FIRST		= 0x1F1E6,		// Regional indicators
+			FLAG_LAST		= 0x1F1FF,
+			MAX_CODE_POINT	= 0x10FFFF
+			};
+
+		enum
+			{
+			ENC_UTF8		= 0,			// As it is
+			ENC_LATIN1,						// A byte a code point
+			ENC_BINARY						// Not text at all
+			};
+
+		enum
+			{
+			BOM_BYTES		= 3				// A UTF-8 byte order mark
+			};
+
+		enum
+			{
+			BLOCK_BITS		= 8,			// Code points a block is 256
+			BLOCK_BYTES		= (1 << BLOCK_BITS) / 4,
+			NUM_BLOCKS		= (MAX_CODE_POINT >> BLOCK_BITS) + 1,
+			MAX_BLOCKS		= 160			// Distinct blocks we can have
+			};
+
+		typedef struct Widths
+			{
+			std::array<uint8_t, NUM_BLOCKS>					blocks;
+			std::array<uint8_t, MAX_BLOCKS * BLOCK_BYTES>	widths;
+			int												count;
+			} Widths;
+
+    private:
+		static const Widths _table;
+
+    public:
+        /*********************************************************************\
+        |* Decode the code point at 's', which has 'len' bytes left. Returns
+        |* the bytes it took, and INVALID (taking one byte) if it isn't good
+        |* UTF-8: a stray continuation byte, a truncated or overlong sequence,
+        |* or a surrogate
+        \*********************************************************************/
+		static inline int decode(const char *s, size_t len, uint32_t *cp)
+			{
+			const uint8_t *p = (const uint8_t *) s;
+			uint8_t c		 = p[0];
+			*cp				 = c;
+			if (c < 0x80)
+				return 1;
+
+			int more;
+			uint32_t min;
+			if ((c & 0xE0) == 0xC0)
+				{ more = 1; min = 0x80; *cp = c & 0x1F; }
+			else if ((c & 0xF0) == 0xE0)
+				{ more = 2; min = 0x800; *cp = c & 0x0F; }
+			else if ((c & 0xF8) == 0xF0)
+				{ more = 3; min = 0x10000; *cp = c & 0x07; }
+			else
+				{ *cp = INVALID; return 1; }
+
+			if ((size_t) more >= len)
+				{ *cp = INVALID; return 1; }
+			for (int i = 1; i <= more; i++)
+				{
+				if ((p[i] & 0xC0) != 0x80)
+					{ *cp = INVALID; return 1; }
+				*cp = (*cp << 6) | (p[i] & 0x3F);
+				}
+
+			if ((*cp < min) || (*cp > MAX_CODE_POINT)
+			 || ((*cp >= 0xD800) && (*cp <= 0xDFFF)))
+				{ *cp = INVALID; return 1; }
+			return more + 1;
+			}
+
+        /*********************************************************************\
+        |* Columns a code point takes: 0 for marks that combine with what's
+        |* before them (and format characters), 2 for wide (East Asian) ones,
+        |* and otherwise 1
+        \*********************************************************************/
+		static inline int width(uint32_t cp)
+			{
+			if (cp > MAX_CODE_POINT)
+				return 1;
+			int block = _table.blocks[cp >> BLOCK_BITS];
+			int at	  = (cp & ((1 << BLOCK_BITS) - 1));
+			uint8_t b = _table.widths[block * BLOCK_BYTES + (at >> 2)];
+			return (b >> ((at & 3) * 2)) & 3;
+			}
+
+        /*********************************************************************\
+        |* Is this shown as a symbol rather than sent to the terminal: it's
+        |* a control character (C0, DEL or C1), or bad UTF-8
+        \*********************************************************************/
+		static inline bool isControl(uint32_t cp)
+			{
+			return (cp < 0x20) || ((cp >= 0x7F) && (cp < 0xA0)) || (cp == INVALID);
+			}
+
+        /*********************************************************************\
+        |* The grapheme at 's', which has 'len' bytes left. Returns the bytes
+        |* it takes, and sets 'columns' to how many columns it's drawn in. A
+        |* control character or bad byte is drawn as one column, on its own
+        \*********************************************************************/
+		static int grapheme(const char *s, size_t len, int *columns);
+
+        /*********************************************************************\
+        |* How many bytes at the start of 'src' are ASCII other than tab,
+        |* each of which is drawn in one column (control characters too, as
+        |* a symbol)
+        \*********************************************************************/
+		static size_t plain(const char *src, size_t len);
+
+        /*********************************************************************\
+        |* What a file is, ENC_*. A UTF-8 byte order mark is taken as UTF-8,
+        |* and 'bom' set to the bytes of it to skip. UTF-16 and UTF-32 aren't
+        |* edited, so their marks say it's binary (it'll be full of NULs)
+        \*********************************************************************/
+		static int detect(const char *src, size_t len, size_t *bom);
+
+        /*********************************************************************\
+        |* Latin-1 to UTF-8, into 'dst', which has room for 'len' bytes and
+        |* latin1Growth() more. Returns the bytes written
+        \*********************************************************************/
+		static size_t latin1Growth(const char *src, size_t len);
+		static size_t fromLatin1(const char *src, size_t len, char *dst);
+
+        /*********************************************************************\
+        |* UTF-8 to Latin-1. Anything Latin-1 doesn't have becomes '?', and
+        |* then it returns false
+        \*********************************************************************/
+		static bool toLatin1(std::string_view text, std::string& out);
+	};
+
+#endif /* Utf8_h */
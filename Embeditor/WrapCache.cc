@@ -0,0 +1,355 @@
+//
+//  WrapCache.cc
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#include <algorithm>
+
+#include "Utf8.h"
+#include "WrapCache.h"
+
+/*****************************************************************************\
+|* Constructor
+\*****************************************************************************/
+WrapCache::WrapCache()
+		  :_width(80)
+		  ,_tabStop(4)
+		  ,_layouts(CACHE_ROWS, {.row		= -1,
+								 .lines		= 0,
+								 .complete	= false,
+								 .breaks	= BreakList()})
+		  ,_any(false)
+	{}
+
+/*****************************************************************************\
+|* Destructor
+\*****************************************************************************/
+WrapCache::~WrapCache()
+	{}
+
+/*****************************************************************************\
+|* Use a different allocator. Containers keep the allocator they're made
+|* with, so they're made again
+\*****************************************************************************/
+void WrapCache::setAllocator(Allocator *allocator)
+	{
+	for (Layout& layout : _layouts)
+		{
+		layout.row		= -1;
+		layout.breaks	= BreakList(StlAllocator<Break>(allocator));
+		}
+	_any = false;
+	}
+
+/*****************************************************************************\
+|* Set the width and tab stops, forgetting everything if they've changed
+\*****************************************************************************/
+void WrapCache::setLayout(int width, int tabStop)
+	{
+	width	= MAX(width, 1);
+	tabStop	= MAX(tabStop, 1);
+	if ((width != _width) || (tabStop != _tabStop))
+		{
+		_width	 = width;
+		_tabStop = tabStop;
+		forget();
+		}
+	}
+
+/*****************************************************************************\
+|* Forget the rows from 'from' on
+\*****************************************************************************/
+void WrapCache::forget(int from)
+	{
+	if (!_any)
+		return;
+
+	for (Layout& layout : _layouts)
+		if (layout.row >= from)
+			layout.row = -1;
+	_any = (from > 0);
+	}
+
+/*****************************************************************************\
+|* Forget everything, and give back the memory
+\*****************************************************************************/
+void WrapCache::clear(void)
+	{
+	for (Layout& layout : _layouts)
+		{
+		layout.row = -1;
+		BreakList(layout.breaks.get_allocator()).swap(layout.breaks);
+		}
+	_any = false;
+	}
+
+/*****************************************************************************\
+|* Text has been inserted or deleted at column 'cx'. Lines that start before
+|* it are where they were, since nothing before them has changed, but the
+|* line it's in may now end somewhere else, and so may every one after
+\*****************************************************************************/
+void WrapCache::edited(int row, int cx)
+	{
+	Layout& layout = _layouts[row % CACHE_ROWS];
+	if (layout.row != row)
+		return;
+
+	int keep = 1;
+	if (cx > 0)
+		{
+		auto found = std::upper_bound(layout.breaks.begin(),
+									  layout.breaks.end(),
+									  cx - 1,
+			[](int cx, const Break& b) { return cx < b.cx; }) - 1;
+		int next = (found + 1 != layout.breaks.end()) ? (found + 1)->line
+													  : layout.lines;
+		keep = MIN(found->line + (cx - 1 - found->cx) / _width, next - 1) + 1;
+		}
+
+	layout.breaks.erase(std::partition_point(layout.breaks.begin(),
+											 layout.breaks.end(),
+		[&](const Break& b) { return b.line < keep; }), layout.breaks.end());
+	layout.lines	= keep;
+	layout.complete	= false;
+	}
+
+/*****************************************************************************\
+|* The line column 'cx' is on. It's on the last line that starts at or
+|* before it, which is either a break or a multiple of 'width' on from one
+\*****************************************************************************/
+int WrapCache::line(int row, std::string_view text, int cx)
+	{
+	Layout& layout = _layout(row);
+	_measure(layout, text, cx, 0);
+
+	auto found = std::upper_bound(layout.breaks.begin(),
+								  layout.breaks.end(),
+								  cx,
+		[](int cx, const Break& b) { return cx < b.cx; }) - 1;
+	int next = (found + 1 != layout.breaks.end()) ? (found + 1)->line
+												  : layout.lines;
+	return MIN(found->line + (cx - found->cx) / _width, next - 1);
+	}
+
+/*****************************************************************************\
+|* Where a line starts
+\*****************************************************************************/
+int WrapCache::start(int row, std::string_view text, int line)
+	{
+	if (line < 0)
+		return -1;
+
+	Layout& layout = _layout(row);
+	_measure(layout, text, -1, line);
+	return (line < layout.lines) ? _start(layout, line) : -1;
+	}
+
+/*****************************************************************************\
+|* How many lines a row takes, up to 'most'
+\*****************************************************************************/
+int WrapCache::lines(int row, std::string_view text, int most)
+	{
+	if (most <= 0)
+		return 0;
+
+	Layout& layout = _layout(row);
+	_measure(layout, text, -1, most - 1);
+	return MIN(layout.lines, most);
+	}
+
+/*****************************************************************************\
+|* The screen column 'cx' is at, from the start of its line
+\*****************************************************************************/
+int WrapCache::column(int row, std::string_view text, int cx)
+	{
+	int at	= start(row, text, line(row, text, cx));
+	int col	= 0;
+	while (at < cx)
+		{
+		int width;
+		int bytes = _step(text, at, col, &width);
+		if (at + bytes > cx)
+			break;
+		at	+= bytes;
+		col += width;
+		}
+	return col;
+	}
+
+/*****************************************************************************\
+|* The grapheme at screen column 'rx' of a line. The cursor can't go past
+|* the last grapheme of a line that isn't the row's last, since the column
+|* after that is the start of the next line
+\*****************************************************************************/
+int WrapCache::cx(int row, std::string_view text, int line, int rx)
+	{
+	int at	 = start(row, text, line);
+	int end	 = start(row, text, line + 1);
+	bool last = (end < 0);
+	if (at < 0)
+		return (int) text.length();
+	if (last)
+		end = (int) text.length();
+
+	int col = 0;
+	while (at < end)
+		{
+		int width;
+		int bytes = _step(text, at, col, &width);
+		if ((col + width > rx) || (!last && (at + bytes >= end)))
+			break;
+		at	+= bytes;
+		col += width;
+		}
+	return at;
+	}
+
+/*****************************************************************************\
+|* The grapheme 'cx' is part of. Lines start at the start of a grapheme, so
+|* it's found by stepping along the line
+\*****************************************************************************/
+int WrapCache::snap(int row, std::string_view text, int cx)
+	{
+	int at = start(row, text, line(row, text, cx));
+	while (at < cx)
+		{
+		int width;
+		int bytes = _step(text, at, 0, &width);
+		if (at + bytes > cx)
+			break;
+		at += bytes;
+		}
+	return at;
+	}
+
+/*****************************************************************************\
+|* The grapheme before 'cx'
+\*****************************************************************************/
+int WrapCache::prev(int row, std::string_view text, int cx)
+	{
+	return (cx <= 0) ? 0 : snap(row, text, cx - 1);
+	}
+
+/*****************************************************************************\
+|* The grapheme after the one at 'cx'
+\*****************************************************************************/
+int WrapCache::next(int row, std::string_view text, int cx)
+	{
+	int len = (int) text.length();
+	int at	= snap(row, text, MIN(cx, len));
+	if (at >= len)
+		return len;
+
+	int width;
+	return MIN(at + _step(text, at, 0, &width), len);
+	}
+
+#pragma mark - Private methods
+
+/*****************************************************************************\
+|* The layout of a row, which is started afresh if it isn't the one cached
+\*****************************************************************************/
+WrapCache::Layout& WrapCache::_layout(int row)
+	{
+	Layout& layout = _layouts[row % CACHE_ROWS];
+	if (layout.row != row)
+		{
+		layout.row		= row;
+		layout.lines	= 1;
+		layout.complete	= false;
+		layout.breaks.clear();
+		layout.breaks.push_back({.line = 0, .cx = 0});
+		_any = true;
+		}
+	return layout;
+	}
+
+/*****************************************************************************\
+|* Lay out more of a row, from the start of the last line found, until
+|* we've found 'line', and the line 'cx' is on (which is known once we're
+|* past it). Plain ASCII is a column a byte, so it's skipped a vector at a
+|* time, a line's worth at most, and only tabs and anything that isn't
+|* ASCII are looked at
+\*****************************************************************************/
+void WrapCache::_measure(Layout& layout, std::string_view text, int cx, int line)
+	{
+	const char *chars = text.data();
+	int len			  = (int) text.length();
+	int at			  = _start(layout, layout.lines - 1);
+	int col			  = 0;
+	while (!layout.complete && ((layout.lines <= line) || (at <= cx)))
+		{
+		if ((col < _width) && (at < len))
+			{
+			int run = (int) Utf8::plain(chars + at, MIN(len - at, _width - col));
+			at	+= run;
+			col += run;
+			}
+
+		// A full line has another after it, for the cursor at the end
+		if (at >= len)
+			{
+			if (col >= _width)
+				_add(layout, len);
+			layout.complete = true;
+			break;
+			}
+
+		// Anything that won't fit (a mark that combines with what's
+		// before it always does) starts the next line, unless it won't
+		// fit on a line of its own either
+		int width;
+		int bytes = _step(text, at, col, &width);
+		if ((col > 0) && (col + width > _width))
+			{
+			_add(layout, at);
+			col = 0;
+			continue;
+			}
+		at	+= bytes;
+		col += width;
+		}
+	}
+
+/*****************************************************************************\
+|* Another line has been found, starting at 'cx'. It only needs a break if
+|* it isn't 'width' on from the line before
+\*****************************************************************************/
+void WrapCache::_add(Layout& layout, int cx)
+	{
+	const Break& last = layout.breaks.back();
+	if (cx != last.cx + (layout.lines - last.line) * _width)
+		layout.breaks.push_back({.line = layout.lines, .cx = cx});
+	layout.lines ++;
+	}
+
+/*****************************************************************************\
+|* Where a line we've found starts
+\*****************************************************************************/
+int WrapCache::_start(const Layout& layout, int line)
+	{
+	auto found = std::upper_bound(layout.breaks.begin(),
+								  layout.breaks.end(),
+								  line,
+		[](int line, const Break& b) { return line < b.line; }) - 1;
+	return found->cx + (line - found->line) * _width;
+	}
+
+/*****************************************************************************\
+|* The tab or grapheme at 'at', 'col' columns into its line. Returns the
+|* bytes it takes, and sets 'width' to the columns. A tab goes up to the
+|* next tab stop, or the end of the line if that's sooner
+\*****************************************************************************/
+int WrapCache::_step(std::string_view text, int at, int col, int *width)
+	{
+	if (text[at] == '\t')
+		{
+		*width = _tabStop - (col % _tabStop);
+		if (col < _width)
+			*width = MIN(*width, _width - col);
+		return 1;
+		}
+	return Utf8::grapheme(text.data() + at, text.length() - at, width);
+	}
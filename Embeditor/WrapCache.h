@@ -0,0 +1,150 @@
+//
+//  WrapCache.h
+//  Embeditor
+//
+//  Created by Simon Gornall on 10/16/26.
+//
+
+#ifndef WrapCache_h
+#define WrapCache_h
+
+#include <climits>
+#include <string_view>
+#include <vector>
+
+#include "properties.h"
+#include "macros.h"
+#include "Allocator.h"
+
+/*****************************************************************************\
+|* Where rows wrap, when long rows are folded onto as many lines of the
+|* screen as they take rather than scrolled sideways. A row's lines are
+|* numbered from 0, and each starts where the one before it ran out of
+|* columns: a tab or grapheme that won't fit goes to the next line whole,
+|* and tabs are expanded from the start of the line they're on.
+|*
+|* Rows are laid out lazily, only as far down as has been asked for, and
+|* what's found is kept, so a row of megabytes that's only been looked at
+|* near the top is only measured near the top. An edit forgets the lines
+|* from the one it's in, since those before it can't have moved.
+|*
+|* Most lines of a long row are just the width of the screen in plain
+|* ASCII, so a row is kept as breaks: where a line starts that isn't
+|* 'width' bytes after the line before. Every line between two breaks is
+|* then a multiple of 'width' on from the first, and finding the line a
+|* column is in (or where a line starts) is a binary search of the breaks.
+|*
+|* Layouts are kept for CACHE_ROWS rows, by row number, which is plenty for
+|* the screen and the cursor's moves about it
+\*****************************************************************************/
+class WrapCache
+	{
+    NON_COPYABLE_NOR_MOVEABLE(WrapCache)
+
+	/*************************************************************************\
+    |* Typedefs and enums
+    \*************************************************************************/
+    public:
+		enum
+			{
+			CACHE_ROWS		= 256			// Rows laid out at once
+			};
+
+    protected:
+		typedef struct Break
+			{
+			int						line;	// Line that starts here
+			int						cx;		// ... at this column
+			} Break;
+
+		typedef std::vector<Break, StlAllocator<Break>> BreakList;
+
+		typedef struct Layout
+			{
+			int						row;	// Row laid out here, or -1
+			int						lines;	// Lines found so far
+			bool					complete;	// ... which is all of them
+			BreakList				breaks;	// Lines that aren't 'width' on
+			} Layout;
+
+	/*************************************************************************\
+    |* Properties
+    \*************************************************************************/
+    GET(int, width);					// Columns a line has
+    GET(int, tabStop);					// ... and between tab stops
+
+    protected:
+		std::vector<Layout>		_layouts;		// By row % CACHE_ROWS
+		bool					_any;			// ... if there are any
+
+    public:
+        /*********************************************************************\
+        |* Constructors and Destructor
+        \*********************************************************************/
+        explicit WrapCache();
+        ~WrapCache();
+
+        /*********************************************************************\
+        |* Where the breaks come from
+        \*********************************************************************/
+		void setAllocator(Allocator *allocator);
+
+        /*********************************************************************\
+        |* Lay rows out for lines this wide, with these tab stops. Changing
+        |* either forgets everything
+        \*********************************************************************/
+		void setLayout(int width, int tabStop);
+
+        /*********************************************************************\
+        |* Forget the rows from 'from' on, because they've changed or moved,
+        |* or (clear) everything, giving back the memory
+        \*********************************************************************/
+		void forget(int from = 0);
+		void clear(void);
+
+        /*********************************************************************\
+        |* A row has had text inserted or deleted at column 'cx'
+        \*********************************************************************/
+		void edited(int row, int cx);
+
+        /*********************************************************************\
+        |* The line that column 'cx' of a row is on. The end of a row is on
+        |* its last line, which is an empty one if the line before is full
+        \*********************************************************************/
+		int line(int row, std::string_view text, int cx);
+
+        /*********************************************************************\
+        |* The column a line of a row starts at, or -1 if there's no such line
+        \*********************************************************************/
+		int start(int row, std::string_view text, int line);
+
+        /*********************************************************************\
+        |* How many lines a row takes, measuring no more than 'most' of them
+        \*********************************************************************/
+		int lines(int row, std::string_view text, int most = INT_MAX);
+
+        /*********************************************************************\
+        |* The screen column that column 'cx' is drawn at, on its line, and
+        |* the column of the grapheme drawn at screen column 'rx' of a line.
+        |* That's the last grapheme on the line if 'rx' is past the end of it
+        \*********************************************************************/
+		int column(int row, std::string_view text, int cx);
+		int cx(int row, std::string_view text, int line, int rx);
+
+        /*********************************************************************\
+        |* The column of the grapheme that column 'cx' is part of, of the one
+        |* before it, and of the one after it
+        \*********************************************************************/
+		int snap(int row, std::string_view text, int cx);
+		int prev(int row, std::string_view text, int cx);
+		int next(int row, std::string_view text, int cx);
+
+    private:
+		Layout& _layout(int row);
+		void _measure(Layout& layout, std::string_view text, int cx, int line);
+		void _add(Layout& layout, int cx);
+		int  _start(const Layout& layout, int line);
+		int  _step(std::string_view text, int at, int col, int *width);
+	};
+
+#endif /* WrapCache_h */
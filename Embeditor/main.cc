@@ -4,14 +4,113 @@
 //
 //  Created by Simon Gornall on 8/10/23.
 //
-#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <unistd.h>
+
+#include "Allocator.h"
 #include "Editor.h"
 
-int main(int argc, const char * argv[])
+#define SYNTAX_DIR		"/usr/share/embeditor/syntax"
+
+int main(int argc, char * const argv[])
 	{
 	Editor e;
-	if (argc > 1)
-		e.open(argv[1]);
+	bool view	= false;
+	bool follow	= false;
+	bool bench	= false;
+	bool hex	= false;
+	const char *syntax = getenv("EMBEDITOR_SYNTAX");
+	if (syntax == nullptr)
+		syntax = SYNTAX_DIR;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "bfim:s:vwx")) != -1)
+		{
+		switch (opt)
+			{
+			case 'b':
+				bench = true;
+				break;
+			case 'f':
+				follow = true;
+				break;
+			case 'i':
+				e.setUseIndex(true);
+				break;
+			case 'm':
+				{
+				// The editor draws on the pool until it exits
+				size_t megs		 = (size_t) atol(optarg);
+				StaticPool *pool = new (std::nothrow) StaticPool(megs << 20);
+				if ((megs == 0) || (pool == nullptr) || (pool->capacity() == 0))
+					{
+					fprintf(stderr, "Can't set aside %sMB\n", optarg);
+					return 1;
+					}
+				e.setAllocator(pool);
+				break;
+				}
+			case 's':
+				syntax = optarg;
+				break;
+			case 'v':
+				view = true;
+				break;
+			case 'w':
+				e.wrap(true);
+				break;
+			case 'x':
+				hex = true;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-b] [-f] [-i] [-m MB] [-s dir] [-v] [-w] [-x] [file]\n"
+								"  -b  time highlighting the file in each "
+								"language, and exit\n"
+								"  -f  follow lines appended to the file\n"
+								"  -i  index the file for faster searches\n"
+								"  -m  keep the file in a pool of this many "
+								"MB, set aside up front\n"
+								"  -s  load syntax definitions from here "
+								"(default $EMBEDITOR_SYNTAX or\n"
+								"      " SYNTAX_DIR ")\n"
+								"  -v  view the file read-only, without "
+								"loading it all\n"
+								"  -w  wrap long lines rather than "
+								"scrolling sideways\n"
+								"  -x  edit the file in hex, patching it "
+								"in place (read-only with -v)\n",
+						argv[0]);
+				return 1;
+			}
+		}
+	
+	e.loadSyntax(syntax);
+	if (bench)
+		{
+		if (optind >= argc)
+			{
+			fprintf(stderr, "-b needs a file to time\n");
+			return 1;
+			}
+		e.benchmark(argv[optind]);
+		return 0;
+		}
+	
+	if (optind < argc)
+		{
+		if (hex)
+			e.hex(argv[optind], view);
+		else if (view)
+			e.view(argv[optind]);
+		else
+			e.open(argv[optind]);
+		
+		if (follow)
+			e.follow(true);
+		}
 	e.edit();
 	
 	return 0;